@@ -0,0 +1,280 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_COLUMN_BATCH_H_
+#define STDEX_DATA_COLUMN_BATCH_H_
+
+#include "data_meta.h"
+
+namespace stdex {
+
+//a query result laid out column by column. every column keeps its values
+//in one contiguous array of its own type, strings as offsets into a
+//shared byte buffer, and a bitmap marks the null rows. null rows still
+//take a zero or empty slot so row i is always at index i
+class ColumnBatch
+{
+public:
+	enum Type
+	{
+		TYPE_NULL,
+		TYPE_INT,
+		TYPE_BIGINT,
+		TYPE_FLOAT,
+		TYPE_DOUBLE,
+		TYPE_STRING,
+	};
+
+	struct Column
+	{
+		string name;
+		Type type;
+
+		std::vector<int32_t> ints;
+		std::vector<int64_t> bigints;
+		std::vector<float> floats;
+		std::vector<double> doubles;
+
+		//string i is chars[offsets[i], offsets[i+1])
+		std::vector<size_t> offsets;
+		std::vector<char> chars;
+
+		//bit i is set when row i is null
+		std::vector<uint8_t> nulls;
+		size_t null_count;
+	};
+
+	ColumnBatch()
+	{
+		_rows = 0;
+	}
+
+	//drops all rows but keeps the allocated arrays for the next query
+	void reset(size_t column_num)
+	{
+		_columns.resize(column_num);
+		_rows = 0;
+
+		for (size_t i=0; i<column_num; i++)
+		{
+			Column &column = _columns[i];
+			column.name.clear();
+			column.type = TYPE_NULL;
+			column.ints.clear();
+			column.bigints.clear();
+			column.floats.clear();
+			column.doubles.clear();
+			column.offsets.clear();
+			column.chars.clear();
+			column.nulls.clear();
+			column.null_count = 0;
+		}
+	}
+
+	size_t column_count() const
+	{
+		return _columns.size();
+	}
+
+	size_t row_count() const
+	{
+		return _rows;
+	}
+
+	const Column &column(size_t col) const
+	{
+		return _columns[col];
+	}
+
+	bool is_null(size_t col, size_t row) const
+	{
+		const Column &column = _columns[col];
+		return column.type == TYPE_NULL || (column.nulls[row >> 3] >> (row & 7)) & 1;
+	}
+
+	const char *string_data(size_t col, size_t row) const
+	{
+		const Column &column = _columns[col];
+		return column.chars.data() + column.offsets[row];
+	}
+
+	size_t string_size(size_t col, size_t row) const
+	{
+		const Column &column = _columns[col];
+		return column.offsets[row + 1] - column.offsets[row];
+	}
+
+	//a single cell as a Meta, for code that still wants row access
+	Meta get(size_t col, size_t row) const
+	{
+		const Column &column = _columns[col];
+		if (is_null(col, row))
+			return Meta();
+
+		switch (column.type)
+		{
+		case TYPE_INT:
+			return Meta(column.ints[row]);
+		case TYPE_BIGINT:
+			return Meta(column.bigints[row]);
+		case TYPE_FLOAT:
+			return Meta(column.floats[row]);
+		case TYPE_DOUBLE:
+			return Meta(column.doubles[row]);
+		default:
+		{
+			Meta meta;
+			meta.assign(string_data(col, row), string_size(col, row));
+			return meta;
+		}
+		}
+	}
+
+	//the rest is used by the data sources while filling the batch, one
+	//value per column and then end_row()
+
+	void set_column(size_t col, const string &name, Type type)
+	{
+		_columns[col].name = name;
+		set_type(col, type);
+	}
+
+	//fixes the type of a column that was TYPE_NULL so far, the rows
+	//already added become null slots of the new type
+	void set_type(size_t col, Type type)
+	{
+		Column &column = _columns[col];
+		column.type = type;
+
+		switch (type)
+		{
+		case TYPE_INT:
+			column.ints.assign(_rows, 0);
+			break;
+		case TYPE_BIGINT:
+			column.bigints.assign(_rows, 0);
+			break;
+		case TYPE_FLOAT:
+			column.floats.assign(_rows, 0);
+			break;
+		case TYPE_DOUBLE:
+			column.doubles.assign(_rows, 0);
+			break;
+		case TYPE_STRING:
+			column.offsets.assign(_rows + 1, 0);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void append_null(size_t col)
+	{
+		Column &column = _columns[col];
+
+		switch (column.type)
+		{
+		case TYPE_INT:
+			column.ints.push_back(0);
+			break;
+		case TYPE_BIGINT:
+			column.bigints.push_back(0);
+			break;
+		case TYPE_FLOAT:
+			column.floats.push_back(0);
+			break;
+		case TYPE_DOUBLE:
+			column.doubles.push_back(0);
+			break;
+		case TYPE_STRING:
+			column.offsets.push_back(column.chars.size());
+			break;
+		default:
+			break;
+		}
+
+		mark_row(column)[_rows >> 3] |= 1 << (_rows & 7);
+		column.null_count++;
+	}
+
+	void append_int(size_t col, int32_t val)
+	{
+		mark_row(_columns[col]);
+		_columns[col].ints.push_back(val);
+	}
+
+	void append_bigint(size_t col, int64_t val)
+	{
+		mark_row(_columns[col]);
+		_columns[col].bigints.push_back(val);
+	}
+
+	void append_float(size_t col, float val)
+	{
+		mark_row(_columns[col]);
+		_columns[col].floats.push_back(val);
+	}
+
+	void append_double(size_t col, double val)
+	{
+		mark_row(_columns[col]);
+		_columns[col].doubles.push_back(val);
+	}
+
+	//reserves len bytes for the next string of the column and returns
+	//where to write them
+	char *append_string(size_t col, size_t len)
+	{
+		Column &column = _columns[col];
+		mark_row(column);
+
+		size_t offset = column.chars.size();
+		column.chars.resize(offset + len);
+		column.offsets.push_back(offset + len);
+		return column.chars.data() + offset;
+	}
+
+	void append_string(size_t col, const char *data, size_t len)
+	{
+		char *dst = append_string(col, len);
+		if (len)
+			memcpy(dst, data, len);
+	}
+
+	void end_row()
+	{
+		_rows++;
+	}
+
+private:
+	//grows the null bitmap to cover the row being added
+	std::vector<uint8_t> &mark_row(Column &column)
+	{
+		if ((_rows >> 3) >= column.nulls.size())
+			column.nulls.push_back(0);
+
+		return column.nulls;
+	}
+
+	std::vector<Column> _columns;
+	size_t _rows;
+};
+
+}
+#endif //STDEX_DATA_COLUMN_BATCH_H_
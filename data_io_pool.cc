@@ -0,0 +1,104 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_io_pool.h"
+namespace stdex {
+
+static thread_local int worker_index = -1;
+
+IoPool::IoPool(size_t thread_num)
+{
+	_running = true;
+
+	if (thread_num == 0)
+		thread_num = 1;
+
+	for (size_t i = 0; i < thread_num; i++)
+		_threads.push_back(std::thread(&IoPool::worker_loop, this, (int)i));
+}
+
+IoPool::~IoPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+
+	_cond.notify_all();
+
+	for (size_t i = 0; i < _threads.size(); i++)
+		_threads[i].join();
+}
+
+bool IoPool::post(Task task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_running)
+			return false;
+
+		_tasks.push_back(std::move(task));
+	}
+
+	_cond.notify_one();
+	return true;
+}
+
+size_t IoPool::size() const
+{
+	return _threads.size();
+}
+
+size_t IoPool::pending() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _tasks.size();
+}
+
+int IoPool::current_worker()
+{
+	return worker_index;
+}
+
+void IoPool::worker_loop(int index)
+{
+	worker_index = index;
+
+	while (true)
+	{
+		Task task;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (_running && _tasks.empty())
+				_cond.wait(lock);
+
+			//the queue is drained before the workers leave
+			if (_tasks.empty())
+				break;
+
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+}
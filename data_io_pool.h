@@ -0,0 +1,66 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_IO_POOL_H_
+#define STDEX_DATA_IO_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+namespace stdex {
+
+//a fixed set of threads that run blocking driver calls, so callers that
+//must not block (coroutines, event loops) hand the call over instead
+class IoPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit IoPool(size_t thread_num=4);
+	//runs the tasks still queued, then joins the threads
+	~IoPool();
+
+	//false once the pool is shutting down, the task is not run then
+	bool post(Task task);
+
+	size_t size() const;
+	size_t pending() const;
+
+	//index of the worker running the caller, -1 off the pool. lets a
+	//task pick a connection owned by its thread
+	static int current_worker();
+
+private:
+	IoPool(const IoPool &) = delete;
+	IoPool &operator=(const IoPool &) = delete;
+
+	void worker_loop(int index);
+
+	std::vector<std::thread> _threads;
+	std::deque<Task> _tasks;
+	mutable std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _running;
+};
+
+}
+#endif //STDEX_DATA_IO_POOL_H_
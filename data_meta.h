@@ -49,283 +49,366 @@ class Meta
 public:
 	Meta()
 	{
-		type = TYPE_NULL;
+		_local.type = TYPE_NULL;
+		_local.size = 0;
+		_number.number_i64 = 0;
 	}
 
     inline Meta(const Meta &other)
     {
-        type = other.type;
-
-        if (type == TYPE_STRING)
-            _string = other._string;
-        else
-            _number = other._number;
+        _local.type = TYPE_NULL;
+        _local.size = 0;
+        copy_from(other);
     }
 
     inline Meta(Meta &&other)
     {
-        type = other.type;
+        take(other);
+    }
 
-        if (type == TYPE_STRING)
-            _string = std::move(other._string);
-        else
-            _number = other._number;
+    inline ~Meta()
+    {
+        release();
     }
 
 #ifdef _MSC_VER
     inline Meta(size_t val)
     {
-        type = TYPE_INT;
+        _number.type = TYPE_INT;
         _number.number_i32 = (int32_t)val;
     }
 
 	inline Meta(long val)
 	{
-		type = TYPE_INT;
+		_number.type = TYPE_INT;
 		_number.number_i32 = (int32_t)val;
 	}
 #endif	
 	
     inline Meta(int32_t val)
     {
-        type = TYPE_INT;
+        _number.type = TYPE_INT;
         _number.number_i32 = val;
     }
 
     inline Meta(uint32_t val)
     {
-        type = TYPE_INT;
+        _number.type = TYPE_INT;
         _number.number_i32 = (int32_t)val;
     }
 
     inline Meta(int64_t val)
     {
-        type = TYPE_BIGINT;
+        _number.type = TYPE_BIGINT;
         _number.number_i64 = val;
     }
 
     inline Meta(uint64_t val)
     {
-        type = TYPE_BIGINT;
+        _number.type = TYPE_BIGINT;
         _number.number_i64 = val;
     }
 	
     inline Meta(float val)
     {
-        type = TYPE_FLOAT;
+        _number.type = TYPE_FLOAT;
         _number.number_f32 = val;
     }
 
     inline Meta(double val)
     {
-        type = TYPE_DOUBLE;
+        _number.type = TYPE_DOUBLE;
         _number.number_f64 = val;
     }
 
     inline Meta(const string &val)
     {
-        type = TYPE_STRING;
-        _string = val;
+        _local.type = TYPE_NULL;
+        _local.size = 0;
+        set_string(val.data(), val.size());
     }
 
     inline Meta(string &&val)
     {
-        type = TYPE_STRING;
-        _string = std::move(val);
+        _local.type = TYPE_NULL;
+        _local.size = 0;
+        set_string(std::move(val));
     }
 
     inline Meta(const char *val)
     {
-        type = TYPE_STRING;
-        _string = val;
+        _local.type = TYPE_NULL;
+        _local.size = 0;
+        set_string(val, strlen(val));
     }
 
 	inline Meta &operator=(const Meta &other)
     {
-        type = other.type;
-
-        if (type == TYPE_STRING)
-            _string = other._string;
-        else
-            _number = other._number;
+        if (this != &other)
+            copy_from(other);
 
         return *this;
     }
 
     inline Meta &operator=(Meta &&other)
     {
-        type = other.type;
+        if (this == &other)
+            return *this;
 
-        if (type == TYPE_STRING)
-            _string = std::move(other._string);
-        else
-            _number = other._number;
+        //keep our own std::string when the other side has nothing to
+        //hand over, so reused rows do not reallocate
+        if (is_std_string() && other.is_string() && other._local.size <= LOCAL_CAPACITY)
+        {
+            _string.str->assign(other._local.data, other._local.size);
+            return *this;
+        }
 
+        release();
+        take(other);
         return *this;
     }
 
     inline Meta &operator=(int32_t val)
     {
-        type = TYPE_INT;
+        set_number(TYPE_INT);
         _number.number_i32 = val;
         return *this;
     }
 
     inline Meta &operator=(uint32_t val)
     {
-        type = TYPE_INT;
+        set_number(TYPE_INT);
         _number.number_i32 = (int32_t)val;
         return *this;
     }
 
     inline Meta &operator=(int64_t val)
     {
-        type = TYPE_BIGINT;
+        set_number(TYPE_BIGINT);
         _number.number_i64 = val;
         return *this;
     }
 
     inline Meta &operator=(float val)
     {
-        type = TYPE_FLOAT;
+        set_number(TYPE_FLOAT);
         _number.number_f32 = val;
         return *this;
     }
 
     inline Meta &operator=(double val)
     {
-        type = TYPE_DOUBLE;
+        set_number(TYPE_DOUBLE);
         _number.number_f64 = val;
         return *this;
     }
 
     inline Meta &operator=(const string &val)
     {
-        type = TYPE_STRING;
-        _string = val;
+        set_string(val.data(), val.size());
         return *this;
     }
 
     inline Meta &operator=(string &&val)
     {
-        type = TYPE_STRING;
-        _string = std::move(val);
+        set_string(std::move(val));
         return *this;
     }
 
     inline Meta &operator=(const char *val)
     {
-        type = TYPE_STRING;
-        _string = val;
+        set_string(val, strlen(val));
         return *this;
     }
 
+    //stores a string of len bytes, reusing the current buffer
+    //when it is large enough
+    inline void assign(const char *data, size_t len)
+    {
+        set_string(data, len);
+    }
+
+    //points the meta at len bytes it does not own, they have to outlive
+    //it. moves keep pointing at the same bytes, copies own theirs
+    inline void assign_view(const char *data, size_t len)
+    {
+        release();
+        _heap.type = TYPE_STRING;
+        _heap.size = VIEW_CHARS;
+        _heap.spare = 0;
+        _heap.length = (uint32_t)len;
+        _heap.data = const_cast<char *>(data);
+    }
+
     inline bool is_null() const
     {
-    	return type == TYPE_NULL;
+    	return _local.type == TYPE_NULL;
     }
 
     inline bool is_integer() const
     {
-    	return type == TYPE_INT;
+    	return _local.type == TYPE_INT;
     }
 
     inline bool is_bigint() const
     {
-    	return type == TYPE_BIGINT;
+    	return _local.type == TYPE_BIGINT;
     }
 
     inline bool is_float() const
     {
-    	return type == TYPE_FLOAT;
+    	return _local.type == TYPE_FLOAT;
     }
 
     inline bool is_double() const
     {
-    	return type == TYPE_DOUBLE;
+    	return _local.type == TYPE_DOUBLE;
     }
 
     inline bool is_string() const
     {
-    	return type == TYPE_STRING;
+    	return _local.type == TYPE_STRING;
     }
 
+    //on a string meta these drop the string and hand out a zero of the
+    //asked type, as a write through them makes the meta that number
     inline int32_t &int_ref()
     {
-        return _number.number_i32;
+        return number_ref(TYPE_INT).number_i32;
+    }
+
+    inline int32_t &integer_ref()
+    {
+        return int_ref();
     }
 
     inline int64_t &bigint_ref()
     {
-        return _number.number_i64;
+        return number_ref(TYPE_BIGINT).number_i64;
     }
 
     inline float &float_ref()
     {
-        return _number.number_f32;
+        return number_ref(TYPE_FLOAT).number_f32;
     }
 
     inline double &double_ref()
     {
-        return _number.number_f64;
+        return number_ref(TYPE_DOUBLE).number_f64;
     }
 
+    //switches the value over to a heap std::string, so it allocates
+    //unless the value already is one, and a non string meta becomes a
+    //string. the returned reference stays valid until the meta is
+    //reassigned. string_data/string_size read without changing anything
     inline string &string_ref()
     {
-        return _string;
+        if (is_std_string())
+            return *_string.str;
+
+        string *str;
+        if (is_string())
+            str = new string(string_data(), string_size());
+        else
+            str = new string();
+
+        release();
+        _string.type = TYPE_STRING;
+        _string.size = STD_STRING;
+        _string.str = str;
+        return *str;
     }
 
     inline int32_t get_int() const
     {
-        return _number.number_i32;
+        return is_string() ? 0 : _number.number_i32;
+    }
+
+    inline int32_t get_integer() const
+    {
+        return get_int();
     }
 
     inline int64_t get_bigint() const
     {
-        return _number.number_i64;
+        return is_string() ? 0 : _number.number_i64;
     }
 
     inline float get_float() const
     {
-        return _number.number_f32;
+        return is_string() ? 0 : _number.number_f32;
     }
 
     inline double get_double() const
     {
-        return _number.number_f64;
+        return is_string() ? 0 : _number.number_f64;
     }
 
     inline string get_string() const
     {
-        return _string;
+        if (is_std_string())
+            return *_string.str;
+        else if (is_string())
+            return string(string_data(), string_size());
+
+        return string();
+    }
+
+    //borrow the string bytes without building a std::string, valid
+    //until the meta is modified. the data is not null terminated
+    inline const char *string_data() const
+    {
+        if (is_std_string())
+            return _string.str->data();
+        else if (is_heap_chars() || is_view_chars())
+            return _heap.data;
+
+        return _local.data;
+    }
+
+    inline size_t string_size() const
+    {
+        if (!is_string())
+            return 0;
+        else if (is_std_string())
+            return _string.str->size();
+        else if (is_heap_chars() || is_view_chars())
+            return _heap.length;
+
+        return _local.size;
     }
 
-    inline string&& move_string()
+    //only a heap std::string is moved out, the other forms are copied
+    //from their bytes without being promoted first
+    inline string move_string()
     {
-        return std::move(_string);
+        if (is_std_string())
+            return std::move(*_string.str);
+
+        return string(string_data(), string_size());
     }
 
     inline string to_string() const
     {
-    	if (type == TYPE_INT)
+    	if (_local.type == TYPE_INT)
     	{
     		return std::to_string(_number.number_i32);
     	}
-    	else if (type == TYPE_BIGINT)
+    	else if (_local.type == TYPE_BIGINT)
     	{
     		return std::to_string(_number.number_i64);
     	}
-    	else if (type == TYPE_FLOAT)
+    	else if (_local.type == TYPE_FLOAT)
     	{
     		return std::to_string(_number.number_f32);
     	}
-    	else if (type == TYPE_DOUBLE)
+    	else if (_local.type == TYPE_DOUBLE)
     	{
     		return std::to_string(_number.number_f64);
     	}
-    	else if (type == TYPE_STRING)
+    	else if (_local.type == TYPE_STRING)
     	{
-    		return _string;
+    		return get_string();
     	}
 
     	return string();
@@ -342,20 +425,206 @@ private:
 		TYPE_STRING,
 	};
 
-    Type type;
+	//a string of up to LOCAL_CAPACITY bytes is stored inline and the
+	//size byte holds its length, larger values use one of the markers
+	enum
+	{
+		LOCAL_CAPACITY = 14,
+		VIEW_CHARS = 0xfd,
+		HEAP_CHARS = 0xfe,
+		STD_STRING = 0xff,
+	};
+
+    inline bool is_heap_chars() const
+    {
+        return _local.type == TYPE_STRING && _local.size == HEAP_CHARS;
+    }
+
+    inline bool is_std_string() const
+    {
+        return _local.type == TYPE_STRING && _local.size == STD_STRING;
+    }
 
-    union Number
+    inline bool is_view_chars() const
     {
-    	int32_t number_i32;
-    	int64_t number_i64;
-    	float number_f32;
-    	double number_f64;
-		Number() : number_i64(0) {}
+        return _local.type == TYPE_STRING && _local.size == VIEW_CHARS;
+    }
+
+    inline void release()
+    {
+        if (is_std_string())
+            delete _string.str;
+        else if (is_heap_chars())
+            delete[] _heap.data;
+    }
+
+    inline void take(Meta &other)
+    {
+        if (other.is_std_string())
+        {
+            _string = other._string;
+            other._local.size = 0;
+        }
+        else if (other.is_heap_chars())
+        {
+            _heap = other._heap;
+            other._local.size = 0;
+        }
+        else if (other.is_string())
+            _local = other._local;
+        else
+            _number = other._number;
+    }
+
+    //a heap buffer holds length + spare bytes. spare is capped, so a
+    //buffer reused for a much shorter string forgets some of its room
+    inline size_t heap_capacity() const
+    {
+        return (size_t)_heap.length + _heap.spare;
+    }
+
+    inline void set_heap_length(size_t len, size_t capacity)
+    {
+        size_t spare = capacity - len;
+        _heap.length = (uint32_t)len;
+        _heap.spare = (uint16_t)(spare < 0xffff ? spare : 0xffff);
+    }
+
+    inline void set_number(Type type)
+    {
+        release();
+        _number.type = type;
+    }
+
+    //data may point into this meta's own bytes, so it is copied out
+    //before the old storage is released, and moved when it is reused
+    inline void set_string(const char *data, size_t len)
+    {
+        if (is_std_string())
+        {
+            _string.str->assign(data, len);
+        }
+        else if (len <= LOCAL_CAPACITY)
+        {
+            char chars[LOCAL_CAPACITY];
+            memcpy(chars, data, len);
+
+            release();
+            _local.type = TYPE_STRING;
+            _local.size = (uint8_t)len;
+            memcpy(_local.data, chars, len);
+        }
+        else if (is_heap_chars() && heap_capacity() >= len)
+        {
+            size_t capacity = heap_capacity();
+            memmove(_heap.data, data, len);
+            set_heap_length(len, capacity);
+        }
+        else
+        {
+            char *buf = new char[len];
+            memcpy(buf, data, len);
+
+            release();
+            _heap.type = TYPE_STRING;
+            _heap.size = HEAP_CHARS;
+            set_heap_length(len, len);
+            _heap.data = buf;
+        }
+    }
+
+    inline void set_string(string &&val)
+    {
+        if (is_std_string())
+        {
+            *_string.str = std::move(val);
+        }
+        else if (val.size() <= LOCAL_CAPACITY)
+        {
+            set_string(val.data(), val.size());
+        }
+        else
+        {
+            string *str = new string(std::move(val));
+            release();
+            _string.type = TYPE_STRING;
+            _string.size = STD_STRING;
+            _string.str = str;
+        }
+    }
+
+    inline void copy_from(const Meta &other)
+    {
+        if (other.is_string())
+            set_string(other.string_data(), other.string_size());
+        else
+        {
+            release();
+            _number = other._number;
+        }
+    }
+
+    //every representation starts with the type byte, so it can be
+    //read through any of them
+    struct NumberRep
+    {
+        uint8_t type;
+        union
+        {
+            int32_t number_i32;
+            int64_t number_i64;
+            float number_f32;
+            double number_f64;
+        };
+    };
+
+    struct LocalRep
+    {
+        uint8_t type;
+        uint8_t size;
+        char data[LOCAL_CAPACITY];
     };
 
-    Number _number;
-    string _string;
+    struct HeapRep
+    {
+        uint8_t type;
+        uint8_t size;
+        uint16_t spare;
+        uint32_t length;
+        char *data;
+    };
+
+    struct StringRep
+    {
+        uint8_t type;
+        uint8_t size;
+        string *str;
+    };
+
+    union
+    {
+        NumberRep _number;
+        LocalRep _local;
+        HeapRep _heap;
+        StringRep _string;
+    };
+
+    //the number of a string meta shares its storage with the string, so
+    //asking one for a number reference turns it into a zero of that type
+    inline NumberRep &number_ref(Type type)
+    {
+        if (is_string())
+        {
+            release();
+            _number.type = type;
+            _number.number_i64 = 0;
+        }
+
+        return _number;
+    }
 };
 
+static_assert(sizeof(Meta) == 16, "stdex::Meta is expected to be 16 bytes");
+
 }
 #endif //STDEX_DATA_META_H_
\ No newline at end of file
@@ -0,0 +1,405 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_parallel_scan.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+namespace stdex {
+
+//rows travel from a range to the callback in chunks, so the lock is
+//taken once per chunk rather than once per row
+static const size_t scan_chunk_rows = 256;
+
+typedef std::vector<std::vector<Meta>> ScanChunk;
+
+struct ScanRange
+{
+	string sql;
+	std::vector<Meta> in;
+
+	std::deque<ScanChunk> chunks;
+	bool done;
+	int code;
+};
+
+struct ScanState
+{
+	std::vector<ScanRange> ranges;
+	size_t max_chunks;
+	bool stop;
+
+	std::mutex mutex;
+	std::condition_variable readable;
+	std::vector<std::condition_variable> writable;
+};
+
+ScanOptions::ScanOptions()
+{
+	partitions = 4;
+	ordered = false;
+	split = SCAN_SPLIT_AUTO;
+	columns = "*";
+	queue_rows = 16 * scan_chunk_rows;
+}
+
+static bool is_whole(const Meta &meta)
+{
+	return meta.is_integer() || meta.is_bigint();
+}
+
+static int64_t whole_value(const Meta &meta)
+{
+	return meta.is_integer() ? meta.get_int() : meta.get_bigint();
+}
+
+static string scan_filter(const ScanOptions &options)
+{
+	if (options.where.empty())
+		return string();
+
+	return " WHERE (" + options.where + ")";
+}
+
+static string scan_and(const ScanOptions &options)
+{
+	if (options.where.empty())
+		return " WHERE ";
+
+	return " WHERE (" + options.where + ") AND ";
+}
+
+static int read_single(const ScanRunner &runner, const string &sql, std::vector<Meta> &row)
+{
+	std::vector<Meta> in;
+	bool found = false;
+
+	int ret = runner(sql, in, [&row, &found](std::vector<Meta> &r) {
+		row.swap(r);
+		found = true;
+		return false;
+	});
+
+	if (ret)
+		return ret;
+
+	return found ? 0 : 1;
+}
+
+//the lower bounds of every range but the first, strictly increasing.
+//fewer than partitions-1 come back when the key has few distinct values
+static int split_range(const ScanRunner &runner, const string &table, const string &key_column,
+	const ScanOptions &options, std::vector<Meta> &bounds)
+{
+	size_t partitions = options.partitions;
+	std::vector<Meta> row;
+
+	if (options.split != SCAN_SPLIT_QUANTILE)
+	{
+		string sql = "SELECT MIN(" + key_column + "), MAX(" + key_column + ") FROM " + table + scan_filter(options);
+		if (read_single(runner, sql, row) || row.size() != 2)
+			return 1;
+
+		//an empty table, one range does
+		if (row[0].is_null())
+			return 0;
+
+		if (is_whole(row[0]) && is_whole(row[1]))
+		{
+			int64_t low = whole_value(row[0]);
+			uint64_t span = (uint64_t)whole_value(row[1]) - (uint64_t)low;
+
+			for (size_t i=1; i<partitions; i++)
+			{
+				int64_t bound = (int64_t)((uint64_t)low + span / partitions * i + span % partitions * i / partitions);
+				if (bound > low && (bounds.empty() || bound > whole_value(bounds.back())))
+					bounds.push_back(Meta(bound));
+			}
+
+			return 0;
+		}
+
+		if (options.split == SCAN_SPLIT_MINMAX)
+			return 1;
+	}
+
+	string sql = "SELECT COUNT(*) FROM " + table + scan_filter(options);
+	if (read_single(runner, sql, row) || row.size() != 1)
+		return 1;
+
+	int64_t count = whole_value(row[0]);
+
+	for (size_t i=1; i<partitions; i++)
+	{
+		int64_t offset = count * (int64_t)i / (int64_t)partitions;
+		if (offset == 0)
+			continue;
+
+		sql = "SELECT " + key_column + " FROM " + table + scan_and(options) + key_column + " IS NOT NULL ORDER BY "
+			+ key_column + " LIMIT 1 OFFSET " + std::to_string(offset);
+
+		if (read_single(runner, sql, row))
+			continue;
+
+		//a key value spanning several quantiles yields one range
+		if (row[0].is_null() || (!bounds.empty() && bounds.back().to_string() == row[0].to_string()))
+			continue;
+
+		bounds.push_back(row[0]);
+	}
+
+	return 0;
+}
+
+static void plan_ranges(const string &table, const string &key_column, const ScanOptions &options,
+	const std::vector<Meta> &bounds, std::vector<ScanRange> &ranges)
+{
+	string head = "SELECT " + options.columns + " FROM " + table + scan_and(options);
+	string tail = options.ordered ? " ORDER BY " + key_column : string();
+
+	ranges.resize(bounds.size() + 1);
+
+	for (size_t i=0; i<ranges.size(); i++)
+	{
+		ScanRange &range = ranges[i];
+		range.done = false;
+		range.code = 0;
+
+		string cond;
+		if (i == 0 && bounds.empty())
+			cond = "1=1";
+		else if (i == 0)
+			cond = "(" + key_column + " < ? OR " + key_column + " IS NULL)";
+		else if (i == bounds.size())
+			cond = key_column + " >= ?";
+		else
+			cond = key_column + " >= ? AND " + key_column + " < ?";
+
+		if (i > 0)
+			range.in.push_back(bounds[i - 1]);
+		if (i < bounds.size())
+			range.in.push_back(bounds[i]);
+
+		range.sql = head + cond + tail;
+	}
+}
+
+static bool push_chunk(ScanState &state, size_t index, ScanChunk &chunk)
+{
+	std::unique_lock<std::mutex> lock(state.mutex);
+	ScanRange &range = state.ranges[index];
+
+	while (!state.stop && range.chunks.size() >= state.max_chunks)
+		state.writable[index].wait(lock);
+
+	if (state.stop)
+		return false;
+
+	range.chunks.push_back(std::move(chunk));
+	state.readable.notify_one();
+	return true;
+}
+
+static void scan_range(const ScanRunner &runner, ScanState &state, size_t index)
+{
+	ScanRange &range = state.ranges[index];
+	ScanChunk chunk;
+	bool stopped = false;
+
+	int ret = runner(range.sql, range.in, [&](std::vector<Meta> &row) {
+		chunk.push_back(std::move(row));
+		if (chunk.size() < scan_chunk_rows)
+			return true;
+
+		if (!push_chunk(state, index, chunk))
+		{
+			stopped = true;
+			return false;
+		}
+
+		chunk.clear();
+		chunk.reserve(scan_chunk_rows);
+		return true;
+	});
+
+	if (!ret && !stopped && !chunk.empty())
+		push_chunk(state, index, chunk);
+
+	std::lock_guard<std::mutex> lock(state.mutex);
+	range.code = ret;
+	range.done = true;
+	state.readable.notify_one();
+}
+
+static void pop_chunk(ScanState &state, size_t index, ScanChunk &chunk)
+{
+	ScanRange &range = state.ranges[index];
+	chunk = std::move(range.chunks.front());
+	range.chunks.pop_front();
+	state.writable[index].notify_one();
+}
+
+//the next chunk to hand to the callback, false once nothing is left.
+//ordered scans drain the ranges one after another, the others take
+//from whichever range has rows
+static bool take_chunk(ScanState &state, bool ordered, size_t &current, ScanChunk &chunk)
+{
+	std::unique_lock<std::mutex> lock(state.mutex);
+	size_t range_num = state.ranges.size();
+
+	while (ordered)
+	{
+		if (current == range_num)
+			return false;
+
+		ScanRange &range = state.ranges[current];
+
+		if (!range.chunks.empty())
+		{
+			pop_chunk(state, current, chunk);
+			return true;
+		}
+
+		if (range.done)
+			current++;
+		else
+			state.readable.wait(lock);
+	}
+
+	while (true)
+	{
+		size_t done = 0;
+
+		for (size_t i=0; i<range_num; i++)
+		{
+			size_t index = (current + i) % range_num;
+			ScanRange &range = state.ranges[index];
+
+			if (!range.chunks.empty())
+			{
+				pop_chunk(state, index, chunk);
+				current = (index + 1) % range_num;
+				return true;
+			}
+
+			if (range.done)
+				done++;
+		}
+
+		if (done == range_num)
+			return false;
+
+		state.readable.wait(lock);
+	}
+}
+
+int parallel_scan(const ScanRunner &runner, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback)
+{
+	std::vector<Meta> bounds;
+
+	if (options.partitions > 1 && split_range(runner, table, key_column, options, bounds))
+		return 1;
+
+	ScanState state;
+	state.max_chunks = std::max<size_t>(options.queue_rows / scan_chunk_rows, 1);
+	state.stop = false;
+	plan_ranges(table, key_column, options, bounds, state.ranges);
+	state.writable = std::vector<std::condition_variable>(state.ranges.size());
+
+	std::vector<std::thread> threads;
+	for (size_t i=0; i<state.ranges.size(); i++)
+		threads.push_back(std::thread(scan_range, std::cref(runner), std::ref(state), i));
+
+	size_t current = 0;
+	ScanChunk chunk;
+	bool stopped = false;
+
+	while (!stopped && take_chunk(state, options.ordered, current, chunk))
+	{
+		for (size_t i=0; i<chunk.size(); i++)
+		{
+			if (!callback(chunk[i]))
+			{
+				stopped = true;
+				break;
+			}
+		}
+	}
+
+	if (stopped)
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.stop = true;
+
+		for (size_t i=0; i<state.writable.size(); i++)
+			state.writable[i].notify_all();
+	}
+
+	for (size_t i=0; i<threads.size(); i++)
+		threads[i].join();
+
+	if (stopped)
+		return 0;
+
+	for (size_t i=0; i<state.ranges.size(); i++)
+	{
+		if (state.ranges[i].code)
+			return 2;
+	}
+
+	return 0;
+}
+
+#ifdef STDEX_HAS_MYSQL
+int parallel_scan(MysqlPool &pool, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback)
+{
+	ScanRunner runner = [&pool](const string &sql, std::vector<Meta> &in, const RowCallback &cb) {
+		MysqlPool::Lease conn = pool.acquire();
+		if (!conn)
+			return 1;
+
+		return conn->query_each(sql, in, cb);
+	};
+
+	return parallel_scan(runner, table, key_column, options, callback);
+}
+#endif
+
+#ifdef STDEX_HAS_SQLITE
+int parallel_scan(const string &filename, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback)
+{
+	ScanRunner runner = [&filename](const string &sql, std::vector<Meta> &in, const RowCallback &cb) {
+		//each range has the connection to itself, sqlite needs no
+		//locking around it
+		DataSourceSqlite conn;
+		if (conn.open(filename, SQLITE_OPEN_READONLY|SQLITE_OPEN_NOMUTEX))
+			return 1;
+
+		return conn.query_each(sql, in, cb);
+	};
+
+	return parallel_scan(runner, table, key_column, options, callback);
+}
+#endif
+
+}
@@ -0,0 +1,85 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_PARALLEL_SCAN_H_
+#define STDEX_DATA_PARALLEL_SCAN_H_
+
+#include "data_source.h"
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql_pool.h"
+#endif
+#ifdef STDEX_HAS_SQLITE
+#include "data_source_sqlite.h"
+#endif
+namespace stdex {
+
+enum ScanSplit
+{
+	//MIN/MAX for an integer key, quantiles for anything else
+	SCAN_SPLIT_AUTO,
+	//equal slices of [MIN, MAX], an integer key only
+	SCAN_SPLIT_MINMAX,
+	//key values at equal row counts, costs an index walk per boundary
+	//but copes with skewed keys
+	SCAN_SPLIT_QUANTILE,
+};
+
+struct ScanOptions
+{
+	//key ranges scanned at once, each over its own connection
+	size_t partitions;
+	//deliver the rows in key order. the ranges are disjoint, so this
+	//only holds back the later ranges until the earlier ones finished
+	bool ordered;
+	ScanSplit split;
+	//select list, * by default
+	string columns;
+	//optional condition added to every range, without parameters
+	string where;
+	//rows a range may buffer ahead of the callback before it waits
+	size_t queue_rows;
+
+	ScanOptions();
+};
+
+//runs sql on a connection of its own, safe to call from many threads
+typedef std::function<int(const string &sql, std::vector<Meta> &in, const RowCallback &callback)> ScanRunner;
+
+//reads the whole table split into key ranges. the callback runs on the
+//calling thread and stops the scan by returning false. table, key and
+//options go into the sql verbatim. rows with a NULL key come first.
+//returns 1 when the key range could not be read and 2 when a range
+//failed
+int parallel_scan(const ScanRunner &runner, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback);
+
+#ifdef STDEX_HAS_MYSQL
+//every range holds a pooled connection while it runs
+int parallel_scan(MysqlPool &pool, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback);
+#endif
+
+#ifdef STDEX_HAS_SQLITE
+//every range opens a read only connection to the file
+int parallel_scan(const string &filename, const string &table, const string &key_column,
+	const ScanOptions &options, const RowCallback &callback);
+#endif
+
+}
+#endif //STDEX_DATA_PARALLEL_SCAN_H_
@@ -0,0 +1,356 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifdef STDEX_HAS_MYSQL
+#include "data_query_batch.h"
+#include <chrono>
+namespace stdex {
+
+size_t QueryBatch::add(const string &sql, const std::vector<Meta> &in)
+{
+	Job job;
+	job.sql = sql;
+	job.in = in;
+	job.code = 0;
+	job.timed_out = false;
+
+	_jobs.push_back(std::move(job));
+	return _jobs.size() - 1;
+}
+
+size_t QueryBatch::size() const
+{
+	return _jobs.size();
+}
+
+void QueryBatch::clear()
+{
+	_jobs.clear();
+}
+
+int QueryBatch::code(size_t index) const
+{
+	return _jobs[index].code;
+}
+
+const string &QueryBatch::error(size_t index) const
+{
+	return _jobs[index].error;
+}
+
+bool QueryBatch::timed_out(size_t index) const
+{
+	return _jobs[index].timed_out;
+}
+
+std::vector<std::vector<Meta>> &QueryBatch::rows(size_t index)
+{
+	return _jobs[index].rows;
+}
+
+QueryExecutorOptions::QueryExecutorOptions()
+{
+	parallelism = 8;
+	job_timeout_ms = 0;
+	acquire_timeout_ms = 5000;
+}
+
+QueryExecutor::QueryExecutor(MysqlPool &pool, const QueryExecutorOptions &options) : _pool(pool)
+{
+	_options = options;
+	if (_options.parallelism == 0)
+		_options.parallelism = 1;
+
+	_next = 0;
+	_queued = 0;
+	_running = true;
+
+	for (size_t i=0; i<_options.parallelism; i++)
+		_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+
+	for (size_t i=0; i<_options.parallelism; i++)
+		_workers[i]->thread = std::thread(&QueryExecutor::worker_loop, this, i);
+}
+
+QueryExecutor::~QueryExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_running = false;
+	}
+
+	_cond.notify_all();
+
+	for (size_t i=0; i<_workers.size(); i++)
+		_workers[i]->thread.join();
+}
+
+int QueryExecutor::run(QueryBatch &batch)
+{
+	size_t job_num = batch._jobs.size();
+	if (job_num == 0)
+		return 0;
+
+	Run run;
+	run.batch = &batch;
+	run.remaining = job_num;
+	run.slots.resize(job_num);
+
+	for (size_t i=0; i<job_num; i++)
+	{
+		Slot &slot = run.slots[i];
+		slot.state = JOB_QUEUED;
+		slot.thread_id = 0;
+		slot.started_ms = 0;
+		slot.killing = false;
+		slot.killed = false;
+		slot.kill_error.clear();
+
+		QueryBatch::Job &job = batch._jobs[i];
+		job.rows.clear();
+		job.code = 0;
+		job.error.clear();
+		job.timed_out = false;
+	}
+
+	//deal the jobs out round robin, starting where the last batch ended
+	//so small batches do not all land on the first worker
+	size_t worker_num = _workers.size();
+	size_t first = _next.fetch_add(job_num);
+
+	for (size_t i=0; i<job_num; i++)
+	{
+		Worker &worker = *_workers[(first + i) % worker_num];
+		Task task;
+		task.run = &run;
+		task.index = i;
+
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queued += job_num;
+	}
+
+	_cond.notify_all();
+
+	std::unique_lock<std::mutex> lock(run.mutex);
+
+	while (run.remaining)
+	{
+		if (!_options.job_timeout_ms)
+		{
+			run.cond.wait(lock);
+			continue;
+		}
+
+		//sleep until the earliest running job goes over its time, a job
+		//starting later has its deadline a whole timeout away
+		int64_t now = now_ms();
+		int64_t wake = now + _options.job_timeout_ms;
+
+		for (size_t i=0; i<job_num; i++)
+		{
+			const Slot &slot = run.slots[i];
+			if (slot.state == JOB_RUNNING && !slot.killed)
+				wake = std::min(wake, slot.started_ms + (int64_t)_options.job_timeout_ms);
+		}
+
+		if (wake > now)
+			run.cond.wait_for(lock, std::chrono::milliseconds(wake - now));
+
+		kill_overdue(run, lock);
+	}
+
+	for (size_t i=0; i<job_num; i++)
+	{
+		if (batch._jobs[i].code)
+			return 1;
+	}
+
+	return 0;
+}
+
+void QueryExecutor::worker_loop(size_t index)
+{
+	while (true)
+	{
+		Task task;
+
+		if (pop(index, task) || steal(index, task))
+		{
+			_queued--;
+			execute(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (_running && _queued == 0)
+			_cond.wait(lock);
+
+		if (!_running && _queued == 0)
+			break;
+	}
+}
+
+bool QueryExecutor::pop(size_t index, Task &task)
+{
+	Worker &worker = *_workers[index];
+	std::lock_guard<std::mutex> lock(worker.mutex);
+
+	if (worker.tasks.empty())
+		return false;
+
+	task = worker.tasks.back();
+	worker.tasks.pop_back();
+	return true;
+}
+
+bool QueryExecutor::steal(size_t index, Task &task)
+{
+	size_t worker_num = _workers.size();
+
+	for (size_t i=1; i<worker_num; i++)
+	{
+		Worker &victim = *_workers[(index + i) % worker_num];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (victim.tasks.empty())
+			continue;
+
+		task = victim.tasks.front();
+		victim.tasks.pop_front();
+		return true;
+	}
+
+	return false;
+}
+
+void QueryExecutor::execute(const Task &task)
+{
+	Run &run = *task.run;
+	Slot &slot = run.slots[task.index];
+	QueryBatch::Job &job = run.batch->_jobs[task.index];
+
+	MysqlPool::Lease conn = _pool.acquire(_options.acquire_timeout_ms);
+
+	if (!conn)
+	{
+		job.code = 1;
+		job.error = _pool.last_error();
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(run.mutex);
+			slot.state = JOB_RUNNING;
+			slot.thread_id = conn->thread_id();
+			slot.started_ms = now_ms();
+		}
+
+		job.code = conn->query_all(job.sql, job.in, job.rows);
+		if (job.code)
+			job.error = conn->last_error();
+	}
+
+	//the connection goes back only after the job is marked done, so a
+	//kill sent for this job cannot hit the next one on the connection,
+	//and before the batch is reported done, so the caller may close the
+	//pool right after run()
+	std::unique_lock<std::mutex> lock(run.mutex);
+	while (slot.killing)
+		run.cond.wait(lock);
+
+	slot.state = JOB_DONE;
+	job.timed_out = slot.killed && job.code;
+
+	//the query ran over its time and could not be stopped
+	if (!slot.kill_error.empty())
+	{
+		job.timed_out = true;
+		job.code = 1;
+		job.error = slot.kill_error;
+	}
+
+	conn.release();
+
+	if (--run.remaining == 0)
+		run.cond.notify_all();
+}
+
+//the kills are sent without the run lock, a job being killed holds on
+//to its connection until the kill is out, so a kill cannot hit the next
+//query on that connection. a job that cannot be killed is given up on
+//with an error rather than retried
+void QueryExecutor::kill_overdue(Run &run, std::unique_lock<std::mutex> &lock)
+{
+	int64_t deadline = now_ms() - _options.job_timeout_ms;
+	std::vector<size_t> overdue;
+	std::vector<unsigned long> thread_ids;
+
+	for (size_t i=0; i<run.slots.size(); i++)
+	{
+		Slot &slot = run.slots[i];
+		if (slot.state != JOB_RUNNING || slot.killed || slot.started_ms > deadline)
+			continue;
+
+		slot.killing = true;
+		overdue.push_back(i);
+		thread_ids.push_back(slot.thread_id);
+	}
+
+	if (overdue.empty())
+		return;
+
+	lock.unlock();
+
+	std::vector<string> errors(overdue.size());
+	MysqlPool::Lease conn = _pool.acquire(_options.acquire_timeout_ms);
+
+	for (size_t i=0; i<overdue.size(); i++)
+	{
+		if (!conn)
+			errors[i] = "ran over the timeout, no pooled connection was free to send KILL QUERY";
+		else if (conn->execute("KILL QUERY " + std::to_string(thread_ids[i])))
+			errors[i] = string("KILL QUERY failed: ") + conn->last_error();
+	}
+
+	conn.release();
+	lock.lock();
+
+	for (size_t i=0; i<overdue.size(); i++)
+	{
+		Slot &slot = run.slots[overdue[i]];
+		slot.killing = false;
+		slot.killed = true;
+		slot.kill_error = std::move(errors[i]);
+	}
+
+	run.cond.notify_all();
+}
+
+int64_t QueryExecutor::now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+#endif
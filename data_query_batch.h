@@ -0,0 +1,150 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_QUERY_BATCH_H_
+#define STDEX_DATA_QUERY_BATCH_H_
+#ifdef STDEX_HAS_MYSQL
+
+#include "data_source_mysql_pool.h"
+#include <deque>
+namespace stdex {
+
+//independent queries run together by a QueryExecutor. results are kept
+//in the order the jobs were added
+class QueryBatch
+{
+public:
+	//returns the index of the job
+	size_t add(const string &sql, const std::vector<Meta> &in);
+	size_t size() const;
+	void clear();
+
+	//0 or the code query_all returned for the job
+	int code(size_t index) const;
+	const string &error(size_t index) const;
+	//the job ran over the timeout and its query was killed, or could
+	//not be killed, in which case code is 1 and error says why
+	bool timed_out(size_t index) const;
+	std::vector<std::vector<Meta>> &rows(size_t index);
+
+private:
+	friend class QueryExecutor;
+
+	struct Job
+	{
+		string sql;
+		std::vector<Meta> in;
+		std::vector<std::vector<Meta>> rows;
+		int code;
+		string error;
+		bool timed_out;
+	};
+
+	std::vector<Job> _jobs;
+};
+
+struct QueryExecutorOptions
+{
+	//worker threads, each holding at most one pooled connection
+	size_t parallelism;
+	//a query running longer is killed with KILL QUERY, 0 never kills.
+	//the kill is sent over another pooled connection, so the pool needs
+	//room beyond parallelism
+	uint32_t job_timeout_ms;
+	//how long a job waits for a pooled connection
+	uint32_t acquire_timeout_ms;
+
+	QueryExecutorOptions();
+};
+
+//spreads the jobs of a batch over worker threads with a queue each. a
+//worker takes its own jobs from the back and steals from the front of
+//the others when it runs dry, so one slow query does not hold up the
+//jobs queued behind it
+class QueryExecutor
+{
+public:
+	QueryExecutor(MysqlPool &pool, const QueryExecutorOptions &options=QueryExecutorOptions());
+	~QueryExecutor();
+
+	//blocks until every job finished, returns 0 when all succeeded and
+	//1 otherwise. several threads may run batches at once
+	int run(QueryBatch &batch);
+
+private:
+	QueryExecutor(const QueryExecutor &) = delete;
+	QueryExecutor &operator=(const QueryExecutor &) = delete;
+
+	enum JobState {JOB_QUEUED, JOB_RUNNING, JOB_DONE};
+
+	struct Slot
+	{
+		JobState state;
+		unsigned long thread_id;
+		int64_t started_ms;
+		//a kill is being sent, the job keeps its connection till it is out
+		bool killing;
+		bool killed;
+		string kill_error;
+	};
+
+	struct Run
+	{
+		QueryBatch *batch;
+		std::vector<Slot> slots;
+		size_t remaining;
+		std::mutex mutex;
+		std::condition_variable cond;
+	};
+
+	struct Task
+	{
+		Run *run;
+		size_t index;
+	};
+
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	void worker_loop(size_t index);
+	bool pop(size_t index, Task &task);
+	bool steal(size_t index, Task &task);
+	void execute(const Task &task);
+	void kill_overdue(Run &run, std::unique_lock<std::mutex> &lock);
+
+	static int64_t now_ms();
+
+	MysqlPool &_pool;
+	QueryExecutorOptions _options;
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::atomic<size_t> _next;
+
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::atomic<size_t> _queued;
+	bool _running;
+};
+
+}
+#endif
+#endif //STDEX_DATA_QUERY_BATCH_H_
@@ -0,0 +1,474 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_query_stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+namespace stdex {
+
+uint64_t HistogramSnapshot::percentile(double q) const
+{
+	if (count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(q * count);
+	if (rank >= count)
+		rank = count - 1;
+
+	uint64_t seen = 0;
+
+	for (size_t i=0; i<buckets.size(); i++)
+	{
+		seen += buckets[i];
+		if (seen > rank)
+			return LatencyHistogram::bucket_end(i);
+	}
+
+	return LatencyHistogram::bucket_end(buckets.size() - 1);
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (size_t i=0; i<BUCKET_NUM; i++)
+		_buckets[i] = 0;
+
+	_count = 0;
+	_sum = 0;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+	_buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::snapshot(HistogramSnapshot &out) const
+{
+	out.buckets.resize(BUCKET_NUM);
+
+	for (size_t i=0; i<BUCKET_NUM; i++)
+		out.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+
+	out.count = _count.load(std::memory_order_relaxed);
+	out.sum_ns = _sum.load(std::memory_order_relaxed);
+}
+
+//index of the highest set bit, ns is never 0 here
+static int top_bit(uint64_t ns)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(ns);
+#elif defined(_MSC_VER) && defined(_WIN64)
+	unsigned long index;
+	_BitScanReverse64(&index, ns);
+	return (int)index;
+#else
+	int top = 0;
+	while (ns >>= 1)
+		top++;
+	return top;
+#endif
+}
+
+//values below 2^SUB_BITS get a bucket each, above that the top bit picks
+//the power of two and the next SUB_BITS bits the bucket within it
+size_t LatencyHistogram::bucket_of(uint64_t ns)
+{
+	if (ns < (1u << SUB_BITS))
+		return (size_t)ns;
+
+	if (ns >> MAX_BITS)
+		return BUCKET_NUM - 1;
+
+	int top = top_bit(ns);
+	size_t sub = (size_t)(ns >> (top - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+	return ((size_t)(top - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucket_end(size_t index)
+{
+	if (index < (1u << SUB_BITS))
+		return index + 1;
+
+	int shift = (int)(index >> SUB_BITS) - 1;
+	uint64_t sub = index & ((1u << SUB_BITS) - 1);
+	return ((1ull << SUB_BITS) + sub + 1) << shift;
+}
+
+QueryStats::QueryStats(const std::string &fingerprint) : _fingerprint(fingerprint)
+{
+	_calls = 0;
+	_rows = 0;
+	_bytes = 0;
+}
+
+const std::string &QueryStats::fingerprint() const
+{
+	return _fingerprint;
+}
+
+void QueryStats::record(const uint64_t *phases_ns, uint64_t rows, uint64_t bytes, unsigned error)
+{
+	//a phase the call never went through is left out of its histogram
+	for (size_t i=0; i<PHASE_NUM; i++)
+	{
+		if (phases_ns[i] || i == PHASE_TOTAL)
+			_phases[i].record(phases_ns[i]);
+	}
+
+	_calls.fetch_add(1, std::memory_order_relaxed);
+	_rows.fetch_add(rows, std::memory_order_relaxed);
+	_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+	if (error)
+		record_error(error);
+}
+
+void QueryStats::record_error(unsigned error)
+{
+	std::lock_guard<std::mutex> lock(_error_mutex);
+	_errors[error]++;
+}
+
+QueryStatsRegistry::QueryStatsRegistry(size_t max_entries)
+{
+	_max_entries = max_entries;
+}
+
+QueryStats *QueryStatsRegistry::find(const std::string &sql)
+{
+	std::string key = fingerprint(sql);
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _entries.find(key);
+	if (it != _entries.end())
+		return it->second.get();
+
+	if (_entries.size() >= _max_entries)
+		key = "other";
+
+	std::unique_ptr<QueryStats> &entry = _entries[key];
+	if (!entry)
+		entry.reset(new QueryStats(key));
+
+	return entry.get();
+}
+
+void QueryStatsRegistry::snapshot(std::vector<QueryStatsSnapshot> &out) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	out.clear();
+	out.reserve(_entries.size());
+
+	for (auto it = _entries.begin(); it != _entries.end(); ++it)
+	{
+		QueryStats &stats = *it->second;
+
+		out.push_back(QueryStatsSnapshot());
+		QueryStatsSnapshot &snap = out.back();
+		snap.fingerprint = stats._fingerprint;
+		snap.calls = stats._calls.load(std::memory_order_relaxed);
+		snap.rows = stats._rows.load(std::memory_order_relaxed);
+		snap.bytes = stats._bytes.load(std::memory_order_relaxed);
+
+		for (size_t i=0; i<PHASE_NUM; i++)
+			stats._phases[i].snapshot(snap.phases[i]);
+
+		std::lock_guard<std::mutex> error_lock(stats._error_mutex);
+		snap.errors.assign(stats._errors.begin(), stats._errors.end());
+	}
+
+	std::sort(out.begin(), out.end(), [](const QueryStatsSnapshot &a, const QueryStatsSnapshot &b) {
+		return a.fingerprint < b.fingerprint;
+	});
+}
+
+static const char *phase_names[PHASE_NUM] = {"prepare", "bind", "execute", "fetch", "decode", "total"};
+
+//bucket bounds of the exported histograms, in seconds
+static const double export_bounds[] = {
+	0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+	0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+static std::string label_value(const std::string &val)
+{
+	std::string out;
+	out.reserve(val.size());
+
+	for (size_t i=0; i<val.size(); i++)
+	{
+		char c = val[i];
+		if (c == '\\' || c == '"')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (c == '\n')
+		{
+			out += "\\n";
+		}
+		else
+		{
+			out += c;
+		}
+	}
+
+	return out;
+}
+
+static void append_line(std::string &out, const char *name, const std::string &labels, double value)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.17g", value);
+
+	out += name;
+	out += '{';
+	out += labels;
+	out += "} ";
+	out += buf;
+	out += '\n';
+}
+
+//the fine buckets are summed into the export bounds, a fine bucket
+//straddling a bound counts above it
+void QueryStatsRegistry::export_prometheus(std::string &out) const
+{
+	std::vector<QueryStatsSnapshot> snaps;
+	snapshot(snaps);
+
+	out += "# HELP stdex_query_duration_seconds Time spent per query phase.\n";
+	out += "# TYPE stdex_query_duration_seconds histogram\n";
+
+	for (size_t s=0; s<snaps.size(); s++)
+	{
+		const QueryStatsSnapshot &snap = snaps[s];
+		std::string query = "query=\"" + label_value(snap.fingerprint) + "\"";
+
+		for (size_t p=0; p<PHASE_NUM; p++)
+		{
+			const HistogramSnapshot &hist = snap.phases[p];
+			if (hist.count == 0)
+				continue;
+
+			std::string labels = query + ",phase=\"" + phase_names[p] + "\"";
+			size_t bucket = 0;
+			uint64_t seen = 0;
+
+			for (size_t b=0; b<sizeof(export_bounds)/sizeof(export_bounds[0]); b++)
+			{
+				uint64_t bound_ns = (uint64_t)(export_bounds[b] * 1e9);
+				while (bucket < hist.buckets.size() && LatencyHistogram::bucket_end(bucket) <= bound_ns)
+					seen += hist.buckets[bucket++];
+
+				char le[32];
+				snprintf(le, sizeof(le), ",le=\"%g\"", export_bounds[b]);
+				append_line(out, "stdex_query_duration_seconds_bucket", labels + le, (double)seen);
+			}
+
+			append_line(out, "stdex_query_duration_seconds_bucket", labels + ",le=\"+Inf\"", (double)hist.count);
+			append_line(out, "stdex_query_duration_seconds_sum", labels, hist.sum_ns / 1e9);
+			append_line(out, "stdex_query_duration_seconds_count", labels, (double)hist.count);
+		}
+	}
+
+	out += "# HELP stdex_query_calls_total Calls per query.\n";
+	out += "# TYPE stdex_query_calls_total counter\n";
+	for (size_t s=0; s<snaps.size(); s++)
+		append_line(out, "stdex_query_calls_total", "query=\"" + label_value(snaps[s].fingerprint) + "\"", (double)snaps[s].calls);
+
+	out += "# HELP stdex_query_rows_total Rows returned per query.\n";
+	out += "# TYPE stdex_query_rows_total counter\n";
+	for (size_t s=0; s<snaps.size(); s++)
+		append_line(out, "stdex_query_rows_total", "query=\"" + label_value(snaps[s].fingerprint) + "\"", (double)snaps[s].rows);
+
+	out += "# HELP stdex_query_bytes_total Bytes of row data read per query.\n";
+	out += "# TYPE stdex_query_bytes_total counter\n";
+	for (size_t s=0; s<snaps.size(); s++)
+		append_line(out, "stdex_query_bytes_total", "query=\"" + label_value(snaps[s].fingerprint) + "\"", (double)snaps[s].bytes);
+
+	out += "# HELP stdex_query_errors_total Failed calls per query and error code.\n";
+	out += "# TYPE stdex_query_errors_total counter\n";
+	for (size_t s=0; s<snaps.size(); s++)
+	{
+		const QueryStatsSnapshot &snap = snaps[s];
+		for (size_t e=0; e<snap.errors.size(); e++)
+		{
+			std::string labels = "query=\"" + label_value(snap.fingerprint) + "\",code=\"" + std::to_string(snap.errors[e].first) + "\"";
+			append_line(out, "stdex_query_errors_total", labels, (double)snap.errors[e].second);
+		}
+	}
+}
+
+static bool is_word(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+//a comma separated run of item becomes a single item
+static std::string fold_list(const std::string &sql, const std::string &item)
+{
+	std::string out;
+	out.reserve(sql.size());
+	size_t i = 0;
+
+	while (i < sql.size())
+	{
+		if (sql.compare(i, item.size(), item) != 0)
+		{
+			out += sql[i++];
+			continue;
+		}
+
+		out += item;
+		i += item.size();
+
+		while (true)
+		{
+			size_t next = i;
+			if (next < sql.size() && sql[next] == ',')
+				next++;
+			else
+				break;
+
+			if (next < sql.size() && sql[next] == ' ')
+				next++;
+
+			if (sql.compare(next, item.size(), item) != 0)
+				break;
+
+			i = next + item.size();
+		}
+	}
+
+	return out;
+}
+
+std::string QueryStatsRegistry::fingerprint(const std::string &sql)
+{
+	std::string out;
+	out.reserve(sql.size());
+	size_t i = 0;
+
+	while (i < sql.size())
+	{
+		char c = sql[i];
+
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+		{
+			while (i < sql.size() && (sql[i] == ' ' || sql[i] == '\t' || sql[i] == '\n' || sql[i] == '\r'))
+				i++;
+
+			if (!out.empty() && i < sql.size())
+				out += ' ';
+			continue;
+		}
+
+		if (c == '\'' || c == '"')
+		{
+			//quoted literal, backslash and doubled quotes escape
+			i++;
+			while (i < sql.size())
+			{
+				if (sql[i] == '\\')
+					i += 2;
+				else if (sql[i] == c && i + 1 < sql.size() && sql[i + 1] == c)
+					i += 2;
+				else if (sql[i] == c)
+					break;
+				else
+					i++;
+			}
+
+			i++;
+			out += '?';
+			continue;
+		}
+
+		if (c >= '0' && c <= '9' && (out.empty() || !is_word(out[out.size() - 1])))
+		{
+			while (i < sql.size() && (is_word(sql[i]) || sql[i] == '.'))
+				i++;
+
+			out += '?';
+			continue;
+		}
+
+		out += c;
+		i++;
+	}
+
+	//IN (?, ?, ?) reads IN (?), and the rows of a multi row insert fold
+	//the same way once their values did
+	return fold_list(fold_list(out, "?"), "(?)");
+}
+
+uint64_t QueryTiming::now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void QueryTiming::start()
+{
+	begin = mark = now_ns();
+
+	for (size_t i=0; i<PHASE_NUM; i++)
+		phases[i] = 0;
+
+	rows = 0;
+	bytes = 0;
+}
+
+void QueryTiming::lap(QueryPhase phase)
+{
+	uint64_t now = now_ns();
+	phases[phase] += now - mark;
+	mark = now;
+}
+
+//what passed since the last lap went into reading rows, less the decode
+//time the caller measured
+void QueryTiming::end(unsigned error)
+{
+	uint64_t now = now_ns();
+	phases[PHASE_TOTAL] = now - begin;
+
+	if (rows)
+	{
+		uint64_t rest = now - mark;
+		phases[PHASE_DECODE] = std::min(phases[PHASE_DECODE], rest);
+		phases[PHASE_FETCH] += rest - phases[PHASE_DECODE];
+	}
+	else
+	{
+		phases[PHASE_DECODE] = 0;
+	}
+
+	if (stats)
+		stats->record(phases, rows, bytes, error);
+
+	stats = NULL;
+}
+
+}
@@ -0,0 +1,168 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_QUERY_STATS_H_
+#define STDEX_DATA_QUERY_STATS_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+namespace stdex {
+
+//the data sources record into a QueryStatsRegistry only when built with
+//STDEX_QUERY_STATS, otherwise the hooks compile to nothing. only the
+//mysql source is instrumented so far
+enum QueryPhase
+{
+	PHASE_PREPARE,
+	PHASE_BIND,
+	PHASE_EXECUTE,
+	//reading rows off the connection, including the time the caller's
+	//row callback takes
+	PHASE_FETCH,
+	//turning the bound buffers into Meta values
+	PHASE_DECODE,
+	PHASE_TOTAL,
+	PHASE_NUM,
+};
+
+struct HistogramSnapshot
+{
+	uint64_t count;
+	uint64_t sum_ns;
+	std::vector<uint64_t> buckets;
+
+	//upper bound of the bucket holding the q-th fraction of the values
+	uint64_t percentile(double q) const;
+};
+
+//log linear buckets over nanoseconds with 8 buckets per power of two, so
+//a value is known to within 12.5%. recording is three relaxed atomic adds
+class LatencyHistogram
+{
+public:
+	enum
+	{
+		SUB_BITS = 3,
+		//values from 2^41 ns, about 36 minutes, share the last bucket
+		MAX_BITS = 41,
+		BUCKET_NUM = (MAX_BITS - SUB_BITS + 1) << SUB_BITS,
+	};
+
+	LatencyHistogram();
+
+	void record(uint64_t ns);
+	void snapshot(HistogramSnapshot &out) const;
+
+	static size_t bucket_of(uint64_t ns);
+	//first value past the bucket
+	static uint64_t bucket_end(size_t index);
+
+private:
+	std::atomic<uint64_t> _buckets[BUCKET_NUM];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+};
+
+//everything recorded for one sql fingerprint
+class QueryStats
+{
+public:
+	explicit QueryStats(const std::string &fingerprint);
+
+	const std::string &fingerprint() const;
+
+	void record(const uint64_t *phases_ns, uint64_t rows, uint64_t bytes, unsigned error);
+	void record_error(unsigned error);
+
+private:
+	friend class QueryStatsRegistry;
+
+	std::string _fingerprint;
+	LatencyHistogram _phases[PHASE_NUM];
+	std::atomic<uint64_t> _calls;
+	std::atomic<uint64_t> _rows;
+	std::atomic<uint64_t> _bytes;
+
+	//errors are rare enough for a lock
+	std::mutex _error_mutex;
+	std::map<unsigned, uint64_t> _errors;
+};
+
+struct QueryStatsSnapshot
+{
+	std::string fingerprint;
+	uint64_t calls;
+	uint64_t rows;
+	uint64_t bytes;
+	HistogramSnapshot phases[PHASE_NUM];
+	std::vector<std::pair<unsigned, uint64_t>> errors;
+};
+
+class QueryStatsRegistry
+{
+public:
+	//fingerprints past max_entries are counted under one "other" entry
+	explicit QueryStatsRegistry(size_t max_entries=1000);
+
+	//the entry for the fingerprint of sql, created on first use. the
+	//pointer stays valid for the life of the registry, so callers look
+	//it up once per prepared statement
+	QueryStats *find(const std::string &sql);
+
+	void snapshot(std::vector<QueryStatsSnapshot> &out) const;
+	//prometheus text format, a histogram per phase plus counters
+	void export_prometheus(std::string &out) const;
+
+	//sql with literals replaced by ? and whitespace collapsed, runs of
+	//placeholders in lists fold into one
+	static std::string fingerprint(const std::string &sql);
+
+private:
+	QueryStatsRegistry(const QueryStatsRegistry &) = delete;
+	QueryStatsRegistry &operator=(const QueryStatsRegistry &) = delete;
+
+	size_t _max_entries;
+	mutable std::mutex _mutex;
+	std::unordered_map<std::string, std::unique_ptr<QueryStats>> _entries;
+};
+
+//phase times of the call in progress on one connection
+struct QueryTiming
+{
+	QueryStats *stats;
+	uint64_t begin;
+	uint64_t mark;
+	uint64_t phases[PHASE_NUM];
+	uint64_t rows;
+	uint64_t bytes;
+
+	static uint64_t now_ns();
+	void start();
+	//charges the time since the last lap to phase
+	void lap(QueryPhase phase);
+	void end(unsigned error);
+};
+
+}
+#endif //STDEX_DATA_QUERY_STATS_H_
@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_RESULT_ARENA_H_
+#define STDEX_DATA_RESULT_ARENA_H_
+
+#include "data_meta.h"
+#include <cstddef>
+#include <new>
+
+namespace stdex {
+
+//bump allocator handing out memory from large chunks. nothing is freed
+//on its own, clear() or the destructor drop every chunk at once
+class ResultArena
+{
+public:
+	explicit ResultArena(size_t chunk_size = 1 << 20)
+	{
+		_chunk_size = chunk_size;
+		_pos = NULL;
+		_end = NULL;
+		_bytes = 0;
+	}
+
+	~ResultArena()
+	{
+		for (size_t i=0; i<_chunks.size(); i++)
+			delete[] _chunks[i];
+	}
+
+	void *allocate(size_t size, size_t align = alignof(std::max_align_t))
+	{
+		char *ptr = (char *)(((uintptr_t)_pos + align - 1) & ~(uintptr_t)(align - 1));
+
+		if (!_pos || ptr + size > _end)
+		{
+			//big blocks get a chunk of their own so the current one
+			//stays in use
+			if (size > _chunk_size / 4)
+			{
+				char *chunk = new char[size + align];
+				_chunks.push_back(chunk);
+				_bytes += size + align;
+				return (void *)(((uintptr_t)chunk + align - 1) & ~(uintptr_t)(align - 1));
+			}
+
+			char *chunk = new char[_chunk_size];
+			_chunks.push_back(chunk);
+			_bytes += _chunk_size;
+			_end = chunk + _chunk_size;
+			ptr = (char *)(((uintptr_t)chunk + align - 1) & ~(uintptr_t)(align - 1));
+		}
+
+		_pos = ptr + size;
+		return ptr;
+	}
+
+	const char *copy(const char *data, size_t len)
+	{
+		char *ptr = (char *)allocate(len, 1);
+		memcpy(ptr, data, len);
+		return ptr;
+	}
+
+	void clear()
+	{
+		for (size_t i=0; i<_chunks.size(); i++)
+			delete[] _chunks[i];
+
+		_chunks.clear();
+		_pos = NULL;
+		_end = NULL;
+		_bytes = 0;
+	}
+
+	size_t chunk_count() const
+	{
+		return _chunks.size();
+	}
+
+	size_t bytes_allocated() const
+	{
+		return _bytes;
+	}
+
+private:
+	ResultArena(const ResultArena &) = delete;
+	ResultArena &operator=(const ResultArena &) = delete;
+
+	std::vector<char *> _chunks;
+	char *_pos;
+	char *_end;
+	size_t _chunk_size;
+	size_t _bytes;
+};
+
+//query_all result whose rows and strings all live in one arena. string
+//cells are views into the arena, so the rows are only valid as long as
+//the ArenaRows and are dropped with it in O(chunks) instead of one free
+//per row and string
+class ArenaRows
+{
+public:
+	explicit ArenaRows(size_t chunk_size = 1 << 20)
+		: _arena(chunk_size)
+	{
+		_column_count = 0;
+	}
+
+	size_t size() const
+	{
+		return _rows.size();
+	}
+
+	bool empty() const
+	{
+		return _rows.empty();
+	}
+
+	size_t column_count() const
+	{
+		return _column_count;
+	}
+
+	//the row is column_count() cells
+	const Meta *operator[](size_t row) const
+	{
+		return _rows[row];
+	}
+
+	//copies row into the arena
+	void push_back(const std::vector<Meta> &row)
+	{
+		_column_count = row.size();
+		Meta *cells = (Meta *)_arena.allocate(sizeof(Meta) * row.size(), alignof(Meta));
+
+		for (size_t i=0; i<row.size(); i++)
+		{
+			const Meta &meta = row[i];
+			Meta *cell = new (&cells[i]) Meta();
+
+			if (meta.is_string())
+			{
+				size_t len = meta.string_size();
+				cell->assign_view(_arena.copy(meta.string_data(), len), len);
+			}
+			else
+			{
+				*cell = meta;
+			}
+		}
+
+		_rows.push_back(cells);
+	}
+
+	void clear()
+	{
+		_rows.clear();
+		_arena.clear();
+		_column_count = 0;
+	}
+
+	const ResultArena &arena() const
+	{
+		return _arena;
+	}
+
+private:
+	ArenaRows(const ArenaRows &) = delete;
+	ArenaRows &operator=(const ArenaRows &) = delete;
+
+	ResultArena _arena;
+	std::vector<Meta *> _rows;
+	size_t _column_count;
+};
+
+}
+#endif //STDEX_DATA_RESULT_ARENA_H_
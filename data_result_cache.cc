@@ -0,0 +1,571 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_result_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <list>
+namespace stdex {
+
+struct ResultCache::Entry
+{
+	string key;
+	std::shared_ptr<const std::vector<std::vector<Meta>>> rows;
+	int64_t expires_ms;
+	uint64_t epoch;
+	std::vector<std::pair<std::atomic<uint64_t> *, uint64_t>> tables;
+	size_t bytes;
+};
+
+struct ResultCache::Shard
+{
+	std::mutex mutex;
+	//most recently used first
+	std::list<Entry> lru;
+	std::unordered_map<string, std::list<Entry>::iterator> map;
+	size_t bytes;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t expired;
+	uint64_t stale;
+	uint64_t evictions;
+
+	Shard() : bytes(0), hits(0), misses(0), expired(0), stale(0), evictions(0) {}
+
+	void erase(std::list<Entry>::iterator it)
+	{
+		bytes -= it->bytes;
+		map.erase(it->key);
+		lru.erase(it);
+	}
+};
+
+static int64_t now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ResultCacheOptions::ResultCacheOptions()
+{
+	shards = 16;
+	max_bytes = 64 << 20;
+	ttl_ms = 1000;
+}
+
+double ResultCacheStats::hit_rate() const
+{
+	uint64_t lookups = hits + misses;
+	return lookups ? (double)hits / lookups : 0;
+}
+
+ResultCache::ResultCache()
+{
+	_shard_bytes = 0;
+	_epoch = 0;
+	_invalidations = 0;
+}
+
+ResultCache::~ResultCache()
+{
+}
+
+int ResultCache::open(const ResultCacheOptions &options)
+{
+	if (_shards)
+		return 1;
+
+	_options = options;
+	if (!_options.shards)
+		_options.shards = 1;
+
+	_shards.reset(new Shard[_options.shards]);
+	_shard_bytes = _options.max_bytes / _options.shards;
+	return 0;
+}
+
+//the table names a lookup depends on are the last part of a qualified
+//name, so db1.t and db2.t share a generation. that costs an extra miss
+//now and then, never a stale hit
+bool ResultCache::get(const string &sql, const std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows, ResultCacheTicket &ticket)
+{
+	ticket.key.clear();
+	ticket.tables.clear();
+
+	if (!_shards)
+		return false;
+
+	string key;
+	make_key(sql, in, key);
+	Shard &shard = shard_of(key);
+
+	std::shared_ptr<const std::vector<std::vector<Meta>>> found;
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.map.find(key);
+		if (it != shard.map.end())
+		{
+			std::list<Entry>::iterator entry = it->second;
+			bool current = entry->epoch == _epoch.load(std::memory_order_acquire);
+
+			for (size_t i=0; current && i<entry->tables.size(); i++)
+				current = entry->tables[i].first->load(std::memory_order_acquire) == entry->tables[i].second;
+
+			if (!current)
+			{
+				shard.stale++;
+				shard.erase(entry);
+			}
+			else if (entry->expires_ms <= now_ms())
+			{
+				shard.expired++;
+				shard.erase(entry);
+			}
+			else
+			{
+				shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+				found = entry->rows;
+				shard.hits++;
+			}
+		}
+
+		if (!found)
+			shard.misses++;
+	}
+
+	if (found)
+	{
+		rows = *found;
+		return true;
+	}
+
+	std::vector<string> tables;
+	if (scan_tables(sql, tables) != SQL_READ)
+		return false;
+
+	//taken before the query runs, a write finishing while it does
+	//leaves the result unusable
+	ticket.epoch = _epoch.load(std::memory_order_acquire);
+	for (size_t i=0; i<tables.size(); i++)
+	{
+		std::atomic<uint64_t> *gen = generation(tables[i]);
+		ticket.tables.push_back(std::make_pair(gen, gen->load(std::memory_order_acquire)));
+	}
+
+	ticket.key.swap(key);
+	return false;
+}
+
+void ResultCache::put(ResultCacheTicket &ticket, const std::vector<std::vector<Meta>> &rows, uint32_t ttl_ms)
+{
+	if (!_shards || ticket.key.empty())
+		return;
+
+	if (ticket.epoch != _epoch.load(std::memory_order_acquire))
+		return;
+
+	for (size_t i=0; i<ticket.tables.size(); i++)
+	{
+		if (ticket.tables[i].first->load(std::memory_order_acquire) != ticket.tables[i].second)
+			return;
+	}
+
+	size_t bytes = sizeof(Entry) + 2 * ticket.key.size() + row_bytes(rows);
+	if (bytes > _shard_bytes)
+		return;
+
+	Entry entry;
+	entry.rows = std::make_shared<const std::vector<std::vector<Meta>>>(rows);
+	entry.expires_ms = now_ms() + (ttl_ms ? ttl_ms : _options.ttl_ms);
+	entry.epoch = ticket.epoch;
+	entry.tables.swap(ticket.tables);
+	entry.bytes = bytes;
+	entry.key.swap(ticket.key);
+
+	Shard &shard = shard_of(entry.key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	auto it = shard.map.find(entry.key);
+	if (it != shard.map.end())
+		shard.erase(it->second);
+
+	while (shard.bytes + bytes > _shard_bytes && !shard.lru.empty())
+	{
+		shard.erase(std::prev(shard.lru.end()));
+		shard.evictions++;
+	}
+
+	shard.lru.push_front(std::move(entry));
+	shard.map[shard.lru.front().key] = shard.lru.begin();
+	shard.bytes += bytes;
+}
+
+void ResultCache::invalidate_sql(const string &sql)
+{
+	std::vector<string> tables;
+	SqlKind kind = scan_tables(sql, tables);
+
+	if (kind == SQL_READ)
+		return;
+
+	if (kind == SQL_OTHER || tables.empty())
+	{
+		invalidate_all();
+		return;
+	}
+
+	for (size_t i=0; i<tables.size(); i++)
+		invalidate(tables[i]);
+}
+
+void ResultCache::invalidate(const string &table)
+{
+	string name;
+	for (size_t i=0; i<table.size(); i++)
+		name += (char)tolower((unsigned char)table[i]);
+
+	generation(name)->fetch_add(1, std::memory_order_acq_rel);
+	_invalidations++;
+}
+
+void ResultCache::invalidate_all()
+{
+	_epoch.fetch_add(1, std::memory_order_acq_rel);
+	_invalidations++;
+}
+
+ResultCacheStats ResultCache::stats() const
+{
+	ResultCacheStats out;
+	memset(&out, 0, sizeof(out));
+	out.invalidations = _invalidations;
+
+	for (size_t i=0; _shards && i<_options.shards; i++)
+	{
+		Shard &shard = _shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		out.hits += shard.hits;
+		out.misses += shard.misses;
+		out.expired += shard.expired;
+		out.stale += shard.stale;
+		out.evictions += shard.evictions;
+		out.entries += shard.lru.size();
+		out.bytes += shard.bytes;
+	}
+
+	return out;
+}
+
+std::atomic<uint64_t> *ResultCache::generation(const string &table)
+{
+	std::lock_guard<std::mutex> lock(_table_mutex);
+
+	std::unique_ptr<std::atomic<uint64_t>> &gen = _tables[table];
+	if (!gen)
+		gen.reset(new std::atomic<uint64_t>(0));
+
+	return gen.get();
+}
+
+ResultCache::Shard &ResultCache::shard_of(const string &key)
+{
+	return _shards[std::hash<string>()(key) % _options.shards];
+}
+
+//the sql, then per parameter a type byte and its value, strings with
+//their length so no two parameter lists encode the same
+void ResultCache::make_key(const string &sql, const std::vector<Meta> &in, string &key)
+{
+	key.reserve(sql.size() + 1 + in.size() * 9);
+	key = sql;
+	key += '\0';
+
+	for (size_t i=0; i<in.size(); i++)
+	{
+		const Meta &meta = in[i];
+
+		if (meta.is_integer())
+		{
+			int32_t val = meta.get_int();
+			key += 'i';
+			key.append((const char *)&val, sizeof(val));
+		}
+		else if (meta.is_bigint())
+		{
+			int64_t val = meta.get_bigint();
+			key += 'b';
+			key.append((const char *)&val, sizeof(val));
+		}
+		else if (meta.is_float())
+		{
+			float val = meta.get_float();
+			key += 'f';
+			key.append((const char *)&val, sizeof(val));
+		}
+		else if (meta.is_double())
+		{
+			double val = meta.get_double();
+			key += 'd';
+			key.append((const char *)&val, sizeof(val));
+		}
+		else if (meta.is_string())
+		{
+			uint32_t size = (uint32_t)meta.string_size();
+			key += 's';
+			key.append((const char *)&size, sizeof(size));
+			key.append(meta.string_data(), size);
+		}
+		else
+		{
+			key += 'n';
+		}
+	}
+}
+
+size_t ResultCache::row_bytes(const std::vector<std::vector<Meta>> &rows)
+{
+	size_t bytes = sizeof(rows);
+
+	for (size_t i=0; i<rows.size(); i++)
+	{
+		const std::vector<Meta> &row = rows[i];
+		bytes += sizeof(row) + row.size() * sizeof(Meta);
+
+		for (size_t j=0; j<row.size(); j++)
+		{
+			if (row[j].is_string() && row[j].string_size() > 14)
+				bytes += row[j].string_size() + 1;
+		}
+	}
+
+	return bytes;
+}
+
+namespace {
+
+struct SqlToken
+{
+	//lower case word or identifier, empty for anything else
+	string word;
+	char punct;
+};
+
+}
+
+static void tokenize(const string &sql, std::vector<SqlToken> &tokens)
+{
+	size_t i = 0;
+	size_t n = sql.size();
+
+	while (i < n)
+	{
+		char c = sql[i];
+
+		if (isspace((unsigned char)c))
+		{
+			i++;
+			continue;
+		}
+
+		if ((c == '-' && i + 1 < n && sql[i + 1] == '-') || c == '#')
+		{
+			while (i < n && sql[i] != '\n')
+				i++;
+			continue;
+		}
+
+		if (c == '/' && i + 1 < n && sql[i + 1] == '*')
+		{
+			size_t end = sql.find("*/", i + 2);
+			i = end == string::npos ? n : end + 2;
+			continue;
+		}
+
+		SqlToken token;
+		token.punct = 0;
+
+		if (c == '\'')
+		{
+			for (i++; i < n; i++)
+			{
+				if (sql[i] == '\\')
+					i++;
+				else if (sql[i] == '\'')
+				{
+					if (i + 1 < n && sql[i + 1] == '\'')
+						i++;
+					else
+						break;
+				}
+			}
+
+			i++;
+			token.punct = '\'';
+			tokens.push_back(token);
+			continue;
+		}
+
+		//a name, quoted or not, with any schema prefix dropped
+		bool name = false;
+		while (i < n)
+		{
+			c = sql[i];
+			char close = c == '`' ? '`' : c == '"' ? '"' : c == '[' ? ']' : 0;
+
+			if (close)
+			{
+				size_t end = sql.find(close, i + 1);
+				if (end == string::npos)
+					end = n;
+
+				token.word.assign(sql, i + 1, end - i - 1);
+				i = end + 1;
+			}
+			else if (isalnum((unsigned char)c) || c == '_' || c == '$')
+			{
+				size_t begin = i;
+				while (i < n && (isalnum((unsigned char)sql[i]) || sql[i] == '_' || sql[i] == '$'))
+					i++;
+
+				token.word.assign(sql, begin, i - begin);
+			}
+			else
+			{
+				break;
+			}
+
+			name = true;
+			if (i < n && sql[i] == '.')
+				i++;
+			else
+				break;
+		}
+
+		if (!name)
+		{
+			token.punct = c;
+			i++;
+		}
+
+		for (size_t j=0; j<token.word.size(); j++)
+			token.word[j] = (char)tolower((unsigned char)token.word[j]);
+
+		tokens.push_back(token);
+	}
+}
+
+//words that end a table reference, anything else after a table name is
+//taken as its alias
+static bool ends_reference(const string &word)
+{
+	static const char *words[] = {
+		"where", "join", "inner", "left", "right", "full", "outer", "cross", "natural", "straight_join",
+		"on", "using", "group", "order", "limit", "having", "window", "union", "except", "intersect",
+		"set", "values", "value", "select", "partition", "force", "use", "ignore", "indexed", "not",
+		"for", "lock", "returning", "default", "into", "from", "as", "with",
+	};
+
+	for (size_t i=0; i<sizeof(words) / sizeof(words[0]); i++)
+	{
+		if (word == words[i])
+			return true;
+	}
+
+	return false;
+}
+
+ResultCache::SqlKind ResultCache::scan_tables(const string &sql, std::vector<string> &tables)
+{
+	std::vector<SqlToken> tokens;
+	tokenize(sql, tokens);
+
+	SqlKind kind = SQL_OTHER;
+	size_t first = 0;
+	while (first < tokens.size() && tokens[first].punct == '(')
+		first++;
+
+	if (first < tokens.size())
+	{
+		const string &word = tokens[first].word;
+
+		if (word == "select" || word == "with")
+			kind = SQL_READ;
+		else if (word == "insert" || word == "update" || word == "delete" || word == "replace")
+			kind = SQL_WRITE;
+	}
+
+	//a with clause can lead into a write
+	if (kind == SQL_READ && tokens[first].word == "with")
+	{
+		for (size_t i=first; i<tokens.size(); i++)
+		{
+			const string &word = tokens[i].word;
+			if (word == "insert" || word == "delete" || word == "replace" || (word == "update" && (i == 0 || tokens[i - 1].word != "for")))
+				kind = SQL_WRITE;
+		}
+	}
+
+	for (size_t i=0; i<tokens.size(); i++)
+	{
+		const string &word = tokens[i].word;
+		if (word != "from" && word != "join" && word != "into" && word != "update")
+			continue;
+
+		//select ... for update names no table
+		if (word == "update" && i > 0 && tokens[i - 1].word == "for")
+			continue;
+
+		size_t at = i + 1;
+
+		//update low_priority ignore t, update or replace t
+		if (word == "update")
+		{
+			while (at < tokens.size() && (tokens[at].word == "low_priority" || tokens[at].word == "ignore"
+				|| tokens[at].word == "or" || tokens[at].word == "rollback" || tokens[at].word == "abort"
+				|| tokens[at].word == "replace" || tokens[at].word == "fail"))
+				at++;
+		}
+
+		//a comma separated list of references, a subquery is skipped
+		//since its own from is found on the way
+		while (at < tokens.size() && !tokens[at].word.empty() && !ends_reference(tokens[at].word))
+		{
+			if (std::find(tables.begin(), tables.end(), tokens[at].word) == tables.end())
+				tables.push_back(tokens[at].word);
+
+			at++;
+			if (at < tokens.size() && tokens[at].word == "as")
+				at++;
+			if (at < tokens.size() && !tokens[at].word.empty() && !ends_reference(tokens[at].word))
+				at++;
+
+			if (at >= tokens.size() || tokens[at].punct != ',' || word == "into")
+				break;
+
+			at++;
+		}
+	}
+
+	return kind;
+}
+
+}
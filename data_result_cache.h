@@ -0,0 +1,188 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_RESULT_CACHE_H_
+#define STDEX_DATA_RESULT_CACHE_H_
+
+#include "data_source.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+namespace stdex {
+
+struct ResultCacheOptions
+{
+	//independently locked parts, a key always maps to the same one
+	size_t shards;
+	//approximate size of the cached rows and keys over all shards,
+	//the least recently used entries go first past it
+	size_t max_bytes;
+	//used when put is given a ttl of 0
+	uint32_t ttl_ms;
+
+	ResultCacheOptions();
+};
+
+struct ResultCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	//lookups that found an entry past its ttl
+	uint64_t expired;
+	//lookups that found an entry a write had invalidated
+	uint64_t stale;
+	uint64_t evictions;
+	//tables written to, a write the cache can not follow counts once
+	uint64_t invalidations;
+	size_t entries;
+	size_t bytes;
+
+	double hit_rate() const;
+};
+
+//what a lookup saw of the tables a query reads. a miss hands it to the
+//caller, who passes it to put once the query ran, so a write landing
+//in between keeps the result from being served
+struct ResultCacheTicket
+{
+	string key;
+	uint64_t epoch;
+	std::vector<std::pair<std::atomic<uint64_t> *, uint64_t>> tables;
+};
+
+//results of read queries, keyed by sql and parameters. every write
+//that goes through the cache bumps a generation per table it touches,
+//and an entry is only served while the generations it was filled
+//under are current. writes made behind the cache's back are only
+//noticed when the ttl runs out
+class ResultCache
+{
+public:
+	ResultCache();
+	~ResultCache();
+
+	int open(const ResultCacheOptions &options);
+
+	//copies the rows out on a hit, fills ticket on a miss
+	bool get(const string &sql, const std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows, ResultCacheTicket &ticket);
+	//ttl_ms 0 uses the default
+	void put(ResultCacheTicket &ticket, const std::vector<std::vector<Meta>> &rows, uint32_t ttl_ms=0);
+
+	//called after sql ran, with the tables it writes. a statement that
+	//is neither a plain read nor an insert, update, delete or replace,
+	//commit or ddl included, invalidates everything
+	void invalidate_sql(const string &sql);
+	void invalidate(const string &table);
+	void invalidate_all();
+
+	ResultCacheStats stats() const;
+
+	enum SqlKind
+	{
+		SQL_READ,
+		SQL_WRITE,
+		SQL_OTHER,
+	};
+
+	//the tables named after FROM, JOIN, INTO and UPDATE, lower case and
+	//without the schema or quotes. a rough scan rather than a parser,
+	//for a write it may name more tables than are written, never fewer
+	static SqlKind scan_tables(const string &sql, std::vector<string> &tables);
+
+	//sql and parameters as one string, equal only for the same sql with
+	//parameters of the same types and values
+	static void make_key(const string &sql, const std::vector<Meta> &in, string &key);
+
+private:
+	ResultCache(const ResultCache &) = delete;
+	ResultCache &operator=(const ResultCache &) = delete;
+
+	struct Entry;
+	struct Shard;
+
+	std::atomic<uint64_t> *generation(const string &table);
+	Shard &shard_of(const string &key);
+	static size_t row_bytes(const std::vector<std::vector<Meta>> &rows);
+
+	ResultCacheOptions _options;
+	std::unique_ptr<Shard[]> _shards;
+	size_t _shard_bytes;
+
+	//bumped by writes the cache can not attribute to tables
+	std::atomic<uint64_t> _epoch;
+	std::atomic<uint64_t> _invalidations;
+
+	//generations are never removed, entries point at them
+	std::mutex _table_mutex;
+	std::unordered_map<string, std::unique_ptr<std::atomic<uint64_t>>> _tables;
+};
+
+//query_all served from the cache when it can, a successful result is
+//stored on a miss
+template <typename Source>
+int cached_query_all(ResultCache &cache, Source &source, const string &sql, std::vector<Meta> &in,
+	std::vector<std::vector<Meta>> &rows, uint32_t ttl_ms=0)
+{
+	ResultCacheTicket ticket;
+	if (cache.get(sql, in, rows, ticket))
+		return 0;
+
+	int ret = source.query_all(sql, in, rows);
+	if (!ret)
+		cache.put(ticket, rows, ttl_ms);
+
+	return ret;
+}
+
+//execute, then invalidates what it wrote, failed or not since part of
+//it may have been applied
+template <typename Source>
+int cached_execute(ResultCache &cache, Source &source, const string &sql, std::vector<Meta> &in)
+{
+	int ret = source.execute(sql, in);
+	cache.invalidate_sql(sql);
+	return ret;
+}
+
+template <typename Source, typename Count>
+int cached_execute(ResultCache &cache, Source &source, const string &sql, std::vector<Meta> &in, Count *affected)
+{
+	int ret = source.execute(sql, in, affected);
+	cache.invalidate_sql(sql);
+	return ret;
+}
+
+template <typename Source>
+int cached_insert(ResultCache &cache, Source &source, const string &sql, std::vector<Meta> &in)
+{
+	int ret = source.insert(sql, in);
+	cache.invalidate_sql(sql);
+	return ret;
+}
+
+template <typename Source, typename Id>
+int cached_insert(ResultCache &cache, Source &source, const string &sql, std::vector<Meta> &in, Id *insert_id)
+{
+	int ret = source.insert(sql, in, insert_id);
+	cache.invalidate_sql(sql);
+	return ret;
+}
+
+}
+#endif //STDEX_DATA_RESULT_CACHE_H_
@@ -0,0 +1,62 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_ROW_MAPPING_H_
+#define STDEX_DATA_ROW_MAPPING_H_
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+namespace stdex {
+
+//maps a struct onto result columns for query_as. specialize it with a
+//fields() returning references to the members in column order:
+//
+//	template <> struct RowMapping<User>
+//	{
+//		static std::tuple<int32_t &, string &> fields(User &u)
+//		{
+//			return std::tie(u.id, u.name);
+//		}
+//	};
+//
+//supported member types are int32_t, int64_t, float, double and string
+template <typename T>
+struct RowMapping;
+
+//compile time list of column indexes used to walk a tuple
+template <size_t... I>
+struct IndexSequence
+{
+};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...>
+{
+};
+
+template <size_t... I>
+struct MakeIndexSequence<0, I...>
+{
+	typedef IndexSequence<I...> type;
+};
+
+}
+#endif //STDEX_DATA_ROW_MAPPING_H_
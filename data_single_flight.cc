@@ -0,0 +1,161 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_single_flight.h"
+namespace stdex {
+
+SingleFlight::SingleFlight(size_t shards)
+{
+	_shard_num = shards ? shards : 1;
+	_shards.reset(new Shard[_shard_num]);
+	_executions = 0;
+	_coalesced = 0;
+}
+
+SingleFlight::~SingleFlight()
+{
+}
+
+int SingleFlight::run(const string &key, std::vector<std::vector<Meta>> &rows, const Fetch &fetch)
+{
+	Shard &shard = _shards[std::hash<string>()(key) % _shard_num];
+	std::shared_ptr<Flight> flight;
+
+	{
+		std::unique_lock<std::mutex> lock(shard.mutex);
+
+		auto it = shard.flights.find(key);
+		if (it != shard.flights.end())
+		{
+			flight = it->second;
+			_coalesced++;
+
+			flight->done_cond.wait(lock, [&flight] { return flight->done; });
+			lock.unlock();
+
+			//the rows are not touched again once the flight is done
+			rows = flight->rows;
+			return flight->code;
+		}
+
+		flight = std::make_shared<Flight>();
+		flight->done = false;
+		flight->code = 0;
+		shard.flights[key] = flight;
+	}
+
+	_executions++;
+
+	//waiters must not be left hanging if the fetch throws
+	int code;
+	try
+	{
+		code = fetch(flight->rows);
+	}
+	catch (...)
+	{
+		flight->rows.clear();
+		finish(shard, key, *flight, -1);
+		throw;
+	}
+
+	rows = flight->rows;
+	finish(shard, key, *flight, code);
+	return code;
+}
+
+void SingleFlight::finish(Shard &shard, const string &key, Flight &flight, int code)
+{
+	std::lock_guard<std::mutex> lock(shard.mutex);
+
+	flight.code = code;
+	flight.done = true;
+	shard.flights.erase(key);
+	flight.done_cond.notify_all();
+}
+
+SingleFlightStats SingleFlight::stats() const
+{
+	SingleFlightStats out;
+	out.executions = _executions;
+	out.coalesced = _coalesced;
+	out.in_flight = 0;
+
+	for (size_t i=0; i<_shard_num; i++)
+	{
+		std::lock_guard<std::mutex> lock(_shards[i].mutex);
+		out.in_flight += _shards[i].flights.size();
+	}
+
+	return out;
+}
+
+SingleFlight &SingleFlight::global()
+{
+	static SingleFlight flight;
+	return flight;
+}
+
+#ifdef STDEX_HAS_MYSQL
+namespace {
+
+//a source that checks a connection out per call
+struct PoolSource
+{
+	MysqlPool &pool;
+
+	explicit PoolSource(MysqlPool &p) : pool(p) {}
+
+	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
+	{
+		MysqlPool::Lease conn = pool.acquire();
+		if (!conn)
+			return 1;
+
+		return conn->query_all(sql, in, rows);
+	}
+
+	int query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
+	{
+		MysqlPool::Lease conn = pool.acquire();
+		if (!conn)
+			return 1;
+
+		return conn->query(sql, in, row);
+	}
+};
+
+}
+
+int coalesced_query_all(SingleFlight &flight, MysqlPool &pool, const string &sql, std::vector<Meta> &in,
+	std::vector<std::vector<Meta>> &rows)
+{
+	PoolSource source(pool);
+	return coalesced_query_all(flight, source, sql, in, rows);
+}
+
+int coalesced_query(SingleFlight &flight, MysqlPool &pool, const string &sql, std::vector<Meta> &in,
+	std::vector<Meta> &row)
+{
+	PoolSource source(pool);
+	return coalesced_query(flight, source, sql, in, row);
+}
+#endif
+
+}
@@ -0,0 +1,140 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_SINGLE_FLIGHT_H_
+#define STDEX_DATA_SINGLE_FLIGHT_H_
+
+#include "data_source.h"
+#include "data_result_cache.h"
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql_pool.h"
+#endif
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+namespace stdex {
+
+struct SingleFlightStats
+{
+	//calls that ran the query themselves
+	uint64_t executions;
+	//calls that waited for another one's result instead
+	uint64_t coalesced;
+	//keys being run right now
+	size_t in_flight;
+};
+
+//lets concurrent callers asking for the same thing share one run of
+//it. the first caller for a key runs the fetch, whoever asks for the
+//key before it finished waits and gets a copy of its rows and return
+//code. nothing is kept once the run is over, pair it with ResultCache
+//for that.
+//
+//the scope of the coalescing is the instance: one per pool merges the
+//calls made through that pool, global() merges across the process and
+//is only right when every source using it reaches the same data
+class SingleFlight
+{
+public:
+	typedef std::function<int(std::vector<std::vector<Meta>> &rows)> Fetch;
+
+	explicit SingleFlight(size_t shards=16);
+	~SingleFlight();
+
+	int run(const string &key, std::vector<std::vector<Meta>> &rows, const Fetch &fetch);
+
+	SingleFlightStats stats() const;
+
+	static SingleFlight &global();
+
+private:
+	SingleFlight(const SingleFlight &) = delete;
+	SingleFlight &operator=(const SingleFlight &) = delete;
+
+	struct Flight
+	{
+		std::condition_variable done_cond;
+		bool done;
+		int code;
+		std::vector<std::vector<Meta>> rows;
+	};
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<string, std::shared_ptr<Flight>> flights;
+	};
+
+	void finish(Shard &shard, const string &key, Flight &flight, int code);
+
+	size_t _shard_num;
+	std::unique_ptr<Shard[]> _shards;
+	std::atomic<uint64_t> _executions;
+	std::atomic<uint64_t> _coalesced;
+};
+
+template <typename Source>
+int coalesced_query_all(SingleFlight &flight, Source &source, const string &sql, std::vector<Meta> &in,
+	std::vector<std::vector<Meta>> &rows)
+{
+	string key;
+	ResultCache::make_key(sql, in, key);
+
+	return flight.run(key, rows, [&](std::vector<std::vector<Meta>> &out) {
+		return source.query_all(sql, in, out);
+	});
+}
+
+//the single row form, row is left empty when there was no row
+template <typename Source>
+int coalesced_query(SingleFlight &flight, Source &source, const string &sql, std::vector<Meta> &in,
+	std::vector<Meta> &row)
+{
+	string key;
+	ResultCache::make_key(sql, in, key);
+	key += 'q';
+
+	std::vector<std::vector<Meta>> rows;
+	int ret = flight.run(key, rows, [&](std::vector<std::vector<Meta>> &out) {
+		out.resize(1);
+		int code = source.query(sql, in, out[0]);
+		if (out[0].empty())
+			out.clear();
+		return code;
+	});
+
+	row.clear();
+	if (!rows.empty())
+		row.swap(rows[0]);
+
+	return ret;
+}
+
+#ifdef STDEX_HAS_MYSQL
+//only the caller running the query checks a connection out, the ones
+//waiting on it hold none
+int coalesced_query_all(SingleFlight &flight, MysqlPool &pool, const string &sql, std::vector<Meta> &in,
+	std::vector<std::vector<Meta>> &rows);
+int coalesced_query(SingleFlight &flight, MysqlPool &pool, const string &sql, std::vector<Meta> &in,
+	std::vector<Meta> &row);
+#endif
+
+}
+#endif //STDEX_DATA_SINGLE_FLIGHT_H_
@@ -0,0 +1,353 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_slow_query_log.h"
+#include <chrono>
+namespace stdex {
+
+//fingerprints remembered for plan capture, past that plans stop
+static const size_t max_planned = 10000;
+
+SlowQueryOptions::SlowQueryOptions()
+{
+	threshold_us = 100000;
+	sample_rate = 1;
+	explain = false;
+	ring_size = 4096;
+}
+
+SlowQueryLog::SlowQueryLog()
+{
+	_file = NULL;
+	_mask = 0;
+	_tail = 0;
+	_head = 0;
+	_running = false;
+	_written = 0;
+	_dropped = 0;
+}
+
+SlowQueryLog::~SlowQueryLog()
+{
+	close();
+}
+
+int SlowQueryLog::open(const SlowQueryOptions &options)
+{
+	if (_running)
+		return 1;
+
+	_options = options;
+
+	if (_options.path.empty())
+	{
+		_file = stderr;
+	}
+	else
+	{
+		_file = fopen(_options.path.c_str(), "a");
+		if (!_file)
+			return 2;
+	}
+
+	size_t size = 2;
+	while (size < _options.ring_size)
+		size <<= 1;
+
+	_ring.reset(new Slot[size]);
+	_mask = size - 1;
+	_tail = 0;
+	_head = 0;
+
+	for (size_t i=0; i<size; i++)
+		_ring[i].seq = i;
+
+	_running = true;
+	_writer = std::thread(&SlowQueryLog::writer_loop, this);
+	return 0;
+}
+
+void SlowQueryLog::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_running)
+			return;
+
+		_running = false;
+	}
+
+	_cond.notify_one();
+	_writer.join();
+
+	if (_file && _file != stderr)
+		fclose(_file);
+
+	_file = NULL;
+}
+
+bool SlowQueryLog::should_log(uint64_t duration_us)
+{
+	if (duration_us < _options.threshold_us || !_ring)
+		return false;
+
+	if (_options.sample_rate >= 1)
+		return true;
+
+	//xorshift per thread, sampling needs no shared state
+	static thread_local uint64_t seed = 0;
+	if (!seed)
+		seed = now_us() ^ (uint64_t)(uintptr_t)&seed;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (seed >> 11) * (1.0 / 9007199254740992.0) < _options.sample_rate;
+}
+
+bool SlowQueryLog::want_plan(const string &sql)
+{
+	if (!_options.explain)
+		return false;
+
+	std::lock_guard<std::mutex> lock(_plan_mutex);
+	if (_planned.size() >= max_planned)
+		return false;
+
+	return _planned.insert(sql).second;
+}
+
+//a bounded queue after Dmitry Vyukov's, a slot's sequence tells whose
+//turn it is, so producers only contend on the tail
+void SlowQueryLog::write(SlowQueryEntry &entry)
+{
+	if (!_ring)
+		return;
+
+	entry.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	size_t pos = _tail.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	while (true)
+	{
+		slot = &_ring[pos & _mask];
+		size_t seq = slot->seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0)
+		{
+			if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			_dropped++;
+			return;
+		}
+		else
+		{
+			pos = _tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->entry.source = entry.source;
+	slot->entry.sql.swap(entry.sql);
+	slot->entry.param_types.swap(entry.param_types);
+	slot->entry.duration_us = entry.duration_us;
+	slot->entry.rows = entry.rows;
+	slot->entry.code = entry.code;
+	slot->entry.plan.swap(entry.plan);
+	slot->entry.time_ms = entry.time_ms;
+	slot->seq.store(pos + 1, std::memory_order_release);
+
+	//without the lock a wakeup can be missed, the writer polls anyway
+	_cond.notify_one();
+}
+
+uint64_t SlowQueryLog::written() const
+{
+	return _written;
+}
+
+uint64_t SlowQueryLog::dropped() const
+{
+	return _dropped;
+}
+
+uint64_t SlowQueryLog::now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *SlowQueryLog::type_name(Param::Type type)
+{
+	static const char *names[] = {"null", "int", "bigint", "float", "double", "string"};
+	return names[type];
+}
+
+string SlowQueryLog::param_types(const std::vector<Meta> &in)
+{
+	string out;
+
+	for (size_t i=0; i<in.size() && i<MAX_PARAM_TYPES; i++)
+	{
+		if (i)
+			out += ',';
+		out += type_name(Param(in[i]).type);
+	}
+
+	if (in.size() > MAX_PARAM_TYPES)
+		out += ",...";
+
+	return out;
+}
+
+string SlowQueryLog::param_types(const Param *params, size_t param_num)
+{
+	string out;
+
+	for (size_t i=0; i<param_num && i<MAX_PARAM_TYPES; i++)
+	{
+		if (i)
+			out += ',';
+		out += type_name(params[i].type);
+	}
+
+	if (param_num > MAX_PARAM_TYPES)
+		out += ",...";
+
+	return out;
+}
+
+bool SlowQueryLog::pop(SlowQueryEntry &entry)
+{
+	Slot &slot = _ring[_head & _mask];
+	if (slot.seq.load(std::memory_order_acquire) != _head + 1)
+		return false;
+
+	entry.source = slot.entry.source;
+	entry.sql.swap(slot.entry.sql);
+	entry.param_types.swap(slot.entry.param_types);
+	entry.duration_us = slot.entry.duration_us;
+	entry.rows = slot.entry.rows;
+	entry.code = slot.entry.code;
+	entry.plan.swap(slot.entry.plan);
+	entry.time_ms = slot.entry.time_ms;
+
+	slot.seq.store(_head + _mask + 1, std::memory_order_release);
+	_head++;
+	return true;
+}
+
+void SlowQueryLog::writer_loop()
+{
+	SlowQueryEntry entry;
+	string line;
+
+	while (true)
+	{
+		bool wrote = false;
+
+		while (pop(entry))
+		{
+			format(entry, line);
+			fwrite(line.data(), 1, line.size(), _file);
+			_written++;
+			wrote = true;
+		}
+
+		if (wrote)
+			fflush(_file);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (!_running)
+			break;
+
+		_cond.wait_for(lock, std::chrono::milliseconds(100));
+	}
+
+	//producers still running after close lose their entries
+	while (pop(entry))
+	{
+		format(entry, line);
+		fwrite(line.data(), 1, line.size(), _file);
+		_written++;
+	}
+
+	fflush(_file);
+}
+
+static void append_json(string &out, const string &val)
+{
+	out += '"';
+
+	for (size_t i=0; i<val.size(); i++)
+	{
+		unsigned char c = val[i];
+
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (c == '\n')
+		{
+			out += "\\n";
+		}
+		else if (c == '\t')
+		{
+			out += "\\t";
+		}
+		else if (c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+
+	out += '"';
+}
+
+void SlowQueryLog::format(const SlowQueryEntry &entry, string &line)
+{
+	char buf[160];
+	snprintf(buf, sizeof(buf), "{\"time_ms\":%lld,\"source\":\"%s\",\"duration_us\":%llu,\"rows\":%llu,\"code\":%u,\"sql\":",
+		(long long)entry.time_ms, entry.source, (unsigned long long)entry.duration_us, (unsigned long long)entry.rows, entry.code);
+
+	line = buf;
+	append_json(line, entry.sql);
+	line += ",\"param_types\":";
+	append_json(line, entry.param_types);
+
+	if (!entry.plan.empty())
+	{
+		line += ",\"plan\":";
+		append_json(line, entry.plan);
+	}
+
+	line += "}\n";
+}
+
+}
@@ -0,0 +1,132 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_SLOW_QUERY_LOG_H_
+#define STDEX_DATA_SLOW_QUERY_LOG_H_
+
+#include "data_source.h"
+#include "data_query_stats.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+namespace stdex {
+
+struct SlowQueryOptions
+{
+	//file the entries are appended to, one json object per line.
+	//stderr when empty
+	string path;
+	//calls taking at least this long are slow
+	uint64_t threshold_us;
+	//share of the slow calls that get logged, 1 logs every one
+	double sample_rate;
+	//capture EXPLAIN (mysql) or EXPLAIN QUERY PLAN (sqlite) the first
+	//time a fingerprint is logged. it runs on the calling connection
+	bool explain;
+	//entries waiting for the writer, rounded up to a power of two.
+	//entries beyond it are dropped rather than waited for
+	size_t ring_size;
+
+	SlowQueryOptions();
+};
+
+struct SlowQueryEntry
+{
+	const char *source;
+	//normalized, literals replaced by ?
+	string sql;
+	string param_types;
+	uint64_t duration_us;
+	uint64_t rows;
+	unsigned code;
+	string plan;
+	int64_t time_ms;
+};
+
+//collects slow calls from any number of connections. the data sources
+//hand entries over through a lock free ring and a writer thread does
+//the formatting and the disk writes
+class SlowQueryLog
+{
+public:
+	//types listed per entry, a multi row insert would list thousands
+	enum { MAX_PARAM_TYPES = 32 };
+
+	SlowQueryLog();
+	~SlowQueryLog();
+
+	int open(const SlowQueryOptions &options);
+	//writes what is still queued and stops the writer
+	void close();
+
+	//whether a call that took duration_us gets logged, sampling included
+	bool should_log(uint64_t duration_us);
+	//true once per fingerprint when plans are captured
+	bool want_plan(const string &sql);
+	//takes the strings of entry, never blocks
+	void write(SlowQueryEntry &entry);
+
+	uint64_t written() const;
+	uint64_t dropped() const;
+
+	static uint64_t now_us();
+	static string param_types(const std::vector<Meta> &in);
+	static string param_types(const Param *params, size_t param_num);
+	//the name param_types lists for a bound type
+	static const char *type_name(Param::Type type);
+
+private:
+	SlowQueryLog(const SlowQueryLog &) = delete;
+	SlowQueryLog &operator=(const SlowQueryLog &) = delete;
+
+	struct Slot
+	{
+		std::atomic<size_t> seq;
+		SlowQueryEntry entry;
+	};
+
+	bool pop(SlowQueryEntry &entry);
+	void writer_loop();
+	void format(const SlowQueryEntry &entry, string &line);
+
+	SlowQueryOptions _options;
+	FILE *_file;
+
+	std::unique_ptr<Slot[]> _ring;
+	size_t _mask;
+	std::atomic<size_t> _tail;
+	size_t _head;
+
+	std::thread _writer;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _running;
+
+	std::mutex _plan_mutex;
+	std::unordered_set<string> _planned;
+
+	std::atomic<uint64_t> _written;
+	std::atomic<uint64_t> _dropped;
+};
+
+}
+#endif //STDEX_DATA_SLOW_QUERY_LOG_H_
@@ -0,0 +1,147 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_SOURCE_H_
+#define STDEX_DATA_SOURCE_H_
+
+#include "data_meta.h"
+#include "data_column_batch.h"
+#include "data_result_arena.h"
+#include "data_row_mapping.h"
+#include <cstddef>
+#include <functional>
+
+namespace stdex {
+
+//called by query_each once per fetched row. the row is reused for the
+//next fetch, so keep what you need by copying or moving it out. return
+//false to stop the fetch early.
+typedef std::function<bool(std::vector<Meta> &row)> RowCallback;
+
+//outcome of one batch written by insert_batch, code is 0 when the
+//batch went through and the error code of the failed call otherwise
+struct BatchResult
+{
+	size_t first_row;
+	size_t row_count;
+	int64_t affected;
+	int code;
+	unsigned errnum;
+	string error;
+};
+
+//one argument of the variadic execute/query calls. numbers are held by
+//value and strings are borrowed, so the argument has to outlive the call
+struct Param
+{
+	enum Type
+	{
+		TYPE_NULL,
+		TYPE_INT,
+		TYPE_BIGINT,
+		TYPE_FLOAT,
+		TYPE_DOUBLE,
+		TYPE_STRING,
+	};
+
+	Param() : type(TYPE_NULL), terminated(false) {}
+	Param(std::nullptr_t) : type(TYPE_NULL), terminated(false) {}
+	Param(int val) { set_integer(val, sizeof(val)); }
+	Param(unsigned val) { set_integer(val, sizeof(val)); }
+	Param(long val) { set_integer(val, sizeof(val)); }
+	Param(unsigned long val) { set_integer(val, sizeof(val)); }
+	Param(long long val) { set_integer(val, sizeof(val)); }
+	Param(unsigned long long val) { set_integer(val, sizeof(val)); }
+	Param(float val) : type(TYPE_FLOAT), terminated(false) { number_f32 = val; }
+	Param(double val) : type(TYPE_DOUBLE), terminated(false) { number_f64 = val; }
+	//a null pointer binds sql NULL
+	Param(const char *val) : type(TYPE_NULL), terminated(false)
+	{
+		if (val)
+			set_string(val, strlen(val), true);
+	}
+	Param(const string &val) { set_string(val.data(), val.size(), true); }
+
+	Param(const Meta &val)
+	{
+		if (val.is_integer())
+			set_integer(val.get_int(), 4);
+		else if (val.is_bigint())
+			set_integer(val.get_bigint(), 8);
+		else if (val.is_float())
+			*this = Param(val.get_float());
+		else if (val.is_double())
+			*this = Param(val.get_double());
+		else if (val.is_string())
+			set_string(val.string_data(), val.string_size(), false);
+		else
+			*this = Param();
+	}
+
+	void set_integer(int64_t val, size_t size)
+	{
+		terminated = false;
+		if (size <= 4)
+		{
+			type = TYPE_INT;
+			number_i32 = (int32_t)val;
+		}
+		else
+		{
+			type = TYPE_BIGINT;
+			number_i64 = val;
+		}
+	}
+
+	void set_string(const char *data, size_t size, bool nul)
+	{
+		type = TYPE_STRING;
+		terminated = nul;
+		str.data = data;
+		str.size = size;
+	}
+
+	Type type;
+	//the string bytes are followed by a null, which some drivers need
+	bool terminated;
+
+	union
+	{
+		int32_t number_i32;
+		int64_t number_i64;
+		float number_f32;
+		double number_f64;
+		struct
+		{
+			const char *data;
+			size_t size;
+		} str;
+	};
+};
+
+//a single row rejected by an array dml execution
+struct RowError
+{
+	size_t row;
+	unsigned errnum;
+	string error;
+};
+
+}
+#endif //STDEX_DATA_SOURCE_H_
@@ -0,0 +1,179 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_SOURCE_CORO_H_
+#define STDEX_DATA_SOURCE_CORO_H_
+#ifdef __cpp_impl_coroutine
+
+#include "data_io_pool.h"
+#include "data_source_mysql.h"
+#include "data_source_oracle.h"
+#include "data_source_sqlite.h"
+#include <coroutine>
+#include <stop_token>
+namespace stdex {
+
+//returned when the stop token fired before or while the call ran
+static const int call_cancelled = -1;
+
+//awaits a blocking data source call run on an IoPool. the coroutine is
+//resumed on the pool thread that ran the call, and the arguments of the
+//call have to live until the co_await finishes
+class DbCall
+{
+public:
+	typedef std::function<int()> Func;
+	typedef std::function<void()> Interrupt;
+
+	DbCall(IoPool &pool, Func func, Interrupt interrupt, std::stop_token stop)
+		: _pool(pool), _func(std::move(func)), _interrupt(std::move(interrupt)), _stop(std::move(stop)), _ret(0) {}
+
+	bool await_ready()
+	{
+		if (!_stop.stop_requested())
+			return false;
+
+		_ret = call_cancelled;
+		return true;
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		bool posted = _pool.post([this, handle]() {
+			run();
+			handle.resume();
+		});
+
+		//the pool is shutting down, run the call here instead
+		if (!posted)
+			run();
+
+		return posted;
+	}
+
+	int await_resume() const
+	{
+		return _ret;
+	}
+
+private:
+	void run()
+	{
+		if (_stop.stop_requested())
+		{
+			_ret = call_cancelled;
+			return;
+		}
+
+		if (_interrupt)
+		{
+			std::stop_callback<Interrupt> on_stop(_stop, _interrupt);
+			_ret = _func();
+		}
+		else
+		{
+			_ret = _func();
+		}
+
+		if (_ret && _stop.stop_requested())
+			_ret = call_cancelled;
+	}
+
+	IoPool &_pool;
+	Func _func;
+	Interrupt _interrupt;
+	std::stop_token _stop;
+	int _ret;
+};
+
+//how a running call is aborted when its stop token fires. drivers
+//without a way to do that only honour the token before the call starts
+template <typename DS>
+DbCall::Interrupt interrupt_of(DS &)
+{
+	return nullptr;
+}
+
+#ifdef STDEX_HAS_SQLITE
+inline DbCall::Interrupt interrupt_of(DataSourceSqlite &ds)
+{
+	return [&ds]() { ds.interrupt(); };
+}
+#endif
+
+//runs any blocking function returning an error code on the pool
+inline DbCall co_run(IoPool &pool, DbCall::Func func, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, std::move(func), nullptr, std::move(stop));
+}
+
+//a data source runs one call at a time, a connection shared between
+//coroutines needs one of them to own it or a MysqlPool lease per call
+template <typename DS>
+DbCall co_query(IoPool &pool, DS &ds, const string &sql, std::vector<Meta> &in, std::vector<Meta> &row, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql, &in, &row]() {
+		return ds.query(sql, in, row);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+//rows is anything query_all takes: vector rows, ArenaRows or typed tuples
+template <typename DS, typename Rows>
+DbCall co_query_all(IoPool &pool, DS &ds, const string &sql, std::vector<Meta> &in, Rows &rows, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql, &in, &rows]() {
+		return ds.query_all(sql, in, rows);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+template <typename DS>
+DbCall co_insert(IoPool &pool, DS &ds, const string &sql, std::vector<Meta> &in, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql, &in]() {
+		return ds.insert(sql, in);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+template <typename DS, typename Id>
+DbCall co_insert(IoPool &pool, DS &ds, const string &sql, std::vector<Meta> &in, Id *insert_id, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql, &in, insert_id]() {
+		return ds.insert(sql, in, insert_id);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+template <typename DS, typename Count>
+DbCall co_execute(IoPool &pool, DS &ds, const string &sql, std::vector<Meta> &in, Count *affected, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql, &in, affected]() {
+		return ds.execute(sql, in, affected);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+template <typename DS>
+DbCall co_execute(IoPool &pool, DS &ds, const string &sql, std::stop_token stop=std::stop_token())
+{
+	return DbCall(pool, [&ds, &sql]() {
+		return ds.execute(sql);
+	}, interrupt_of(ds), std::move(stop));
+}
+
+}
+#endif
+#endif //STDEX_DATA_SOURCE_CORO_H_
@@ -19,8 +19,24 @@
 
 #ifdef STDEX_HAS_MYSQL
 #include "data_source_mysql.h"
+#include <errmsg.h>
+#include <mysqld_error.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef MYSQL_WAIT_READ
+#include <cerrno>
+#include <chrono>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#endif
 namespace stdex {
 
+//strings are bound to at most this many bytes, longer values are
+//pulled with mysql_stmt_fetch_column when they show up
+static const ulong max_string_bind = 64 * 1024;
+
 DataSourceMysql::DataSourceMysql()
 {
 	_dbase = new MYSQL();
@@ -28,6 +44,30 @@ DataSourceMysql::DataSourceMysql()
 	_ready = false;
 	_errno = 0;
 	_error = "";
+	_stmt_capacity = 32;
+	_stmt_hits = 0;
+	_stmt_misses = 0;
+	_thread_id = 0;
+	_max_packet = 0;
+	_stats = NULL;
+	_timing.stats = NULL;
+	_slow_log = NULL;
+	_slow_begin = 0;
+	_slow_rows = 0;
+
+#ifdef MYSQL_WAIT_READ
+	_async.step = ASYNC_IDLE;
+	_async.wait = 0;
+	_async.starting = false;
+	_async.code = 0;
+	_async.is_query = false;
+	_async.retried = false;
+	_async.affected = 0;
+	_async.stmt = NULL;
+	_async.st = NULL;
+	_async.deadline_us = 0;
+	_nonblocking = false;
+#endif
 }
 
 DataSourceMysql::~DataSourceMysql()
@@ -43,6 +83,12 @@ bool DataSourceMysql::is_ready() const
 
 int DataSourceMysql::open(const string &host, int port, const string &user, const string &passwd, const string &dbase)
 {
+#ifdef MYSQL_WAIT_READ
+	//the blocking calls keep working on a non blocking connection
+	if (_nonblocking)
+		mysql_options(_dbase, MYSQL_OPT_NONBLOCK, 0);
+#endif
+
 	if (!mysql_real_connect(_dbase, host.c_str(), user.c_str(), passwd.c_str(), dbase.c_str(), port, NULL, 0))
 	{
 		_errno = mysql_errno(_dbase);
@@ -56,12 +102,31 @@ int DataSourceMysql::open(const string &host, int port, const string &user, cons
 	my_bool reconnect = 1;
 	mysql_options(_dbase, MYSQL_OPT_RECONNECT, &reconnect);
 
+	_thread_id = mysql_thread_id(_dbase);
 	_ready = true;
 	return 0;
 }
 
 void DataSourceMysql::close()
 {
+#ifdef MYSQL_WAIT_READ
+	//a pending call is dropped without running its callback
+	if (_async.stmt)
+		mysql_stmt_close(_async.stmt);
+
+	_async.step = ASYNC_IDLE;
+	_async.wait = 0;
+	_async.deadline_us = 0;
+	_async.stmt = NULL;
+	_async.st = NULL;
+	_async.on_query = nullptr;
+	_async.on_execute = nullptr;
+	_async.rows.clear();
+#endif
+
+	clear_stmt_cache();
+	_max_packet = 0;
+
 	if (_ready)
 	{
 		mysql_close(_dbase);
@@ -70,430 +135,467 @@ void DataSourceMysql::close()
 	}
 }
 
-int DataSourceMysql::query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
+int DataSourceMysql::ping()
 {
-	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
-	if (!stmt)
-	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
+	if (!_ready || !check_idle())
 		return 1;
-	}
 
-	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+	if (mysql_ping(_dbase))
 	{
 		_errno = mysql_errno(_dbase);
 		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
+		check_connection(_errno);
 		return 2;
 	}
 
-	std::vector<MYSQL_BIND> param_binds;
-	std::vector<ulong> param_lens;
+	return 0;
+}
 
-	if (!in.empty())
-	{
-		param_binds.resize(in.size());
-		param_lens.resize(in.size());
+int DataSourceMysql::query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
+{
+	Statement *st = NULL;
 
-		for (size_t i = 0; i < in.size(); i++)
-		{
-			MYSQL_BIND &bind = param_binds[i];
-			memset(&bind, 0, sizeof(bind));
-			ulong &len = param_lens[i];
-			Meta &meta = in[i];
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
 
-			if (meta.is_integer())
-			{
-				int32_t &val = meta.int_ref();
+	return fetch_single(st, row);
+}
 
-				bind.buffer_type = MYSQL_TYPE_LONG;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_bigint())
-			{
-				int64_t &val = meta.bigint_ref();
+int DataSourceMysql::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
+{
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(std::move(row));
+		return true;
+	});
+}
 
-				bind.buffer_type = MYSQL_TYPE_LONGLONG;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_float())
-			{
-				float &val = meta.float_ref();
+int DataSourceMysql::query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows)
+{
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(row);
+		return true;
+	});
+}
 
-				bind.buffer_type = MYSQL_TYPE_FLOAT;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_double())
-			{
-				double &val = meta.double_ref();
+int DataSourceMysql::query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback)
+{
+	Statement *st = NULL;
 
-				bind.buffer_type = MYSQL_TYPE_DOUBLE;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				len = val.size();
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
 
-				bind.buffer_type = MYSQL_TYPE_STRING;
-				bind.buffer = (char *)&val[0];
-				bind.buffer_length = len;
-				bind.length = &len;
-			}
-			else
-			{
-				bind.buffer_type = MYSQL_TYPE_NULL;
-				bind.buffer = NULL;
-			}
-		}
+	if (!st->result_meta)
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 5;
+	}
 
-		if (mysql_stmt_bind_param(stmt, &param_binds[0]))
-		{
-			_errno = mysql_errno(_dbase);
-			_error = mysql_error(_dbase);
-			mysql_stmt_close(stmt);
-			return 3;
-		}
+	if (mysql_stmt_bind_result(st->stmt, &st->result.binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 6;
 	}
 
-	if (mysql_stmt_execute(stmt))
+	//rows are streamed from the server one at a time, finishing the
+	//statement after an early stop discards the rest of the stream
+	std::vector<Meta> &row = _row;
+
+	while (true)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 4;
+		ret = fetch_row(st->stmt, st->result, row);
+		if (ret == MYSQL_NO_DATA)
+			break;
+
+		if (ret)
+		{
+			_errno = mysql_stmt_errno(st->stmt);
+			_error = mysql_stmt_error(st->stmt);
+			finish(st);
+			check_connection(_errno);
+			return 7;
+		}
+
+		if (!callback(row))
+			break;
 	}
 
-	MYSQL_RES *result_meta = mysql_stmt_result_metadata(stmt);
-	if (!result_meta)
+	finish(st);
+	return 0;
+}
+
+int DataSourceMysql::query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch)
+{
+	Statement *st = NULL;
+
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
+
+	if (!st->result_meta)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
 		return 5;
 	}
 
-	MYSQL_FIELD *fields = mysql_fetch_fields(result_meta);
-	unsigned field_num = mysql_num_fields(result_meta);
-	mysql_free_result(result_meta);
-
-	std::vector<MYSQL_BIND> result_binds;
-	std::vector<my_bool> isnull_vec;
-	std::vector<ulong> length_vec;
+	if (mysql_stmt_bind_result(st->stmt, &st->result.binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 6;
+	}
 
-	row.resize(field_num);
-	result_binds.resize(field_num);
-	isnull_vec.resize(field_num);
-	length_vec.resize(field_num);
+	unsigned field_num = st->result.binds.size();
+	MYSQL_FIELD *fields = mysql_fetch_fields(st->result_meta);
+	batch.reset(field_num);
 
 	for (unsigned i = 0; i < field_num; i++)
 	{
-		MYSQL_BIND &bind = result_binds[i];
-		memset(&bind, 0, sizeof(bind));
+		MYSQL_BIND &bind = st->result.binds[i];
+		ColumnBatch::Type type = ColumnBatch::TYPE_STRING;
+
+		if (!bind.is_null)
+			type = ColumnBatch::TYPE_NULL;
+		else if (bind.buffer_type == MYSQL_TYPE_LONG)
+			type = ColumnBatch::TYPE_INT;
+		else if (bind.buffer_type == MYSQL_TYPE_LONGLONG)
+			type = ColumnBatch::TYPE_BIGINT;
+		else if (bind.buffer_type == MYSQL_TYPE_FLOAT)
+			type = ColumnBatch::TYPE_FLOAT;
+		else if (bind.buffer_type == MYSQL_TYPE_DOUBLE)
+			type = ColumnBatch::TYPE_DOUBLE;
+
+		batch.set_column(i, fields[i].name, type);
+	}
 
-		MYSQL_FIELD &field = fields[i];
-		Meta &meta = row[i];
-		my_bool &isnull = isnull_vec[i];
-		ulong &length = length_vec[i];
+	while (true)
+	{
+		ret = fetch_columns(st->stmt, st->result, batch);
+		if (ret == MYSQL_NO_DATA)
+			break;
 
-		if (field.type == MYSQL_TYPE_TINY || field.type == MYSQL_TYPE_SHORT || field.type == MYSQL_TYPE_LONG)
+		if (ret)
 		{
-			meta = (int32_t)0;
-			int32_t &val = meta.int_ref();
-
-			bind.buffer_type = MYSQL_TYPE_LONG;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
+			_errno = mysql_stmt_errno(st->stmt);
+			_error = mysql_stmt_error(st->stmt);
+			finish(st);
+			check_connection(_errno);
+			return 7;
 		}
-		else if (field.type == MYSQL_TYPE_LONGLONG)
-		{
-			meta = (int64_t)0;
-			int64_t &val = meta.bigint_ref();
+	}
 
-			bind.buffer_type = MYSQL_TYPE_LONGLONG;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_FLOAT)
-		{
-			meta = (float)0;
-			float &val = meta.float_ref();
+	finish(st);
+	return 0;
+}
 
-			bind.buffer_type = MYSQL_TYPE_FLOAT;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_DOUBLE)
-		{
-			meta = (double)0;
-			double &val = meta.double_ref();
+int DataSourceMysql::query_typed(const string &sql, std::vector<Meta> &in, TypedBinds &typed, const std::function<void()> &on_row)
+{
+	Statement *st = NULL;
 
-			bind.buffer_type = MYSQL_TYPE_DOUBLE;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_STRING || field.type == MYSQL_TYPE_VAR_STRING)
-		{
-			meta = "";
-			string &val = meta.string_ref();
-			val.resize(field.length);
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
 
-			bind.buffer_type = field.type;
-			bind.buffer = (char *)&val[0];
-			bind.buffer_length = val.size();
-			bind.length = &length;
-			bind.is_null = &isnull;
-		}
+	if (!st->result_meta)
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 5;
 	}
 
-	if (mysql_stmt_bind_result(stmt, &result_binds[0]))
+	unsigned field_num = mysql_num_fields(st->result_meta);
+	if (field_num != typed.binds.size())
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 6;
+		_errno = 0;
+		_error = "column count does not match the row type";
+		finish(st);
+		return 8;
 	}
 
-	int ret = mysql_stmt_fetch(stmt);
-	if (ret)
+	//string columns share one buffer sized from the field metadata
+	MYSQL_FIELD *fields = mysql_fetch_fields(st->result_meta);
+	size_t buffer_size = 0;
+
+	for (unsigned i = 0; i < field_num; i++)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 7;
+		if (!typed.strings[i])
+			continue;
+
+		ulong size = fields[i].length < max_string_bind ? fields[i].length : max_string_bind;
+		if (size == 0)
+			size = 1;
+
+		MYSQL_BIND &bind = typed.binds[i];
+		bind.buffer_type = MYSQL_TYPE_STRING;
+		bind.buffer_length = size;
+		bind.length = &typed.length_vec[i];
+		bind.is_null = &typed.isnull_vec[i];
+		buffer_size += (size + 7) & ~(size_t)7;
 	}
 
+	typed.buffer.resize(buffer_size);
+	buffer_size = 0;
+
 	for (unsigned i = 0; i < field_num; i++)
 	{
-		Meta &meta = row[i];
-		my_bool &isnull = isnull_vec[i];
-		ulong &length = length_vec[i];
+		if (!typed.strings[i])
+			continue;
 
-		if (isnull)
-			meta = Meta();
+		MYSQL_BIND &bind = typed.binds[i];
+		bind.buffer = &typed.buffer[buffer_size];
+		buffer_size += (bind.buffer_length + 7) & ~(size_t)7;
+	}
 
-		if (meta.is_string())
-			meta.string_ref().resize(length);
+	if (mysql_stmt_bind_result(st->stmt, &typed.binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 6;
 	}
 
-	mysql_stmt_close(stmt);
+	while (true)
+	{
+		ret = mysql_stmt_fetch(st->stmt);
+		if (ret == MYSQL_NO_DATA)
+			break;
+
+		if ((ret && ret != MYSQL_DATA_TRUNCATED) || fetch_typed(st->stmt, typed))
+		{
+			_errno = mysql_stmt_errno(st->stmt);
+			_error = mysql_stmt_error(st->stmt);
+			finish(st);
+			check_connection(_errno);
+			return 7;
+		}
+
+		on_row();
+	}
+
+	finish(st);
 	return 0;
 }
 
-int DataSourceMysql::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
+int DataSourceMysql::insert(const string &sql, std::vector<Meta> &in, int64_t *insert_id)
 {
-	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
-	if (!stmt)
+	Statement *st = NULL;
+
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
+
+	if (insert_id)
+		*insert_id = mysql_stmt_insert_id(st->stmt);
+
+	finish(st);
+	return 0;
+}
+
+int DataSourceMysql::execute(const string &sql, std::vector<Meta> &in, int64_t *affected)
+{
+	Statement *st = NULL;
+
+	int ret = execute_stmt(sql, &in, 1, st);
+	if (ret)
+		return ret;
+
+	if (affected)
+		*affected = mysql_stmt_affected_rows(st->stmt);
+
+	finish(st);
+	return 0;
+}
+
+int DataSourceMysql::insert_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, size_t batch_size, std::vector<BatchResult> *results)
+{
+	size_t tuple_begin, tuple_end;
+	bool multi_row = find_values_tuple(sql, tuple_begin, tuple_end);
+	string tuple = multi_row ? sql.substr(tuple_begin, tuple_end - tuple_begin) : string();
+
+	//keep clear of the packet limit, the statement text and the
+	//protocol framing are not counted below
+	size_t packet = multi_row ? max_packet() : 1024 * 1024;
+	size_t max_bytes = packet - packet / 8;
+	size_t param_num = 0;
+
+	if (multi_row)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		return 1;
+		for (size_t i = 0; i < tuple.size(); i++)
+		{
+			if (tuple[i] == '?')
+				param_num++;
+		}
 	}
 
-	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+	//every full batch has the same number of rows and the remainder
+	//goes in one tail statement, so a load prepares two statements at
+	//most. sized from the packet limit the full count is rounded down
+	//to a power of two, which keeps it the same from one load to the
+	//next as long as the rows are of similar size
+	size_t full_count = 1;
+
+	if (multi_row)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 2;
+		size_t widest = 1;
+		for (size_t i = 0; i < rows.size(); i++)
+			widest = std::max(widest, param_bytes(rows[i]));
+
+		size_t limit = std::max<size_t>(max_bytes / widest, 1);
+
+		//prepared statements take at most 65535 placeholders
+		if (param_num)
+			limit = std::min(limit, std::max<size_t>(65535 / param_num, 1));
+		if (batch_size)
+		{
+			full_count = std::min(limit, batch_size);
+		}
+		else
+		{
+			while (full_count * 2 <= limit)
+				full_count *= 2;
+		}
 	}
 
-	std::vector<MYSQL_BIND> param_binds;
-	std::vector<ulong> param_lens;
+	int first_error = 0;
+	size_t next = 0;
+	string batch_sql;
 
-	if (!in.empty())
+	while (next < rows.size())
 	{
-		param_binds.resize(in.size());
-		param_lens.resize(in.size());
+		size_t count = std::min(full_count, rows.size() - next);
+		bool tail = count < full_count;
 
-		for (size_t i = 0; i < in.size(); i++)
+		if (multi_row)
 		{
-			MYSQL_BIND &bind = param_binds[i];
-			memset(&bind, 0, sizeof(bind));
-			ulong &len = param_lens[i];
-			Meta &meta = in[i];
-
-			if (meta.is_integer())
+			batch_sql.assign(sql, 0, tuple_end);
+			for (size_t i = 1; i < count; i++)
 			{
-				int32_t &val = meta.int_ref();
-
-				bind.buffer_type = MYSQL_TYPE_LONG;
-				bind.buffer = (char *)&val;
+				batch_sql += ',';
+				batch_sql += tuple;
 			}
-			else if (meta.is_bigint())
-			{
-				int64_t &val = meta.bigint_ref();
+			batch_sql.append(sql, tuple_end, string::npos);
+		}
 
-				bind.buffer_type = MYSQL_TYPE_LONGLONG;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_float())
-			{
-				float &val = meta.float_ref();
+		Statement *st = NULL;
+		int ret = execute_stmt(multi_row ? batch_sql : sql, &rows[next], count, st);
 
-				bind.buffer_type = MYSQL_TYPE_FLOAT;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_double())
-			{
-				double &val = meta.double_ref();
+		BatchResult result;
+		result.first_row = next;
+		result.row_count = count;
+		result.affected = 0;
+		result.code = ret;
+		result.errnum = 0;
 
-				bind.buffer_type = MYSQL_TYPE_DOUBLE;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				len = val.size();
+		if (ret)
+		{
+			result.errnum = _errno;
+			result.error = _error;
 
-				bind.buffer_type = MYSQL_TYPE_STRING;
-				bind.buffer = (char *)&val[0];
-				bind.buffer_length = len;
-				bind.length = &len;
-			}
-			else
-			{
-				bind.buffer_type = MYSQL_TYPE_NULL;
-				bind.buffer = NULL;
-			}
+			if (!first_error)
+				first_error = ret;
+		}
+		else
+		{
+			result.affected = mysql_stmt_affected_rows(st->stmt);
+			finish(st);
 		}
 
-		if (mysql_stmt_bind_param(stmt, &param_binds[0]))
+		if (results)
+			results->push_back(std::move(result));
+
+		//the tail count is a one off, it would only push the statements
+		//in use out of the cache
+		if (tail)
 		{
-			_errno = mysql_errno(_dbase);
-			_error = mysql_error(_dbase);
-			mysql_stmt_close(stmt);
-			return 3;
+			auto it = _stmt_map.find(batch_sql);
+			if (it != _stmt_map.end())
+				evict(&*it->second);
 		}
-	}
 
-	if (mysql_stmt_execute(stmt))
-	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 4;
+		next += count;
 	}
 
-	MYSQL_RES *result_meta = mysql_stmt_result_metadata(stmt);
-	if (!result_meta)
+	return first_error;
+}
+
+int DataSourceMysql::execute(const string &sql)
+{
+	if (!check_idle())
+		return 1;
+
+	if (mysql_query(_dbase, sql.c_str()))
 	{
 		_errno = mysql_errno(_dbase);
 		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 5;
+		return 1;
 	}
 
-	MYSQL_FIELD *fields = mysql_fetch_fields(result_meta);
-	unsigned field_num = mysql_num_fields(result_meta);
-	mysql_free_result(result_meta);
+	return 0;
+}
 
-	std::vector<MYSQL_BIND> result_binds;
-	std::vector<Meta> row;
-	std::vector<my_bool> isnull_vec;
-	std::vector<ulong> length_vec;
-
-	result_binds.resize(field_num);
-	row.resize(field_num);
-	isnull_vec.resize(field_num);
-	length_vec.resize(field_num);
-
-	for (unsigned i = 0; i < field_num; i++)
-	{
-		MYSQL_BIND &bind = result_binds[i];
-		memset(&bind, 0, sizeof(bind));
-
-		MYSQL_FIELD &field = fields[i];
-		Meta &meta = row[i];
-		my_bool &isnull = isnull_vec[i];
-		ulong &length = length_vec[i];
-
-		if (field.type == MYSQL_TYPE_TINY || field.type == MYSQL_TYPE_SHORT || field.type == MYSQL_TYPE_LONG)
-		{
-			meta = (int32_t)0;
-			int32_t &val = meta.int_ref();
-
-			bind.buffer_type = MYSQL_TYPE_LONG;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_LONGLONG)
-		{
-			meta = (int64_t)0;
-			int64_t &val = meta.bigint_ref();
-
-			bind.buffer_type = MYSQL_TYPE_LONGLONG;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_FLOAT)
-		{
-			meta = (float)0;
-			float &val = meta.float_ref();
+int DataSourceMysql::execute_params(const string &sql, const Param *params, size_t param_num, int64_t *affected)
+{
+	Statement *st = NULL;
 
-			bind.buffer_type = MYSQL_TYPE_FLOAT;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_DOUBLE)
-		{
-			meta = (double)0;
-			double &val = meta.double_ref();
+	int ret = execute_stmt(sql, params, param_num, st);
+	if (ret)
+		return ret;
 
-			bind.buffer_type = MYSQL_TYPE_DOUBLE;
-			bind.buffer = (char *)&val;
-			bind.is_null = &isnull;
-		}
-		else if (field.type == MYSQL_TYPE_STRING || field.type == MYSQL_TYPE_VAR_STRING)
-		{
-			meta = "";
-			string &val = meta.string_ref();
-			val.resize(field.length);
+	if (affected)
+		*affected = mysql_stmt_affected_rows(st->stmt);
 
-			bind.buffer_type = field.type;
-			bind.buffer = (char *)&val[0];
-			bind.buffer_length = val.size();
-			bind.length = &length;
-			bind.is_null = &isnull;
-		}
-	}
+	finish(st);
+	return 0;
+}
 
-	if (mysql_stmt_bind_result(stmt, &result_binds[0]))
-	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 6;
-	}
+int DataSourceMysql::query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row)
+{
+	Statement *st = NULL;
 
-	while (!mysql_stmt_fetch(stmt))
-	{
-		std::vector<Meta> tmp = row;
+	int ret = execute_stmt(sql, params, param_num, st);
+	if (ret)
+		return ret;
 
-		for (unsigned i = 0; i < field_num; i++)
-		{
-			Meta &meta = tmp[i];
-			my_bool &isnull = isnull_vec[i];
-			ulong &length = length_vec[i];
+	return fetch_single(st, row);
+}
 
-			if (isnull)
-				meta = Meta();
+void DataSourceMysql::set_stmt_cache_capacity(size_t capacity)
+{
+	_stmt_capacity = capacity;
 
-			if (meta.is_string())
-				meta.string_ref().resize(length);
-		}
+	while (_stmt_list.size() > _stmt_capacity)
+		evict(&_stmt_list.back());
+}
 
-		rows.push_back(std::move(tmp));
-	}
+size_t DataSourceMysql::stmt_cache_capacity() const
+{
+	return _stmt_capacity;
+}
 
-	mysql_stmt_close(stmt);
-	return 0;
+uint64_t DataSourceMysql::stmt_cache_hits() const
+{
+	return _stmt_hits;
 }
 
+uint64_t DataSourceMysql::stmt_cache_misses() const
+{
+	return _stmt_misses;
+}
 
-int DataSourceMysql::insert(const string &sql, std::vector<Meta> &in, int64_t *insert_id)
+int DataSourceMysql::prepare(const string &sql, Statement *&st)
 {
+	if (find_statement(sql, st))
+		return 0;
+
 	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
 	if (!stmt)
 	{
@@ -504,62 +606,126 @@ int DataSourceMysql::insert(const string &sql, std::vector<Meta> &in, int64_t *i
 
 	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
+		_errno = mysql_stmt_errno(stmt);
+		_error = mysql_stmt_error(stmt);
 		mysql_stmt_close(stmt);
+		check_connection(_errno);
 		return 2;
 	}
 
-	std::vector<MYSQL_BIND> param_binds;
-	std::vector<ulong> param_lens;
+	add_statement(sql, stmt, st);
+	return 0;
+}
+
+bool DataSourceMysql::find_statement(const string &sql, Statement *&st)
+{
+	//statements do not survive a reconnect, the server side handles
+	//went away with the old session
+	unsigned long thread_id = mysql_thread_id(_dbase);
+	if (thread_id != _thread_id)
+	{
+		clear_stmt_cache();
+		_thread_id = thread_id;
+	}
+
+	auto it = _stmt_map.find(sql);
+	if (it == _stmt_map.end())
+	{
+		_stmt_misses++;
+		return false;
+	}
+
+	_stmt_list.splice(_stmt_list.begin(), _stmt_list, it->second);
+	_stmt_hits++;
+	st = &_stmt_list.front();
+	return true;
+}
+
+//caches a freshly prepared statement along with its bind arrays
+void DataSourceMysql::add_statement(const string &sql, MYSQL_STMT *stmt, Statement *&st)
+{
+	_stmt_list.push_front(Statement());
+	st = &_stmt_list.front();
+	st->sql = sql;
+	st->stmt = stmt;
+	st->stats = NULL;
+	st->result_meta = mysql_stmt_result_metadata(stmt);
+
+	if (st->result_meta)
+		bind_result(mysql_fetch_fields(st->result_meta), mysql_num_fields(st->result_meta), st->result);
+
+	st->param_binds.resize(mysql_stmt_param_count(stmt));
+	st->param_lens.resize(st->param_binds.size());
+
+	_stmt_map[sql] = _stmt_list.begin();
+}
+
+int DataSourceMysql::bind_params(Statement *st, const std::vector<Meta> *rows, size_t row_num)
+{
+	size_t param_num = st->param_binds.size();
+	if (param_num == 0)
+		return 0;
+
+	//each row fills an equal share of the placeholders and must have
+	//exactly that many values
+	size_t col_num = param_num / row_num;
 
-	if (!in.empty())
+	for (size_t r = 0; r < row_num; r++)
 	{
-		param_binds.resize(in.size());
-		param_lens.resize(in.size());
+		const std::vector<Meta> &in = rows[r];
+
+		if (in.size() != col_num)
+		{
+			char error[96];
+			snprintf(error, sizeof(error), "row %zu has %zu values for %zu parameters", r, in.size(), col_num);
+
+			_errno = CR_PARAMS_NOT_BOUND;
+			_error = error;
+			return 1;
+		}
 
-		for (size_t i = 0; i < in.size(); i++)
+		for (size_t i = 0; i < col_num; i++)
 		{
-			MYSQL_BIND &bind = param_binds[i];
+			MYSQL_BIND &bind = st->param_binds[r * col_num + i];
 			memset(&bind, 0, sizeof(bind));
-			ulong &len = param_lens[i];
-			Meta &meta = in[i];
+			ulong &len = st->param_lens[r * col_num + i];
+			const Meta &meta = in[i];
 
+			//parameter buffers are only read by the client library
 			if (meta.is_integer())
 			{
-				int32_t &val = meta.int_ref();
+				int32_t &val = const_cast<Meta &>(meta).int_ref();
 
 				bind.buffer_type = MYSQL_TYPE_LONG;
 				bind.buffer = (char *)&val;
 			}
 			else if (meta.is_bigint())
 			{
-				int64_t &val = meta.bigint_ref();
+				int64_t &val = const_cast<Meta &>(meta).bigint_ref();
 
 				bind.buffer_type = MYSQL_TYPE_LONGLONG;
 				bind.buffer = (char *)&val;
 			}
 			else if (meta.is_float())
 			{
-				float &val = meta.float_ref();
+				float &val = const_cast<Meta &>(meta).float_ref();
 
 				bind.buffer_type = MYSQL_TYPE_FLOAT;
 				bind.buffer = (char *)&val;
 			}
 			else if (meta.is_double())
 			{
-				double &val = meta.double_ref();
+				double &val = const_cast<Meta &>(meta).double_ref();
 
 				bind.buffer_type = MYSQL_TYPE_DOUBLE;
 				bind.buffer = (char *)&val;
 			}
 			else if (meta.is_string())
 			{
-				string &val = meta.string_ref();
-				len = val.size();
+				len = meta.string_size();
 
 				bind.buffer_type = MYSQL_TYPE_STRING;
-				bind.buffer = (char *)&val[0];
+				bind.buffer = (char *)meta.string_data();
 				bind.buffer_length = len;
 				bind.length = &len;
 			}
@@ -569,152 +735,1243 @@ int DataSourceMysql::insert(const string &sql, std::vector<Meta> &in, int64_t *i
 				bind.buffer = NULL;
 			}
 		}
-
-		if (mysql_stmt_bind_param(stmt, &param_binds[0]))
-		{
-			_errno = mysql_errno(_dbase);
-			_error = mysql_error(_dbase);
-			return 3;
-		}
 	}
 
-	if (mysql_stmt_execute(stmt))
+	if (mysql_stmt_bind_param(st->stmt, &st->param_binds[0]))
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 4;
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		return 1;
 	}
 
-	if (insert_id)
-		*insert_id = mysql_stmt_insert_id(stmt);
-
-	mysql_stmt_close(stmt);
 	return 0;
 }
 
-int DataSourceMysql::execute(const string &sql, std::vector<Meta> &in, int64_t *affected)
+int DataSourceMysql::bind_params(Statement *st, const Param *params, size_t param_num)
 {
-	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
-	if (!stmt)
-	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		return 1;
-	}
+	size_t bind_num = st->param_binds.size();
+	if (bind_num == 0)
+		return 0;
 
-	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+	if (param_num < bind_num)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
-		return 2;
+		_errno = CR_PARAMS_NOT_BOUND;
+		_error = "No data supplied for parameters in prepared statement";
+		return 1;
 	}
 
-	std::vector<MYSQL_BIND> param_binds;
-	std::vector<ulong> param_lens;
-
-	if (!in.empty())
+	for (size_t i = 0; i < bind_num; i++)
 	{
-		param_binds.resize(in.size());
-		param_lens.resize(in.size());
+		MYSQL_BIND &bind = st->param_binds[i];
+		memset(&bind, 0, sizeof(bind));
+		ulong &len = st->param_lens[i];
+		const Param &param = params[i];
 
-		for (size_t i = 0; i < in.size(); i++)
+		if (param.type == Param::TYPE_INT)
 		{
-			MYSQL_BIND &bind = param_binds[i];
-			memset(&bind, 0, sizeof(bind));
-			ulong &len = param_lens[i];
-			Meta &meta = in[i];
+			bind.buffer_type = MYSQL_TYPE_LONG;
+			bind.buffer = (char *)&param.number_i32;
+		}
+		else if (param.type == Param::TYPE_BIGINT)
+		{
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = (char *)&param.number_i64;
+		}
+		else if (param.type == Param::TYPE_FLOAT)
+		{
+			bind.buffer_type = MYSQL_TYPE_FLOAT;
+			bind.buffer = (char *)&param.number_f32;
+		}
+		else if (param.type == Param::TYPE_DOUBLE)
+		{
+			bind.buffer_type = MYSQL_TYPE_DOUBLE;
+			bind.buffer = (char *)&param.number_f64;
+		}
+		else if (param.type == Param::TYPE_STRING)
+		{
+			len = param.str.size;
 
-			if (meta.is_integer())
-			{
-				int32_t &val = meta.int_ref();
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = (char *)param.str.data;
+			bind.buffer_length = len;
+			bind.length = &len;
+		}
+		else
+		{
+			bind.buffer_type = MYSQL_TYPE_NULL;
+			bind.buffer = NULL;
+		}
+	}
 
-				bind.buffer_type = MYSQL_TYPE_LONG;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_bigint())
-			{
-				int64_t &val = meta.bigint_ref();
+	if (mysql_stmt_bind_param(st->stmt, &st->param_binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		return 1;
+	}
 
-				bind.buffer_type = MYSQL_TYPE_LONGLONG;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_float())
-			{
-				float &val = meta.float_ref();
+	return 0;
+}
 
-				bind.buffer_type = MYSQL_TYPE_FLOAT;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_double())
-			{
-				double &val = meta.double_ref();
+template <typename Bind>
+int DataSourceMysql::run_stmt(const string &sql, const Bind &bind, Statement *&st)
+{
+	if (!check_idle())
+		return 1;
 
-				bind.buffer_type = MYSQL_TYPE_DOUBLE;
-				bind.buffer = (char *)&val;
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				len = val.size();
+	stats_begin();
+	slow_begin();
 
-				bind.buffer_type = MYSQL_TYPE_STRING;
-				bind.buffer = (char *)&val[0];
-				bind.buffer_length = len;
-				bind.length = &len;
-			}
-			else
-			{
-				bind.buffer_type = MYSQL_TYPE_NULL;
-				bind.buffer = NULL;
-			}
+	for (int attempt = 0; ; attempt++)
+	{
+		int ret = prepare(sql, st);
+		if (ret)
+		{
+			stats_failed(sql);
+			slow_end(sql, NULL, _errno);
+			return ret;
 		}
 
-		if (mysql_stmt_bind_param(stmt, &param_binds[0]))
+		stats_prepared(st);
+
+		if (bind(st))
 		{
-			_errno = mysql_errno(_dbase);
-			_error = mysql_error(_dbase);
-			mysql_stmt_close(stmt);
+			finish(st);
 			return 3;
 		}
-	}
 
-	if (mysql_stmt_execute(stmt))
-	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		mysql_stmt_close(stmt);
+		stats_lap(PHASE_BIND);
+		ret = mysql_stmt_execute(st->stmt);
+		stats_lap(PHASE_EXECUTE);
+
+		if (!ret)
+			return 0;
+
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+
+		//the table changed under a cached statement, prepare it again once
+		if (_errno == ER_NEED_REPREPARE && attempt == 0)
+		{
+			evict(st);
+			continue;
+		}
+
+		finish(st);
+		check_connection(_errno);
 		return 4;
 	}
+}
 
-	if (affected)
-		*affected = mysql_stmt_affected_rows(stmt);
+int DataSourceMysql::execute_stmt(const string &sql, const std::vector<Meta> *rows, size_t row_num, Statement *&st)
+{
+	return run_stmt(sql, [this, rows, row_num](Statement *st) {
+		return bind_params(st, rows, row_num);
+	}, st);
+}
 
-	mysql_stmt_close(stmt);
-	return 0;
+int DataSourceMysql::execute_stmt(const string &sql, const Param *params, size_t param_num, Statement *&st)
+{
+	return run_stmt(sql, [this, params, param_num](Statement *st) {
+		return bind_params(st, params, param_num);
+	}, st);
 }
 
-int DataSourceMysql::execute(const string &sql)
+//reads the first row of an executed statement and finishes it
+int DataSourceMysql::fetch_single(Statement *st, std::vector<Meta> &row)
 {
-	if (mysql_query(_dbase, sql.c_str()))
+	if (!st->result_meta)
 	{
-		_errno = mysql_errno(_dbase);
-		_error = mysql_error(_dbase);
-		return 1;
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 5;
+	}
+
+	if (mysql_stmt_bind_result(st->stmt, &st->result.binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		return 6;
+	}
+
+	if (fetch_row(st->stmt, st->result, row))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		check_connection(_errno);
+		return 7;
 	}
 
+	finish(st);
 	return 0;
 }
 
-unsigned DataSourceMysql::last_errno() const
+void DataSourceMysql::finish(Statement *st)
 {
-	return _errno;
+	stats_end(st);
+	unsigned err = _slow_begin ? mysql_stmt_errno(st->stmt) : 0;
+	mysql_stmt_free_result(st->stmt);
+	slow_end(st->sql, st, err);
+
+	while (_stmt_list.size() > _stmt_capacity)
+		evict(&_stmt_list.back());
 }
 
-const char *DataSourceMysql::last_error() const
+void DataSourceMysql::evict(Statement *st)
 {
-	return _error.c_str();
+	auto it = _stmt_map.find(st->sql);
+
+	mysql_stmt_close(st->stmt);
+	if (st->result_meta)
+		mysql_free_result(st->result_meta);
+
+	_stmt_list.erase(it->second);
+	_stmt_map.erase(it);
+}
+
+void DataSourceMysql::clear_stmt_cache()
+{
+	while (!_stmt_list.empty())
+		evict(&_stmt_list.back());
+}
+
+void DataSourceMysql::check_connection(unsigned err)
+{
+	if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST)
+		clear_stmt_cache();
+}
+
+//locates the parenthesized tuple after VALUES in an insert statement,
+//tuple_end points just past its closing parenthesis
+bool DataSourceMysql::find_values_tuple(const string &sql, size_t &tuple_begin, size_t &tuple_end)
+{
+	char quote = 0;
+
+	for (size_t i = 0; i < sql.size(); i++)
+	{
+		char c = sql[i];
+
+		if (quote)
+		{
+			if (c == '\\')
+				i++;
+			else if (c == quote)
+				quote = 0;
+			continue;
+		}
+
+		if (c == '\'' || c == '"' || c == '`')
+		{
+			quote = c;
+			continue;
+		}
+
+		if (i > 0 && (isalnum((unsigned char)sql[i - 1]) || sql[i - 1] == '_'))
+			continue;
+
+		const char *keyword = "VALUES";
+		size_t pos = i;
+
+		while (*keyword && pos < sql.size() && toupper((unsigned char)sql[pos]) == *keyword)
+		{
+			keyword++;
+			pos++;
+		}
+
+		if (*keyword || (pos < sql.size() && (isalnum((unsigned char)sql[pos]) || sql[pos] == '_')))
+			continue;
+
+		while (pos < sql.size() && isspace((unsigned char)sql[pos]))
+			pos++;
+
+		if (pos >= sql.size() || sql[pos] != '(')
+			return false;
+
+		tuple_begin = pos;
+		int depth = 0;
+
+		for (; pos < sql.size(); pos++)
+		{
+			c = sql[pos];
+
+			if (quote)
+			{
+				if (c == '\\')
+					pos++;
+				else if (c == quote)
+					quote = 0;
+			}
+			else if (c == '\'' || c == '"' || c == '`')
+				quote = c;
+			else if (c == '(')
+				depth++;
+			else if (c == ')' && --depth == 0)
+			{
+				tuple_end = pos + 1;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	return false;
+}
+
+//read once per connection over the text protocol, a prepared statement
+//for it would only take a slot in the statement cache
+size_t DataSourceMysql::max_packet()
+{
+	if (_max_packet || !check_idle() || mysql_query(_dbase, "SELECT @@max_allowed_packet"))
+		return _max_packet ? _max_packet : 1024 * 1024;
+
+	MYSQL_RES *res = mysql_store_result(_dbase);
+	if (res)
+	{
+		MYSQL_ROW row = mysql_fetch_row(res);
+		if (row && row[0])
+			_max_packet = strtoull(row[0], NULL, 10);
+
+		mysql_free_result(res);
+	}
+
+	if (_max_packet == 0)
+		_max_packet = 1024 * 1024;
+
+	return _max_packet;
+}
+
+//rough size of a row in the execute packet
+size_t DataSourceMysql::param_bytes(const std::vector<Meta> &row)
+{
+	size_t bytes = 0;
+
+	for (size_t i = 0; i < row.size(); i++)
+	{
+		const Meta &meta = row[i];
+
+		if (meta.is_string())
+			bytes += meta.string_size() + 9;
+		else if (!meta.is_null())
+			bytes += 8;
+
+		bytes += 2;
+	}
+
+	return bytes;
+}
+
+void DataSourceMysql::bind_result(MYSQL_FIELD *fields, unsigned field_num, ResultBinds &result)
+{
+	result.binds.resize(field_num);
+	result.isnull_vec.resize(field_num);
+	result.length_vec.resize(field_num);
+
+	std::vector<size_t> offsets(field_num);
+	size_t buffer_size = 0;
+
+	for (unsigned i = 0; i < field_num; i++)
+	{
+		MYSQL_BIND &bind = result.binds[i];
+		memset(&bind, 0, sizeof(bind));
+
+		MYSQL_FIELD &field = fields[i];
+		ulong size = 0;
+
+		if (field.type == MYSQL_TYPE_TINY || field.type == MYSQL_TYPE_SHORT || field.type == MYSQL_TYPE_LONG)
+		{
+			bind.buffer_type = MYSQL_TYPE_LONG;
+			size = sizeof(int32_t);
+		}
+		else if (field.type == MYSQL_TYPE_LONGLONG)
+		{
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			size = sizeof(int64_t);
+		}
+		else if (field.type == MYSQL_TYPE_FLOAT)
+		{
+			bind.buffer_type = MYSQL_TYPE_FLOAT;
+			size = sizeof(float);
+		}
+		else if (field.type == MYSQL_TYPE_DOUBLE)
+		{
+			bind.buffer_type = MYSQL_TYPE_DOUBLE;
+			size = sizeof(double);
+		}
+		else if (field.type == MYSQL_TYPE_STRING || field.type == MYSQL_TYPE_VAR_STRING)
+		{
+			bind.buffer_type = field.type;
+			size = field.length < max_string_bind ? field.length : max_string_bind;
+			if (size == 0)
+				size = 1;
+
+			bind.buffer_length = size;
+			bind.length = &result.length_vec[i];
+		}
+		else
+		{
+			continue;
+		}
+
+		bind.is_null = &result.isnull_vec[i];
+		offsets[i] = buffer_size;
+		buffer_size += (size + 7) & ~(size_t)7;
+	}
+
+	result.buffer.resize(buffer_size);
+
+	for (unsigned i = 0; i < field_num; i++)
+	{
+		MYSQL_BIND &bind = result.binds[i];
+		if (bind.is_null)
+			bind.buffer = &result.buffer[offsets[i]];
+	}
+}
+
+int DataSourceMysql::fetch_row(MYSQL_STMT *stmt, ResultBinds &result, std::vector<Meta> &row)
+{
+	int ret = mysql_stmt_fetch(stmt);
+	if (ret && ret != MYSQL_DATA_TRUNCATED)
+		return ret;
+
+#ifdef STDEX_QUERY_STATS
+	//reading the clock for every row would cost about what decoding
+	//it does, so every 16th row is timed and counted 16 times
+	bool timed = _timing.stats && (_timing.rows & 15) == 0;
+	uint64_t decode_begin = timed ? QueryTiming::now_ns() : 0;
+#endif
+
+	unsigned field_num = result.binds.size();
+	row.resize(field_num);
+
+	for (unsigned i = 0; i < field_num; i++)
+	{
+		MYSQL_BIND &bind = result.binds[i];
+		Meta &meta = row[i];
+
+		//columns of types we do not bind have no is_null slot and read as NULL
+		if (!bind.is_null || result.isnull_vec[i])
+		{
+			meta = Meta();
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_LONG)
+		{
+			meta = *(int32_t *)bind.buffer;
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_LONGLONG)
+		{
+			meta = *(int64_t *)bind.buffer;
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_FLOAT)
+		{
+			meta = *(float *)bind.buffer;
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_DOUBLE)
+		{
+			meta = *(double *)bind.buffer;
+		}
+		else
+		{
+			ulong length = result.length_vec[i];
+
+			if (length <= bind.buffer_length)
+			{
+				meta.assign((const char *)bind.buffer, length);
+			}
+			else
+			{
+				string &val = meta.string_ref();
+				val.resize(length);
+
+				MYSQL_BIND col;
+				memset(&col, 0, sizeof(col));
+				col.buffer_type = bind.buffer_type;
+				col.buffer = (char *)&val[0];
+				col.buffer_length = length;
+				col.length = &length;
+
+				if (mysql_stmt_fetch_column(stmt, &col, i, 0))
+					return 1;
+			}
+		}
+	}
+
+
+#ifdef STDEX_QUERY_STATS
+	if (timed)
+		_timing.phases[PHASE_DECODE] += (QueryTiming::now_ns() - decode_begin) * 16;
+#endif
+
+	count_row(result.length_vec);
+	return 0;
+}
+
+//appends the next row straight from the bind buffers
+int DataSourceMysql::fetch_columns(MYSQL_STMT *stmt, ResultBinds &result, ColumnBatch &batch)
+{
+	int ret = mysql_stmt_fetch(stmt);
+	if (ret && ret != MYSQL_DATA_TRUNCATED)
+		return ret;
+
+	unsigned field_num = result.binds.size();
+
+	for (unsigned i = 0; i < field_num; i++)
+	{
+		MYSQL_BIND &bind = result.binds[i];
+
+		if (!bind.is_null || result.isnull_vec[i])
+		{
+			batch.append_null(i);
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_LONG)
+		{
+			batch.append_int(i, *(int32_t *)bind.buffer);
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_LONGLONG)
+		{
+			batch.append_bigint(i, *(int64_t *)bind.buffer);
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_FLOAT)
+		{
+			batch.append_float(i, *(float *)bind.buffer);
+		}
+		else if (bind.buffer_type == MYSQL_TYPE_DOUBLE)
+		{
+			batch.append_double(i, *(double *)bind.buffer);
+		}
+		else
+		{
+			ulong length = result.length_vec[i];
+			char *dst = batch.append_string(i, length);
+
+			if (length <= bind.buffer_length)
+			{
+				memcpy(dst, bind.buffer, length);
+			}
+			else
+			{
+				MYSQL_BIND col;
+				memset(&col, 0, sizeof(col));
+				col.buffer_type = bind.buffer_type;
+				col.buffer = dst;
+				col.buffer_length = length;
+				col.length = &length;
+
+				if (mysql_stmt_fetch_column(stmt, &col, i, 0))
+					return 1;
+			}
+		}
+	}
+
+	batch.end_row();
+	count_row(result.length_vec);
+	return 0;
+}
+
+//numbers already sit in their members, this clears the null ones and
+//copies the strings out of the bind buffer
+int DataSourceMysql::fetch_typed(MYSQL_STMT *stmt, TypedBinds &typed)
+{
+	unsigned field_num = typed.binds.size();
+
+	for (unsigned i = 0; i < field_num; i++)
+	{
+		MYSQL_BIND &bind = typed.binds[i];
+		string *val = typed.strings[i];
+
+		if (!val)
+		{
+			if (typed.isnull_vec[i])
+				memset(bind.buffer, 0, bind.buffer_length);
+		}
+		else if (typed.isnull_vec[i])
+		{
+			val->clear();
+		}
+		else
+		{
+			ulong length = typed.length_vec[i];
+
+			if (length <= bind.buffer_length)
+			{
+				val->assign((const char *)bind.buffer, length);
+			}
+			else
+			{
+				val->resize(length);
+
+				MYSQL_BIND col;
+				memset(&col, 0, sizeof(col));
+				col.buffer_type = bind.buffer_type;
+				col.buffer = &(*val)[0];
+				col.buffer_length = length;
+				col.length = &length;
+
+				if (mysql_stmt_fetch_column(stmt, &col, i, 0))
+					return 1;
+			}
+		}
+	}
+
+
+	count_row(typed.length_vec);
+	return 0;
+}
+
+void DataSourceMysql::bind_number(TypedBinds &typed, size_t col, enum_field_types type, void *buffer, ulong size)
+{
+	MYSQL_BIND &bind = typed.binds[col];
+	bind.buffer_type = type;
+	bind.buffer = buffer;
+	bind.buffer_length = size;
+	bind.is_null = &typed.isnull_vec[col];
+}
+
+//a connection waiting on a non blocking call cannot send anything else
+bool DataSourceMysql::check_idle()
+{
+#ifdef MYSQL_WAIT_READ
+	if (_async.step != ASYNC_IDLE)
+	{
+		_errno = CR_COMMANDS_OUT_OF_SYNC;
+		_error = "a non blocking call is pending";
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+#ifdef MYSQL_WAIT_READ
+void DataSourceMysql::set_nonblocking(bool enabled)
+{
+	_nonblocking = enabled;
+}
+
+int DataSourceMysql::query_async(const string &sql, const std::vector<Meta> &in, const QueryCallback &callback)
+{
+	int ret = start_async(sql, in);
+	if (ret)
+		return ret;
+
+	_async.is_query = true;
+	_async.on_query = callback;
+	async_prepare();
+	_async.starting = false;
+	return 0;
+}
+
+int DataSourceMysql::execute_async(const string &sql, const std::vector<Meta> &in, const ExecuteCallback &callback)
+{
+	int ret = start_async(sql, in);
+	if (ret)
+		return ret;
+
+	_async.is_query = false;
+	_async.on_execute = callback;
+	async_prepare();
+	_async.starting = false;
+	return 0;
+}
+
+int DataSourceMysql::socket() const
+{
+	return mysql_get_socket(_dbase);
+}
+
+int DataSourceMysql::wait_events() const
+{
+	return _async.wait;
+}
+
+unsigned DataSourceMysql::wait_timeout() const
+{
+	if (_async.step == ASYNC_DONE)
+		return 0;
+
+	return mysql_get_timeout_value_ms(_dbase);
+}
+
+bool DataSourceMysql::is_busy() const
+{
+	return _async.step != ASYNC_IDLE;
+}
+
+void DataSourceMysql::on_events(int events)
+{
+	int err = 0;
+	//whatever the library waits for next comes with a timeout of its own
+	_async.deadline_us = 0;
+
+	if (_async.step == ASYNC_PREPARE)
+	{
+		_async.wait = mysql_stmt_prepare_cont(&err, _async.stmt, events);
+		if (!_async.wait)
+			async_prepared(err);
+	}
+	else if (_async.step == ASYNC_EXECUTE)
+	{
+		_async.wait = mysql_stmt_execute_cont(&err, _async.st->stmt, events);
+		if (!_async.wait)
+			async_executed(err);
+	}
+	else if (_async.step == ASYNC_STORE)
+	{
+		_async.wait = mysql_stmt_store_result_cont(&err, _async.st->stmt, events);
+		if (!_async.wait)
+			async_stored(err);
+	}
+	else if (_async.step == ASYNC_DONE)
+	{
+		async_complete(_async.code);
+	}
+}
+
+int DataSourceMysql::poll(const std::vector<DataSourceMysql *> &conns, int timeout_ms)
+{
+	std::vector<pollfd> fds;
+	std::vector<DataSourceMysql *> pending;
+	uint64_t now = async_now_us();
+
+	for (size_t i = 0; i < conns.size(); i++)
+	{
+		int wait = conns[i]->wait_events();
+		if (!wait)
+			continue;
+
+		pollfd fd;
+		fd.fd = conns[i]->socket();
+		fd.events = 0;
+		fd.revents = 0;
+
+		if (wait & MYSQL_WAIT_READ)
+			fd.events |= POLLIN;
+		if (wait & MYSQL_WAIT_WRITE)
+			fd.events |= POLLOUT;
+		if (wait & MYSQL_WAIT_EXCEPT)
+			fd.events |= POLLPRI;
+
+		//the deadline outlives this poll, so a wait cut short by another
+		//connection or a signal does not start the timeout over
+		if (wait & MYSQL_WAIT_TIMEOUT)
+		{
+			AsyncCall &async = conns[i]->_async;
+			if (!async.deadline_us)
+				async.deadline_us = now + conns[i]->wait_timeout() * 1000ull;
+
+			int timeout = async.deadline_us > now ? (int)((async.deadline_us - now + 999) / 1000) : 0;
+			if (timeout_ms < 0 || timeout < timeout_ms)
+				timeout_ms = timeout;
+		}
+
+		fds.push_back(fd);
+		pending.push_back(conns[i]);
+	}
+
+	if (fds.empty())
+		return 0;
+
+	//an interrupted poll reports no events, the timeouts are still checked
+#ifdef _WIN32
+	int ret = WSAPoll(&fds[0], (ULONG)fds.size(), timeout_ms);
+	if (ret < 0 && WSAGetLastError() != WSAEINTR)
+		return -1;
+#else
+	int ret = ::poll(&fds[0], fds.size(), timeout_ms);
+	if (ret < 0 && errno != EINTR)
+		return -1;
+#endif
+
+	now = async_now_us();
+	int progressed = 0;
+
+	for (size_t i = 0; i < fds.size(); i++)
+	{
+		DataSourceMysql *conn = pending[i];
+		short revents = ret > 0 ? fds[i].revents : 0;
+		int events = 0;
+
+		if (revents & (POLLIN | POLLHUP | POLLERR))
+			events |= MYSQL_WAIT_READ;
+		if (revents & POLLOUT)
+			events |= MYSQL_WAIT_WRITE;
+		if (revents & POLLPRI)
+			events |= MYSQL_WAIT_EXCEPT;
+
+		//only a connection whose own timeout ran out gets the timeout
+		if (!events && (conn->wait_events() & MYSQL_WAIT_TIMEOUT) && now >= conn->_async.deadline_us)
+			events |= MYSQL_WAIT_TIMEOUT;
+
+		if (events)
+		{
+			conn->on_events(events);
+			progressed++;
+		}
+	}
+
+	return progressed;
+}
+
+uint64_t DataSourceMysql::async_now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int DataSourceMysql::start_async(const string &sql, const std::vector<Meta> &in)
+{
+	if (!_ready)
+	{
+		_errno = CR_SERVER_GONE_ERROR;
+		_error = "MySQL server has gone away";
+		return 1;
+	}
+
+	if (!_nonblocking)
+	{
+		_errno = CR_COMMANDS_OUT_OF_SYNC;
+		_error = "the connection was opened without set_nonblocking(true)";
+		return 1;
+	}
+
+	if (_async.step != ASYNC_IDLE)
+	{
+		_errno = CR_COMMANDS_OUT_OF_SYNC;
+		_error = "a non blocking call is already pending";
+		return 1;
+	}
+
+	//the parameters are read while the packet goes out, keep a copy
+	_async.sql = sql;
+	_async.in = in;
+	_async.starting = true;
+	_async.retried = false;
+	_async.affected = 0;
+	_async.rows.clear();
+	slow_begin();
+	return 0;
+}
+
+void DataSourceMysql::async_prepare()
+{
+	if (find_statement(_async.sql, _async.st))
+	{
+		async_execute();
+		return;
+	}
+
+	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
+	if (!stmt)
+	{
+		_errno = mysql_errno(_dbase);
+		_error = mysql_error(_dbase);
+		async_complete(1);
+		return;
+	}
+
+	int err = 0;
+	_async.step = ASYNC_PREPARE;
+	_async.stmt = stmt;
+	_async.wait = mysql_stmt_prepare_start(&err, stmt, _async.sql.c_str(), _async.sql.size());
+
+	if (!_async.wait)
+		async_prepared(err);
+}
+
+void DataSourceMysql::async_prepared(int err)
+{
+	MYSQL_STMT *stmt = _async.stmt;
+	_async.stmt = NULL;
+
+	if (err)
+	{
+		_errno = mysql_stmt_errno(stmt);
+		_error = mysql_stmt_error(stmt);
+		mysql_stmt_close(stmt);
+		check_connection(_errno);
+		async_complete(2);
+		return;
+	}
+
+	add_statement(_async.sql, stmt, _async.st);
+	async_execute();
+}
+
+void DataSourceMysql::async_execute()
+{
+	if (bind_params(_async.st, &_async.in, 1))
+	{
+		finish(_async.st);
+		async_complete(3);
+		return;
+	}
+
+	int err = 0;
+	_async.step = ASYNC_EXECUTE;
+	_async.wait = mysql_stmt_execute_start(&err, _async.st->stmt);
+
+	if (!_async.wait)
+		async_executed(err);
+}
+
+void DataSourceMysql::async_executed(int err)
+{
+	Statement *st = _async.st;
+
+	if (err)
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+
+		//the table changed under a cached statement, prepare it again once
+		if (_errno == ER_NEED_REPREPARE && !_async.retried)
+		{
+			_async.retried = true;
+			evict(st);
+			async_prepare();
+			return;
+		}
+
+		finish(st);
+		check_connection(_errno);
+		async_complete(4);
+		return;
+	}
+
+	if (!_async.is_query)
+	{
+		_async.affected = mysql_stmt_affected_rows(st->stmt);
+		finish(st);
+		async_complete(0);
+		return;
+	}
+
+	if (!st->result_meta)
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		async_complete(5);
+		return;
+	}
+
+	if (mysql_stmt_bind_result(st->stmt, &st->result.binds[0]))
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		async_complete(6);
+		return;
+	}
+
+	//the whole result is read off the socket without blocking, the
+	//rows are decoded from the client side buffer afterwards
+	_async.step = ASYNC_STORE;
+	_async.wait = mysql_stmt_store_result_start(&err, st->stmt);
+
+	if (!_async.wait)
+		async_stored(err);
+}
+
+void DataSourceMysql::async_stored(int err)
+{
+	Statement *st = _async.st;
+
+	if (err)
+	{
+		_errno = mysql_stmt_errno(st->stmt);
+		_error = mysql_stmt_error(st->stmt);
+		finish(st);
+		check_connection(_errno);
+		async_complete(7);
+		return;
+	}
+
+	while (true)
+	{
+		int ret = fetch_row(st->stmt, st->result, _row);
+		if (ret == MYSQL_NO_DATA)
+			break;
+
+		if (ret)
+		{
+			_errno = mysql_stmt_errno(st->stmt);
+			_error = mysql_stmt_error(st->stmt);
+			finish(st);
+			async_complete(7);
+			return;
+		}
+
+		_async.rows.push_back(std::move(_row));
+	}
+
+	finish(st);
+	async_complete(0);
+}
+
+//the connection is idle again before the callback runs, so it can start
+//the next call right away. a call that ended before query_async or
+//execute_async returned is held for the next on_events(), so the
+//callback never runs inside them
+void DataSourceMysql::async_complete(int code)
+{
+	//a call that failed before it had a statement is still timed
+	slow_end(_async.sql, NULL, code ? _errno : 0);
+
+	if (_async.starting)
+	{
+		_async.step = ASYNC_DONE;
+		_async.code = code;
+		_async.wait = MYSQL_WAIT_TIMEOUT;
+		_async.deadline_us = 0;
+		_async.st = NULL;
+		return;
+	}
+
+	_async.step = ASYNC_IDLE;
+	_async.wait = 0;
+	_async.deadline_us = 0;
+	_async.st = NULL;
+
+	if (_async.is_query)
+	{
+		QueryCallback callback;
+		callback.swap(_async.on_query);
+
+		std::vector<std::vector<Meta>> rows;
+		rows.swap(_async.rows);
+
+		if (callback)
+			callback(code, rows);
+	}
+	else
+	{
+		ExecuteCallback callback;
+		callback.swap(_async.on_execute);
+
+		if (callback)
+			callback(code, _async.affected);
+	}
+}
+#endif
+
+unsigned DataSourceMysql::last_errno() const
+{
+	return _errno;
+}
+
+const char *DataSourceMysql::last_error() const
+{
+	return _error.c_str();
+}
+
+unsigned long DataSourceMysql::thread_id() const
+{
+	return _thread_id;
+}
+
+void DataSourceMysql::set_query_stats(QueryStatsRegistry *stats)
+{
+	_stats = stats;
+
+	//cached statements point into the previous registry
+	for (auto it = _stmt_list.begin(); it != _stmt_list.end(); ++it)
+		it->stats = NULL;
+}
+
+void DataSourceMysql::stats_begin()
+{
+#ifdef STDEX_QUERY_STATS
+	_timing.stats = NULL;
+	if (_stats)
+		_timing.start();
+#endif
+}
+
+//statements remember their entry, so only the first call of a statement
+//pays for the fingerprint
+void DataSourceMysql::stats_prepared(Statement *st)
+{
+#ifdef STDEX_QUERY_STATS
+	if (!_stats)
+		return;
+
+	if (!st->stats)
+		st->stats = _stats->find(st->sql);
+
+	_timing.stats = st->stats;
+	_timing.lap(PHASE_PREPARE);
+#endif
+}
+
+void DataSourceMysql::stats_failed(const string &sql)
+{
+#ifdef STDEX_QUERY_STATS
+	if (_stats)
+		_stats->find(sql)->record_error(_errno);
+#endif
+}
+
+void DataSourceMysql::stats_lap(QueryPhase phase)
+{
+#ifdef STDEX_QUERY_STATS
+	if (_timing.stats)
+		_timing.lap(phase);
+#endif
+}
+
+void DataSourceMysql::count_row(const std::vector<ulong> &lengths)
+{
+	_slow_rows++;
+
+#ifdef STDEX_QUERY_STATS
+	if (!_timing.stats)
+		return;
+
+	_timing.rows++;
+	for (size_t i = 0; i < lengths.size(); i++)
+		_timing.bytes += lengths[i];
+#endif
+}
+
+void DataSourceMysql::stats_end(Statement *st)
+{
+#ifdef STDEX_QUERY_STATS
+	if (_timing.stats)
+		_timing.end(mysql_stmt_errno(st->stmt));
+#endif
+}
+
+void DataSourceMysql::set_slow_query_log(SlowQueryLog *log)
+{
+	_slow_log = log;
+}
+
+void DataSourceMysql::slow_begin()
+{
+	if (!_slow_log)
+		return;
+
+	_slow_begin = SlowQueryLog::now_us();
+	_slow_rows = 0;
+}
+
+//st is NULL when the statement never got prepared, such a call is
+//logged without its parameter types
+void DataSourceMysql::slow_end(const string &sql, Statement *st, unsigned err)
+{
+	if (!_slow_begin)
+		return;
+
+	uint64_t duration = SlowQueryLog::now_us() - _slow_begin;
+	_slow_begin = 0;
+
+	if (!_slow_log || !_slow_log->should_log(duration))
+		return;
+
+	SlowQueryEntry entry;
+	entry.source = "mysql";
+	entry.sql = QueryStatsRegistry::fingerprint(sql);
+	entry.duration_us = duration;
+	entry.rows = _slow_rows;
+	entry.code = err;
+
+	if (st)
+	{
+		size_t param_num = st->param_binds.size();
+
+		for (size_t i = 0; i < param_num && i < SlowQueryLog::MAX_PARAM_TYPES; i++)
+		{
+			enum_field_types type = st->param_binds[i].buffer_type;
+			Param::Type param_type = type == MYSQL_TYPE_LONG ? Param::TYPE_INT
+				: type == MYSQL_TYPE_LONGLONG ? Param::TYPE_BIGINT
+				: type == MYSQL_TYPE_FLOAT ? Param::TYPE_FLOAT
+				: type == MYSQL_TYPE_DOUBLE ? Param::TYPE_DOUBLE
+				: type == MYSQL_TYPE_NULL ? Param::TYPE_NULL : Param::TYPE_STRING;
+
+			if (i)
+				entry.param_types += ',';
+			entry.param_types += SlowQueryLog::type_name(param_type);
+		}
+
+		if (param_num > SlowQueryLog::MAX_PARAM_TYPES)
+			entry.param_types += ",...";
+
+		//EXPLAIN is another blocking round trip, which a non blocking
+		//call must not make, so those are logged without a plan
+		bool blocking = true;
+#ifdef MYSQL_WAIT_READ
+		blocking = _async.step == ASYNC_IDLE;
+#endif
+
+		if (blocking && _slow_log->want_plan(entry.sql))
+			explain(st, entry.plan);
+	}
+
+	_slow_log->write(entry);
+}
+
+//runs EXPLAIN with the parameters still bound to the statement, one line
+//per plan row. the result of the statement itself is already released.
+//the plan rows are not rows of the statement, so neither the query stats
+//nor the slow log row count see them
+void DataSourceMysql::explain(Statement *st, string &plan)
+{
+	MYSQL_STMT *stmt = mysql_stmt_init(_dbase);
+	if (!stmt)
+		return;
+
+	uint64_t slow_rows = _slow_rows;
+#ifdef STDEX_QUERY_STATS
+	QueryStats *stats = _timing.stats;
+	_timing.stats = NULL;
+#endif
+
+	string sql = "EXPLAIN " + st->sql;
+	MYSQL_RES *result_meta = NULL;
+
+	if (!mysql_stmt_prepare(stmt, sql.c_str(), sql.size())
+		&& mysql_stmt_param_count(stmt) == st->param_binds.size()
+		&& (st->param_binds.empty() || !mysql_stmt_bind_param(stmt, &st->param_binds[0]))
+		&& !mysql_stmt_execute(stmt)
+		&& (result_meta = mysql_stmt_result_metadata(stmt)) != NULL)
+	{
+		MYSQL_FIELD *fields = mysql_fetch_fields(result_meta);
+		unsigned field_num = mysql_num_fields(result_meta);
+
+		ResultBinds result;
+		bind_result(fields, field_num, result);
+
+		if (!mysql_stmt_bind_result(stmt, &result.binds[0]))
+		{
+			std::vector<Meta> row;
+
+			while (fetch_row(stmt, result, row) == 0)
+			{
+				for (unsigned i = 0; i < field_num; i++)
+				{
+					if (i)
+						plan += ' ';
+					plan += fields[i].name;
+					plan += '=';
+					plan += row[i].is_null() ? string("NULL") : row[i].to_string();
+				}
+
+				plan += '\n';
+			}
+		}
+
+		mysql_free_result(result_meta);
+	}
+
+	mysql_stmt_close(stmt);
+
+	_slow_rows = slow_rows;
+#ifdef STDEX_QUERY_STATS
+	_timing.stats = stats;
+#endif
 }
 
 int DataSourceMysql::get_magic() const
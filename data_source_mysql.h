@@ -21,7 +21,9 @@
 #define STDEX_DATA_SOURCE_MYSQL_H_
 #ifdef STDEX_HAS_MYSQL
 
-#include "data_meta.h"
+#include "data_source.h"
+#include "data_query_stats.h"
+#include "data_slow_query_log.h"
 #include <mysql.h>
 namespace stdex {
 
@@ -35,26 +37,331 @@ public:
 	int open(const string &host, int port, const string &user, const string &passwd, const string &dbase);
 	void close();
 
+	//round trip to the server, reconnecting when the session went away
+	int ping();
+
 	int query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row);
 	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows);
+	int query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows);
+	int query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback);
+	int query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch);
+
+	//decodes every row straight into native types, skipping Meta. the
+	//result is bound to the row members so the client library converts
+	//the values, the column count has to match the tuple
+	template <typename... Ts>
+	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::tuple<Ts...>> &rows);
+	//same for a struct described by RowMapping<T>
+	template <typename T>
+	int query_as(const string &sql, std::vector<Meta> &in, std::vector<T> &rows);
 	int insert(const string &sql, std::vector<Meta> &in, int64_t *insert_id=NULL);
 	int execute(const string &sql, std::vector<Meta> &in, int64_t *affected=NULL);
 	int execute(const string &sql);
 
+	//variadic forms binding their arguments in place, e.g.
+	//execute(sql, 42, name, 3.5). nothing is copied or allocated for
+	//the parameters
+	template <typename... Ts>
+	int execute(const string &sql, const Ts &... args);
+	template <typename... Ts>
+	int query(const string &sql, std::vector<Meta> &row, const Ts &... args);
+
+	//runs an insert for every row, packing up to batch_size rows into
+	//one multi-row VALUES statement bounded by max_allowed_packet.
+	//batch_size 0 packs as many rows as fit
+	int insert_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, size_t batch_size, std::vector<BatchResult> *results=NULL);
+
 	unsigned last_errno() const;
 	const char *last_error() const;
+	//server side id of the session, what KILL QUERY takes
+	unsigned long thread_id() const;
+
+	//prepared statements are kept per connection, keyed by sql text.
+	//a capacity of 0 closes every statement right after use
+	void set_stmt_cache_capacity(size_t capacity);
+	size_t stmt_cache_capacity() const;
+	uint64_t stmt_cache_hits() const;
+	uint64_t stmt_cache_misses() const;
 
 	int get_magic() const;
 	void set_magic(int v);
 
+	//records phase times, rows and errors of every blocking call into
+	//stats, NULL turns it off. does nothing unless built with
+	//STDEX_QUERY_STATS
+	void set_query_stats(QueryStatsRegistry *stats);
+	//blocking calls over the log's threshold are written to it, NULL
+	//turns it off
+	void set_slow_query_log(SlowQueryLog *log);
+
+//the non blocking calls only exist in the mariadb client library
+#ifdef MYSQL_WAIT_READ
+	typedef std::function<void(int code, std::vector<std::vector<Meta>> &rows)> QueryCallback;
+	typedef std::function<void(int code, int64_t affected)> ExecuteCallback;
+
+	//non blocking mode is off unless asked for before open(). the async
+	//calls below fail on a connection opened without it
+	void set_nonblocking(bool enabled);
+
+	//start a statement without waiting for the server and return 0, or
+	//an error code when it could not be started. the callback runs from
+	//on_events() once the statement completed, with the same codes the
+	//blocking calls return. that holds for a call that completed or
+	//failed at once too: it waits for MYSQL_WAIT_TIMEOUT with a
+	//wait_timeout() of 0. one call at a time per connection, and the
+	//blocking calls fail with CR_COMMANDS_OUT_OF_SYNC while it is pending
+	int query_async(const string &sql, const std::vector<Meta> &in, const QueryCallback &callback);
+	int execute_async(const string &sql, const std::vector<Meta> &in, const ExecuteCallback &callback);
+
+	//for an event loop: watch socket() for wait_events(), a mask of
+	//MYSQL_WAIT_* that is 0 when no call is pending, and hand whatever
+	//happened to on_events(). MYSQL_WAIT_TIMEOUT asks for a call after
+	//wait_timeout() milliseconds
+	int socket() const;
+	int wait_events() const;
+	unsigned wait_timeout() const;
+	void on_events(int events);
+	bool is_busy() const;
+
+	//drives the pending calls of many connections from one thread with
+	//poll(), returns how many of them made progress. the timeout of a
+	//wait runs across calls, so a connection gets MYSQL_WAIT_TIMEOUT once
+	//it passed even when poll() keeps coming back early for another
+	//connection or a signal
+	static int poll(const std::vector<DataSourceMysql *> &conns, int timeout_ms);
+#endif
+
 private:
+	//result bind buffers of a statement, sized once from the field
+	//metadata and reused for every fetched row
+	struct ResultBinds
+	{
+		std::vector<MYSQL_BIND> binds;
+		std::vector<my_bool> isnull_vec;
+		std::vector<ulong> length_vec;
+		std::vector<char> buffer;
+	};
+
+	struct Statement
+	{
+		string sql;
+		MYSQL_STMT *stmt;
+		MYSQL_RES *result_meta;
+		std::vector<MYSQL_BIND> param_binds;
+		std::vector<ulong> param_lens;
+		ResultBinds result;
+		QueryStats *stats;
+	};
+
+	//result binds pointing at the members of a typed row, strings go
+	//through buffer and are assigned to their member after each fetch
+	struct TypedBinds
+	{
+		std::vector<MYSQL_BIND> binds;
+		std::vector<my_bool> isnull_vec;
+		std::vector<ulong> length_vec;
+		std::vector<string *> strings;
+		std::vector<char> buffer;
+	};
+
+	typedef std::list<Statement> StatementList;
+
+	bool check_idle();
+	int prepare(const string &sql, Statement *&st);
+	bool find_statement(const string &sql, Statement *&st);
+	void add_statement(const string &sql, MYSQL_STMT *stmt, Statement *&st);
+	int bind_params(Statement *st, const std::vector<Meta> *rows, size_t row_num);
+	int bind_params(Statement *st, const Param *params, size_t param_num);
+	template <typename Bind>
+	int run_stmt(const string &sql, const Bind &bind, Statement *&st);
+	int execute_stmt(const string &sql, const std::vector<Meta> *rows, size_t row_num, Statement *&st);
+	int execute_stmt(const string &sql, const Param *params, size_t param_num, Statement *&st);
+	int execute_params(const string &sql, const Param *params, size_t param_num, int64_t *affected);
+	int query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row);
+	int fetch_single(Statement *st, std::vector<Meta> &row);
+	void finish(Statement *st);
+	void evict(Statement *st);
+	void clear_stmt_cache();
+	void check_connection(unsigned err);
+
+	void stats_begin();
+	void stats_prepared(Statement *st);
+	void stats_failed(const string &sql);
+	void stats_lap(QueryPhase phase);
+	void count_row(const std::vector<ulong> &lengths);
+	void stats_end(Statement *st);
+	void slow_begin();
+	void slow_end(const string &sql, Statement *st, unsigned err);
+	void explain(Statement *st, string &plan);
+
+	static bool find_values_tuple(const string &sql, size_t &tuple_begin, size_t &tuple_end);
+	size_t max_packet();
+	static size_t param_bytes(const std::vector<Meta> &row);
+
+	void bind_result(MYSQL_FIELD *fields, unsigned field_num, ResultBinds &result);
+	int fetch_row(MYSQL_STMT *stmt, ResultBinds &result, std::vector<Meta> &row);
+	int fetch_columns(MYSQL_STMT *stmt, ResultBinds &result, ColumnBatch &batch);
+
+	int query_typed(const string &sql, std::vector<Meta> &in, TypedBinds &typed, const std::function<void()> &on_row);
+	int fetch_typed(MYSQL_STMT *stmt, TypedBinds &typed);
+	static void bind_number(TypedBinds &typed, size_t col, enum_field_types type, void *buffer, ulong size);
+
+	template <typename Tuple, size_t... I>
+	static void bind_tuple(TypedBinds &typed, Tuple &fields, IndexSequence<I...>)
+	{
+		typed.binds.assign(sizeof...(I), MYSQL_BIND());
+		typed.isnull_vec.assign(sizeof...(I), 0);
+		typed.length_vec.assign(sizeof...(I), 0);
+		typed.strings.assign(sizeof...(I), NULL);
+
+		int expand[] = {0, (bind_typed(typed, I, std::get<I>(fields)), 0)...};
+		(void)expand;
+	}
+
+	static void bind_typed(TypedBinds &typed, size_t col, int32_t &val)
+	{
+		bind_number(typed, col, MYSQL_TYPE_LONG, &val, sizeof(val));
+	}
+
+	static void bind_typed(TypedBinds &typed, size_t col, int64_t &val)
+	{
+		bind_number(typed, col, MYSQL_TYPE_LONGLONG, &val, sizeof(val));
+	}
+
+	static void bind_typed(TypedBinds &typed, size_t col, float &val)
+	{
+		bind_number(typed, col, MYSQL_TYPE_FLOAT, &val, sizeof(val));
+	}
+
+	static void bind_typed(TypedBinds &typed, size_t col, double &val)
+	{
+		bind_number(typed, col, MYSQL_TYPE_DOUBLE, &val, sizeof(val));
+	}
+
+	static void bind_typed(TypedBinds &typed, size_t col, string &val)
+	{
+		typed.strings[col] = &val;
+	}
+
 	MYSQL *_dbase;
 	bool _ready;
 	unsigned _errno;
 	string _error;
 	int _magic;
+
+	//most recently used statement first
+	StatementList _stmt_list;
+	std::unordered_map<string, StatementList::iterator> _stmt_map;
+	size_t _stmt_capacity;
+	uint64_t _stmt_hits;
+	uint64_t _stmt_misses;
+	unsigned long _thread_id;
+
+	QueryStatsRegistry *_stats;
+	QueryTiming _timing;
+
+	SlowQueryLog *_slow_log;
+	uint64_t _slow_begin;
+	uint64_t _slow_rows;
+	size_t _max_packet;
+
+	//scratch reused by every call so a warm statement allocates nothing.
+	//the connection runs one statement at a time, so they are never
+	//shared by two calls
+	std::vector<Meta> _row;
+	TypedBinds _typed;
+
+#ifdef MYSQL_WAIT_READ
+	enum AsyncStep
+	{
+		ASYNC_IDLE,
+		ASYNC_PREPARE,
+		ASYNC_EXECUTE,
+		ASYNC_STORE,
+		//finished before the call that started it returned, the
+		//callback is due on the next on_events()
+		ASYNC_DONE,
+	};
+
+	//state of the pending non blocking call
+	struct AsyncCall
+	{
+		AsyncStep step;
+		int wait;
+		//when the library's timeout for the current wait runs out, 0
+		//until poll() first sees the wait
+		uint64_t deadline_us;
+		//set while query_async/execute_async runs
+		bool starting;
+		int code;
+		bool is_query;
+		bool retried;
+		int64_t affected;
+		string sql;
+		std::vector<Meta> in;
+		MYSQL_STMT *stmt;
+		Statement *st;
+		QueryCallback on_query;
+		ExecuteCallback on_execute;
+		std::vector<std::vector<Meta>> rows;
+	};
+
+	int start_async(const string &sql, const std::vector<Meta> &in);
+	void async_prepare();
+	void async_prepared(int err);
+	void async_execute();
+	void async_executed(int err);
+	void async_stored(int err);
+	void async_complete(int code);
+	static uint64_t async_now_us();
+
+	AsyncCall _async;
+	bool _nonblocking;
+#endif
 };
 
+//the extra trailing slot keeps the array valid for an empty pack
+template <typename... Ts>
+int DataSourceMysql::execute(const string &sql, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return execute_params(sql, params, sizeof...(Ts), NULL);
+}
+
+template <typename... Ts>
+int DataSourceMysql::query(const string &sql, std::vector<Meta> &row, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return query_params(sql, params, sizeof...(Ts), row);
+}
+
+template <typename... Ts>
+int DataSourceMysql::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::tuple<Ts...>> &rows)
+{
+	std::tuple<Ts...> row;
+	TypedBinds &typed = _typed;
+	bind_tuple(typed, row, typename MakeIndexSequence<sizeof...(Ts)>::type());
+
+	return query_typed(sql, in, typed, [&rows, &row]() {
+		rows.push_back(row);
+	});
+}
+
+template <typename T>
+int DataSourceMysql::query_as(const string &sql, std::vector<Meta> &in, std::vector<T> &rows)
+{
+	typedef decltype(RowMapping<T>::fields(std::declval<T &>())) Fields;
+
+	T row = T();
+	Fields fields = RowMapping<T>::fields(row);
+	TypedBinds &typed = _typed;
+	bind_tuple(typed, fields, typename MakeIndexSequence<std::tuple_size<Fields>::value>::type());
+
+	return query_typed(sql, in, typed, [&rows, &row]() {
+		rows.push_back(row);
+	});
+}
+
 }
 #endif
 #endif //STDEX_DATA_SOURCE_MYSQL_H_
\ No newline at end of file
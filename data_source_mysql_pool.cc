@@ -0,0 +1,509 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql_pool.h"
+#include <chrono>
+namespace stdex {
+
+MysqlPoolOptions::MysqlPoolOptions()
+{
+	port = 3306;
+	min_size = 1;
+	max_size = 8;
+	idle_timeout_ms = 60000;
+	ping_after_ms = 5000;
+	reap_interval_ms = 1000;
+}
+
+MysqlPool::Lease::Lease()
+{
+	_pool = NULL;
+	_slot = NULL;
+}
+
+MysqlPool::Lease::Lease(MysqlPool *pool, Slot *slot)
+{
+	_pool = pool;
+	_slot = slot;
+}
+
+MysqlPool::Lease::Lease(Lease &&other)
+{
+	_pool = other._pool;
+	_slot = other._slot;
+	other._pool = NULL;
+	other._slot = NULL;
+}
+
+MysqlPool::Lease &MysqlPool::Lease::operator=(Lease &&other)
+{
+	if (this != &other)
+	{
+		release();
+		_pool = other._pool;
+		_slot = other._slot;
+		other._pool = NULL;
+		other._slot = NULL;
+	}
+
+	return *this;
+}
+
+MysqlPool::Lease::~Lease()
+{
+	release();
+}
+
+MysqlPool::Lease::operator bool() const
+{
+	return _slot != NULL;
+}
+
+DataSourceMysql *MysqlPool::Lease::operator->() const
+{
+	return _slot->conn;
+}
+
+DataSourceMysql &MysqlPool::Lease::operator*() const
+{
+	return *_slot->conn;
+}
+
+void MysqlPool::Lease::release()
+{
+	if (_slot)
+	{
+		_pool->release(_slot);
+		_pool = NULL;
+		_slot = NULL;
+	}
+}
+
+MysqlPool::MysqlPool()
+{
+	_size = 0;
+	_in_use = 0;
+	_waiters = 0;
+	_running = false;
+	_errno = 0;
+	_checkouts = 0;
+	_waits = 0;
+	_timeouts = 0;
+	_wait_us_total = 0;
+	_wait_us_max = 0;
+	_pings = 0;
+	_ping_failures = 0;
+	_opened = 0;
+	_reaped = 0;
+}
+
+MysqlPool::~MysqlPool()
+{
+	close();
+}
+
+int MysqlPool::open(const MysqlPoolOptions &options)
+{
+	if (_slots)
+		return 1;
+
+	if (options.max_size == 0 || options.min_size > options.max_size)
+		return 2;
+
+	_options = options;
+	_slots.reset(new Slot[options.max_size]);
+
+	for (size_t i=0; i<options.max_size; i++)
+	{
+		_slots[i].state = SLOT_EMPTY;
+		_slots[i].idle_since = 0;
+		_slots[i].conn = NULL;
+	}
+
+	for (size_t i=0; i<options.min_size; i++)
+	{
+		if (open_slot(&_slots[i]))
+		{
+			close();
+			return 3;
+		}
+
+		_slots[i].idle_since = now_ms();
+		_slots[i].state = SLOT_FREE;
+		_size++;
+	}
+
+	_running = true;
+	_reaper = std::thread(&MysqlPool::reaper_loop, this);
+	return 0;
+}
+
+void MysqlPool::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(_reaper_mutex);
+		_running = false;
+	}
+
+	_reaper_cond.notify_all();
+	if (_reaper.joinable())
+		_reaper.join();
+
+	if (!_slots)
+		return;
+
+	for (size_t i=0; i<_options.max_size; i++)
+	{
+		delete _slots[i].conn;
+		_slots[i].conn = NULL;
+		_slots[i].state = SLOT_EMPTY;
+	}
+
+	_slots.reset();
+	_size = 0;
+	_in_use = 0;
+}
+
+MysqlPool::Lease MysqlPool::acquire()
+{
+	return checkout(false, 0);
+}
+
+MysqlPool::Lease MysqlPool::acquire(uint32_t timeout_ms)
+{
+	return checkout(true, timeout_ms);
+}
+
+MysqlPool::Lease MysqlPool::checkout(bool bounded, uint32_t timeout_ms)
+{
+	if (!_slots)
+		return Lease();
+
+	auto start = std::chrono::steady_clock::now();
+	auto deadline = start + std::chrono::milliseconds(timeout_ms);
+	std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+	bool waited = false;
+
+	for (;;)
+	{
+		//fast path, a free slot is taken with a single compare and swap
+		Slot *slot = try_claim();
+		if (!slot)
+			slot = try_reserve();
+
+		if (slot)
+		{
+			if (lock.owns_lock())
+			{
+				_waiters--;
+				lock.unlock();
+			}
+
+			if (!slot->conn)
+			{
+				if (open_slot(slot))
+				{
+					slot->state = SLOT_EMPTY;
+					_size--;
+					notify();
+					return Lease();
+				}
+			}
+			else if (!check_idle(slot))
+			{
+				drop(slot);
+				continue;
+			}
+
+			record_wait(start);
+			_checkouts++;
+			_in_use++;
+			return Lease(this, slot);
+		}
+
+		//slow path, register as a waiter and scan once more so a release
+		//racing with the registration is not missed
+		if (!lock.owns_lock())
+		{
+			lock.lock();
+			_waiters++;
+			if (!waited)
+			{
+				waited = true;
+				_waits++;
+			}
+			continue;
+		}
+
+		if (bounded)
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				_waiters--;
+				_timeouts++;
+				record_wait(start);
+				return Lease();
+			}
+
+			_cond.wait_until(lock, deadline);
+		}
+		else
+		{
+			_cond.wait(lock);
+		}
+	}
+}
+
+//every checkout is timed, the ones served at once included, so the
+//average is over all checkouts and not only the contended ones
+void MysqlPool::record_wait(std::chrono::steady_clock::time_point start)
+{
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	_wait_us_total += us;
+
+	uint64_t max = _wait_us_max;
+	while (us > max && !_wait_us_max.compare_exchange_weak(max, us))
+		;
+}
+
+MysqlPoolStats MysqlPool::stats() const
+{
+	MysqlPoolStats stats;
+	stats.size = _size;
+	stats.in_use = _in_use;
+	stats.checkouts = _checkouts;
+	stats.waits = _waits;
+	stats.timeouts = _timeouts;
+	stats.wait_us_total = _wait_us_total;
+	stats.wait_us_max = _wait_us_max;
+	stats.pings = _pings;
+	stats.ping_failures = _ping_failures;
+	stats.opened = _opened;
+	stats.reaped = _reaped;
+	return stats;
+}
+
+unsigned MysqlPool::last_errno() const
+{
+	std::lock_guard<std::mutex> lock(_error_mutex);
+	return _errno;
+}
+
+string MysqlPool::last_error() const
+{
+	std::lock_guard<std::mutex> lock(_error_mutex);
+	return _error;
+}
+
+//lower slots are preferred so the upper ones go idle and get reaped
+MysqlPool::Slot *MysqlPool::try_claim()
+{
+	for (size_t i=0; i<_options.max_size; i++)
+	{
+		Slot *slot = &_slots[i];
+		if (slot->state.load(std::memory_order_relaxed) != SLOT_FREE)
+			continue;
+
+		int expected = SLOT_FREE;
+		if (slot->state.compare_exchange_strong(expected, SLOT_BUSY))
+			return slot;
+	}
+
+	return NULL;
+}
+
+//reserves an empty slot while the pool is below max_size. the slot
+//comes back busy and without a connection
+MysqlPool::Slot *MysqlPool::try_reserve()
+{
+	size_t size = _size;
+	do
+	{
+		if (size >= _options.max_size)
+			return NULL;
+	}
+	while (!_size.compare_exchange_weak(size, size + 1));
+
+	//slots turn empty before _size drops, so one is always left for us
+	for (size_t i=0; i<_options.max_size; i++)
+	{
+		int expected = SLOT_EMPTY;
+		if (_slots[i].state.compare_exchange_strong(expected, SLOT_BUSY))
+			return &_slots[i];
+	}
+
+	_size--;
+	return NULL;
+}
+
+int MysqlPool::open_slot(Slot *slot)
+{
+	DataSourceMysql *conn = new DataSourceMysql();
+	if (conn->open(_options.host, _options.port, _options.user, _options.passwd, _options.dbase))
+	{
+		set_error(conn);
+		delete conn;
+		return 1;
+	}
+
+	slot->conn = conn;
+	_opened++;
+	return 0;
+}
+
+//only connections that sat idle for a while are pinged
+bool MysqlPool::check_idle(Slot *slot)
+{
+	if (_options.ping_after_ms == 0)
+		return true;
+
+	if (now_ms() - slot->idle_since < (int64_t)_options.ping_after_ms)
+		return true;
+
+	_pings++;
+	if (slot->conn->ping())
+	{
+		_ping_failures++;
+		set_error(slot->conn);
+		return false;
+	}
+
+	return true;
+}
+
+void MysqlPool::release(Slot *slot)
+{
+	_in_use--;
+
+	if (!slot->conn->is_ready())
+	{
+		drop(slot);
+		return;
+	}
+
+	slot->idle_since = now_ms();
+	slot->state = SLOT_FREE;
+	notify();
+}
+
+void MysqlPool::drop(Slot *slot)
+{
+	delete slot->conn;
+	slot->conn = NULL;
+	slot->state = SLOT_EMPTY;
+	_size--;
+	notify();
+}
+
+void MysqlPool::notify()
+{
+	if (_waiters == 0)
+		return;
+
+	//taking the mutex orders us after a waiter that registered but has
+	//not started waiting yet
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+	_cond.notify_one();
+}
+
+void MysqlPool::set_error(const DataSourceMysql *conn)
+{
+	std::lock_guard<std::mutex> lock(_error_mutex);
+	_errno = conn->last_errno();
+	_error = conn->last_error();
+}
+
+void MysqlPool::reap()
+{
+	if (_options.idle_timeout_ms)
+	{
+		int64_t now = now_ms();
+
+		for (size_t i=0; i<_options.max_size && _size > _options.min_size; i++)
+		{
+			Slot *slot = &_slots[i];
+			if (slot->state.load(std::memory_order_relaxed) != SLOT_FREE)
+				continue;
+
+			if (now - slot->idle_since < (int64_t)_options.idle_timeout_ms)
+				continue;
+
+			int expected = SLOT_FREE;
+			if (!slot->state.compare_exchange_strong(expected, SLOT_BUSY))
+				continue;
+
+			//it may have been used in between, check again now that we own it
+			if (now - slot->idle_since < (int64_t)_options.idle_timeout_ms)
+			{
+				slot->state = SLOT_FREE;
+				notify();
+				continue;
+			}
+
+			_reaped++;
+			drop(slot);
+		}
+	}
+
+	//top up after connections were lost
+	while (_size < _options.min_size)
+	{
+		Slot *slot = try_reserve();
+		if (!slot)
+			break;
+
+		if (open_slot(slot))
+		{
+			slot->state = SLOT_EMPTY;
+			_size--;
+			break;
+		}
+
+		slot->idle_since = now_ms();
+		slot->state = SLOT_FREE;
+		notify();
+	}
+}
+
+void MysqlPool::reaper_loop()
+{
+	std::unique_lock<std::mutex> lock(_reaper_mutex);
+
+	while (_running)
+	{
+		_reaper_cond.wait_for(lock, std::chrono::milliseconds(_options.reap_interval_ms));
+		if (!_running)
+			break;
+
+		lock.unlock();
+		reap();
+		lock.lock();
+	}
+}
+
+int64_t MysqlPool::now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_SOURCE_MYSQL_POOL_H_
+#define STDEX_DATA_SOURCE_MYSQL_POOL_H_
+#ifdef STDEX_HAS_MYSQL
+
+#include "data_source_mysql.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+namespace stdex {
+
+struct MysqlPoolOptions
+{
+	string host;
+	int port;
+	string user;
+	string passwd;
+	string dbase;
+
+	size_t min_size;
+	size_t max_size;
+
+	//free connections above min_size are closed after idling this long
+	uint32_t idle_timeout_ms;
+	//a connection idle for longer is pinged before it is handed out
+	uint32_t ping_after_ms;
+	//how often the reaper looks for idle connections
+	uint32_t reap_interval_ms;
+
+	MysqlPoolOptions();
+};
+
+struct MysqlPoolStats
+{
+	size_t size;
+	size_t in_use;
+
+	uint64_t checkouts;
+	//checkouts that found no free slot and waited for a release
+	uint64_t waits;
+	uint64_t timeouts;
+	//time spent in every checkout, the ones served at once included
+	uint64_t wait_us_total;
+	uint64_t wait_us_max;
+
+	uint64_t pings;
+	uint64_t ping_failures;
+	uint64_t opened;
+	uint64_t reaped;
+};
+
+class MysqlPool
+{
+	struct Slot;
+
+public:
+	//a checked out connection, handed back to the pool when the lease
+	//goes out of scope. an empty lease means the checkout failed
+	class Lease
+	{
+	public:
+		Lease();
+		Lease(Lease &&other);
+		Lease &operator=(Lease &&other);
+		~Lease();
+
+		explicit operator bool() const;
+		DataSourceMysql *operator->() const;
+		DataSourceMysql &operator*() const;
+
+		void release();
+
+	private:
+		friend class MysqlPool;
+		Lease(MysqlPool *pool, Slot *slot);
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		MysqlPool *_pool;
+		Slot *_slot;
+	};
+
+	MysqlPool();
+	~MysqlPool();
+
+	//opens min_size connections up front and starts the reaper
+	int open(const MysqlPoolOptions &options);
+	//every lease has to be released before the pool is closed
+	void close();
+
+	//blocks until a connection is free
+	Lease acquire();
+	//gives up after timeout_ms and returns an empty lease
+	Lease acquire(uint32_t timeout_ms);
+
+	MysqlPoolStats stats() const;
+
+	unsigned last_errno() const;
+	string last_error() const;
+
+private:
+	enum SlotState {SLOT_EMPTY, SLOT_FREE, SLOT_BUSY};
+
+	struct Slot
+	{
+		std::atomic<int> state;
+		std::atomic<int64_t> idle_since;
+		DataSourceMysql *conn;
+	};
+
+	Lease checkout(bool bounded, uint32_t timeout_ms);
+	void record_wait(std::chrono::steady_clock::time_point start);
+	Slot *try_claim();
+	Slot *try_reserve();
+	int open_slot(Slot *slot);
+	bool check_idle(Slot *slot);
+	void release(Slot *slot);
+	void drop(Slot *slot);
+	void notify();
+	void set_error(const DataSourceMysql *conn);
+	void reap();
+	void reaper_loop();
+
+	static int64_t now_ms();
+
+	MysqlPoolOptions _options;
+	std::unique_ptr<Slot[]> _slots;
+	std::atomic<size_t> _size;
+	std::atomic<size_t> _in_use;
+	std::atomic<size_t> _waiters;
+
+	std::mutex _mutex;
+	std::condition_variable _cond;
+
+	std::thread _reaper;
+	std::mutex _reaper_mutex;
+	std::condition_variable _reaper_cond;
+	bool _running;
+
+	mutable std::mutex _error_mutex;
+	unsigned _errno;
+	string _error;
+
+	std::atomic<uint64_t> _checkouts;
+	std::atomic<uint64_t> _waits;
+	std::atomic<uint64_t> _timeouts;
+	std::atomic<uint64_t> _wait_us_total;
+	std::atomic<uint64_t> _wait_us_max;
+	std::atomic<uint64_t> _pings;
+	std::atomic<uint64_t> _ping_failures;
+	std::atomic<uint64_t> _opened;
+	std::atomic<uint64_t> _reaped;
+};
+
+}
+#endif
+#endif //STDEX_DATA_SOURCE_MYSQL_POOL_H_
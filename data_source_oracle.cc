@@ -19,11 +19,43 @@
 
 #ifdef STDEX_HAS_ORACLE
 #include "data_source_oracle.h"
+#include <chrono>
 namespace stdex {
 
+//the call in progress on this thread, threads share one DataSourceOracle
+struct SlowCall
+{
+	uint64_t begin;
+	const std::vector<Meta> *in;
+	const Param *params;
+	size_t param_num;
+};
+
+static thread_local SlowCall slow_call;
+
+OraclePoolOptions::OraclePoolOptions()
+{
+	min_size = 1;
+	max_size = 10;
+	increment = 1;
+	idle_timeout = 30;
+	wait_timeout_ms = 0;
+	stmt_cache_size = 0;
+}
+
 DataSourceOracle::DataSourceOracle()
 {
 	OCI_Initialize(NULL, NULL, OCI_ENV_DEFAULT|OCI_ENV_THREADED|OCI_ENV_CONTEXT);
+	pool = NULL;
+	_slow_log = NULL;
+	_waiters = 0;
+	_checkouts = 0;
+	_waits = 0;
+	_timeouts = 0;
+	_failures = 0;
+	_wait_us_total = 0;
+	_wait_us_max = 0;
+	_releases = 0;
 }
 
 DataSourceOracle::~DataSourceOracle()
@@ -41,17 +73,30 @@ bool DataSourceOracle::is_ready() const
 }
 
 int DataSourceOracle::open(const string &host, int port, const string &user, const string &passwd, const string &dbase)
+{
+	return open(host, port, user, passwd, dbase, OraclePoolOptions());
+}
+
+int DataSourceOracle::open(const string &host, int port, const string &user, const string &passwd, const string &dbase, const OraclePoolOptions &options)
 {
 	char buf[1024];
 	snprintf(buf, sizeof(buf), "(DESCRIPTION=(ADDRESS=(PROTOCOL=TCP)(HOST=%s)(PORT=%d))(CONNECT_DATA=(SID=%s)))",
 		host.c_str(), port, dbase.c_str());
 
-	pool = OCI_PoolCreate(buf, user.c_str(), passwd.c_str(), OCI_POOL_SESSION, OCI_SESSION_DEFAULT, 1, 10, 1);
-    if (!pool)
-        return 1;
+	pool = OCI_PoolCreate(buf, user.c_str(), passwd.c_str(), OCI_POOL_SESSION, OCI_SESSION_DEFAULT,
+		options.min_size, options.max_size, options.increment);
+	if (!pool)
+		return 1;
+
+	OCI_PoolSetTimeout(pool, options.idle_timeout);
+
+	//waiting is done in acquire so it can be bounded and measured
+	OCI_PoolSetNoWait(pool, TRUE);
 
-    OCI_PoolSetTimeout(pool, 30);  //todo
-    OCI_PoolSetNoWait(pool, TRUE);
+	if (options.stmt_cache_size)
+		OCI_PoolSetStatementCacheSize(pool, options.stmt_cache_size);
+
+	_options = options;
 	return 0;
 }
 
@@ -66,464 +111,1022 @@ void DataSourceOracle::close()
 
 int DataSourceOracle::query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
 {
-	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	OCI_Connection *conn = acquire();
 	if (!conn)
 		return 1;
 
 	OCI_Statement *stmt = OCI_StatementCreate(conn);
 	if (!stmt)
 	{
-		OCI_ConnectionFree(conn);
+		release(conn);
 		return 2;
 	}
 
 	if (!OCI_Prepare(stmt, sql.c_str()))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 3;
 	}
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			Meta &meta = in[i];
-
-			char pos[12];
-			sprintf(pos, ":%d", i+1);
-
-			if (meta.is_integer())
-			{
-				i32 &val = meta.integer_ref();
-				OCI_BindInt(stmt, pos, &val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 &val = meta.bigint_ref();
-				OCI_BindBigInt(stmt, pos, &val);
-			}
-			else if (meta.is_float())
-			{
-				f32 &val = meta.float_ref();
-				OCI_BindFloat(stmt, pos, &val);
-			}
-			else if (meta.is_double())
-			{
-				f64 &val = meta.double_ref();
-				OCI_BindDouble(stmt, pos, &val);
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				ulong len = val.size();
-				OCI_BindString(stmt, pos, &val[0], len);
-			}
-			else
-			{
-				OCI_StatementFree(stmt);
-				OCI_ConnectionFree(conn);
-				return 4;
-			}
-		}
+		finish(stmt);
+		release(conn);
+		return 4;
 	}
 
 	if (!OCI_Execute(stmt))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 5;
 	}
 
 	OCI_Resultset *rs = OCI_GetResultset(stmt);
 	if (!rs)
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 6;
 	}
 
-	u32 field_num = OCI_GetColumnCount(rs);
-	row.resize(field_num);
-
 	if (!OCI_FetchNext(rs))
 	{
 		OCI_ReleaseResultsets(stmt);
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 7;
 	}
 
-	for (u32 i=0; i<field_num; i++)
-	{
-		if (!OCI_IsNull(rs, i+1))
-		{
-			OCI_Column *col = OCI_GetColumn(rs, i+1);
-			u32 col_type = OCI_ColumnGetType(col);
-
-			if (col_type == OCI_CDT_NUMERIC)
-			{
-				if (OCI_ColumnGetScale(col) <= 0)
-				{
-					if (OCI_ColumnGetPrecision(col) >= 10)
-					{
-						row[i] = (i64)OCI_GetBigInt(rs, i+1);
-					}
-					else
-					{
-						row[i] = (i32)OCI_GetInt(rs, i+1);
-					}
-				}
-				else
-				{
-					if (OCI_ColumnGetPrecision(col) >= 10)
-					{
-						row[i] = (f32)OCI_GetDouble(rs, i+1);
-					}
-					else
-					{
-						row[i] = (f64)OCI_GetFloat(rs, i+1);
-					}
-				}
-			}
-			else if (col_type == OCI_CDT_TEXT)
-			{
-				row[i] = OCI_GetString(rs, i+1);
-			}
-		}
-	}
+	fetch_row(rs, row);
 
     OCI_ReleaseResultsets(stmt);
-    OCI_StatementFree(stmt);
-    OCI_ConnectionFree(conn);
+    finish(stmt);
+    release(conn);
 	return 0;
 }
 
 int DataSourceOracle::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
 {
-	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(std::move(row));
+		return true;
+	});
+}
+
+int DataSourceOracle::query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows)
+{
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(row);
+		return true;
+	});
+}
+
+int DataSourceOracle::query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback)
+{
+	OCI_Connection *conn = acquire();
 	if (!conn)
 		return 1;
 
 	OCI_Statement *stmt = OCI_StatementCreate(conn);
 	if (!stmt)
 	{
-		OCI_ConnectionFree(conn);
+		release(conn);
 		return 2;
 	}
 
 	if (!OCI_Prepare(stmt, sql.c_str()))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 3;
 	}
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			Meta &meta = in[i];
-
-			char pos[12];
-			sprintf(pos, ":%d", i+1);
-
-			if (meta.is_integer())
-			{
-				i32 &val = meta.integer_ref();
-				OCI_BindInt(stmt, pos, &val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 &val = meta.bigint_ref();
-				OCI_BindBigInt(stmt, pos, &val);
-			}
-			else if (meta.is_float())
-			{
-				f32 &val = meta.float_ref();
-				OCI_BindFloat(stmt, pos, &val);
-			}
-			else if (meta.is_double())
-			{
-				f64 &val = meta.double_ref();
-				OCI_BindDouble(stmt, pos, &val);
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				ulong len = val.size();
-				OCI_BindString(stmt, pos, &val[0], len);
-			}
-			else
-			{
-				OCI_StatementFree(stmt);
-				OCI_ConnectionFree(conn);
-				return 4;
-			}
-		}
+		finish(stmt);
+		release(conn);
+		return 4;
 	}
 
 	if (!OCI_Execute(stmt))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 5;
 	}
 
 	OCI_Resultset *rs = OCI_GetResultset(stmt);
 	if (!rs)
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 6;
 	}
 
-	u32 field_num = OCI_GetColumnCount(rs);
 	std::vector<Meta> row;
-	row.resize(field_num);
 
 	while (OCI_FetchNext(rs))
 	{
-		for (u32 i=0; i<field_num; i++)
-		{
-			if (!OCI_IsNull(rs, i+1))
-			{
-				OCI_Column *col = OCI_GetColumn(rs, i+1);
-				u32 col_type = OCI_ColumnGetType(col);
+		fetch_row(rs, row);
 
-				if (col_type == OCI_CDT_NUMERIC)
-				{
-					if (OCI_ColumnGetScale(col) <= 0)
-					{
-						if (OCI_ColumnGetPrecision(col) >= 10)
-						{
-							row[i] = (i64)OCI_GetBigInt(rs, i+1);
-						}
-						else
-						{
-							row[i] = (i32)OCI_GetInt(rs, i+1);
-						}
-					}
-					else
-					{
-						if (OCI_ColumnGetPrecision(col) >= 10)
-						{
-							row[i] = (f32)OCI_GetDouble(rs, i+1);
-						}
-						else
-						{
-							row[i] = (f64)OCI_GetFloat(rs, i+1);
-						}
-					}
-				}
-				else if (col_type == OCI_CDT_TEXT)
-				{
-					row[i] = OCI_GetString(rs, i+1);
-				}
-			}
-		}
-
-		rows.push_back(row);
+		if (!callback(row))
+			break;
 	}
 
 	OCI_ReleaseResultsets(stmt);
-	OCI_StatementFree(stmt);
-	OCI_ConnectionFree(conn);
+	finish(stmt);
+	release(conn);
 	return 0;
 }
 
 
-int DataSourceOracle::insert(const string &sql, std::vector<Meta> &in)
+int DataSourceOracle::query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch)
 {
-	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	OCI_Connection *conn = acquire();
 	if (!conn)
 		return 1;
 
 	OCI_Statement *stmt = OCI_StatementCreate(conn);
 	if (!stmt)
 	{
-		OCI_ConnectionFree(conn);
+		release(conn);
 		return 2;
 	}
 
 	if (!OCI_Prepare(stmt, sql.c_str()))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 3;
 	}
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			Meta &meta = in[i];
+		finish(stmt);
+		release(conn);
+		return 4;
+	}
 
-			char pos[12];
-			sprintf(pos, ":%d", i+1);
+	if (!OCI_Execute(stmt))
+	{
+		finish(stmt);
+		release(conn);
+		return 5;
+	}
 
-			if (meta.is_integer())
-			{
-				i32 &val = meta.integer_ref();
-				OCI_BindInt(stmt, pos, &val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 &val = meta.bigint_ref();
-				OCI_BindBigInt(stmt, pos, &val);
-			}
-			else if (meta.is_float())
-			{
-				f32 &val = meta.float_ref();
-				OCI_BindFloat(stmt, pos, &val);
-			}
-			else if (meta.is_double())
-			{
-				f64 &val = meta.double_ref();
-				OCI_BindDouble(stmt, pos, &val);
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				ulong len = val.size();
-				OCI_BindString(stmt, pos, &val[0], len);
-			}
+	OCI_Resultset *rs = OCI_GetResultset(stmt);
+	if (!rs)
+	{
+		finish(stmt);
+		release(conn);
+		return 6;
+	}
+
+	u32 field_num = OCI_GetColumnCount(rs);
+	batch.reset(field_num);
+
+	for (u32 i=0; i<field_num; i++)
+	{
+		OCI_Column *col = OCI_GetColumn(rs, i+1);
+		u32 col_type = OCI_ColumnGetType(col);
+		ColumnBatch::Type type = ColumnBatch::TYPE_NULL;
+
+		if (col_type == OCI_CDT_NUMERIC)
+		{
+			if (OCI_ColumnGetScale(col) > 0)
+				type = ColumnBatch::TYPE_DOUBLE;
+			else if (OCI_ColumnGetPrecision(col) >= 10)
+				type = ColumnBatch::TYPE_BIGINT;
 			else
-			{
-				OCI_StatementFree(stmt);
-				OCI_ConnectionFree(conn);
-				return 4;
-			}
+				type = ColumnBatch::TYPE_INT;
+		}
+		else if (col_type == OCI_CDT_TEXT)
+		{
+			type = ColumnBatch::TYPE_STRING;
 		}
+
+		batch.set_column(i, OCI_ColumnGetName(col), type);
+	}
+
+	while (OCI_FetchNext(rs))
+		fetch_columns(rs, batch);
+
+	OCI_ReleaseResultsets(stmt);
+	finish(stmt);
+	release(conn);
+	return 0;
+}
+
+int DataSourceOracle::insert(const string &sql, std::vector<Meta> &in)
+{
+	OCI_Connection *conn = acquire();
+	if (!conn)
+		return 1;
+
+	OCI_Statement *stmt = OCI_StatementCreate(conn);
+	if (!stmt)
+	{
+		release(conn);
+		return 2;
+	}
+
+	if (!OCI_Prepare(stmt, sql.c_str()))
+	{
+		finish(stmt);
+		release(conn);
+		return 3;
+	}
+
+	if (bind_params(stmt, in))
+	{
+		finish(stmt);
+		release(conn);
+		return 4;
 	}
 
 	if (!OCI_Execute(stmt))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 5;
 	}
 
-	OCI_StatementFree(stmt);
-	OCI_ConnectionFree(conn);
+	finish(stmt);
+	release(conn);
 	return 0;
 }
 
 int DataSourceOracle::execute(const string &sql, std::vector<Meta> &in, i64 *affected)
 {
-	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	OCI_Connection *conn = acquire();
 	if (!conn)
 		return 1;
 
 	OCI_Statement *stmt = OCI_StatementCreate(conn);
 	if (!stmt)
 	{
-		OCI_ConnectionFree(conn);
+		release(conn);
 		return 2;
 	}
 
 	if (!OCI_Prepare(stmt, sql.c_str()))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 3;
 	}
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			Meta &meta = in[i];
-
-			char pos[12];
-			sprintf(pos, ":%d", i+1);
-
-			if (meta.is_integer())
-			{
-				i32 &val = meta.integer_ref();
-				OCI_BindInt(stmt, pos, &val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 &val = meta.bigint_ref();
-				OCI_BindBigInt(stmt, pos, &val);
-			}
-			else if (meta.is_float())
-			{
-				f32 &val = meta.float_ref();
-				OCI_BindFloat(stmt, pos, &val);
-			}
-			else if (meta.is_double())
-			{
-				f64 &val = meta.double_ref();
-				OCI_BindDouble(stmt, pos, &val);
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.string_ref();
-				ulong len = val.size();
-				OCI_BindString(stmt, pos, &val[0], len);
-			}
-			else
-			{
-				OCI_StatementFree(stmt);
-				OCI_ConnectionFree(conn);
-				return 4;
-			}
-		}
+		finish(stmt);
+		release(conn);
+		return 4;
 	}
 
 	if (!OCI_Execute(stmt))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 5;
 	}
 
 	if (affected)
 		*affected = OCI_GetAffectedRows(stmt);
 
-	OCI_StatementFree(stmt);
-	OCI_ConnectionFree(conn);
+	finish(stmt);
+	release(conn);
 	return 0;
 }
 
 
 int DataSourceOracle::execute(const string &sql)
 {
-	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	OCI_Connection *conn = acquire();
 	if (!conn)
 		return 1;
 
 	OCI_Statement *stmt = OCI_StatementCreate(conn);
 	if (!stmt)
 	{
-		OCI_ConnectionFree(conn);
+		release(conn);
 		return 2;
 	}
 
 	if (!OCI_ExecuteStmt(stmt, sql.c_str()))
 	{
-		OCI_StatementFree(stmt);
-		OCI_ConnectionFree(conn);
+		finish(stmt);
+		release(conn);
 		return 3;
 	}
 
-	OCI_StatementFree(stmt);
-	OCI_ConnectionFree(conn);
+	finish(stmt);
+	release(conn);
 	return 0;
 }
 
-unsigned DataSourceOracle::last_errno() const
+int DataSourceOracle::execute_params(const string &sql, const Param *params, size_t param_num, i64 *affected)
 {
-	OCI_Error *err = OCI_GetLastError();
-	return err ? OCI_ErrorGetOCICode(err) : -1;
+	OCI_Connection *conn = acquire();
+	if (!conn)
+		return 1;
+
+	OCI_Statement *stmt = OCI_StatementCreate(conn);
+	if (!stmt)
+	{
+		release(conn);
+		return 2;
+	}
+
+	if (!OCI_Prepare(stmt, sql.c_str()))
+	{
+		finish(stmt);
+		release(conn);
+		return 3;
+	}
+
+	std::vector<string> copies;
+	if (bind_params(stmt, params, param_num, copies))
+	{
+		finish(stmt);
+		release(conn);
+		return 4;
+	}
+
+	if (!OCI_Execute(stmt))
+	{
+		finish(stmt);
+		release(conn);
+		return 5;
+	}
+
+	if (affected)
+		*affected = OCI_GetAffectedRows(stmt);
+
+	finish(stmt);
+	release(conn);
+	return 0;
 }
 
-const char *DataSourceOracle::last_error() const
+int DataSourceOracle::query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row)
 {
-	OCI_Error *err = OCI_GetLastError();
-	return err ? OCI_ErrorGetString(err) : "unknown ocilib error";
+	OCI_Connection *conn = acquire();
+	if (!conn)
+		return 1;
+
+	OCI_Statement *stmt = OCI_StatementCreate(conn);
+	if (!stmt)
+	{
+		release(conn);
+		return 2;
+	}
+
+	if (!OCI_Prepare(stmt, sql.c_str()))
+	{
+		finish(stmt);
+		release(conn);
+		return 3;
+	}
+
+	std::vector<string> copies;
+	if (bind_params(stmt, params, param_num, copies))
+	{
+		finish(stmt);
+		release(conn);
+		return 4;
+	}
+
+	if (!OCI_Execute(stmt))
+	{
+		finish(stmt);
+		release(conn);
+		return 5;
+	}
+
+	OCI_Resultset *rs = OCI_GetResultset(stmt);
+	if (!rs)
+	{
+		finish(stmt);
+		release(conn);
+		return 6;
+	}
+
+	if (!OCI_FetchNext(rs))
+	{
+		OCI_ReleaseResultsets(stmt);
+		finish(stmt);
+		release(conn);
+		return 7;
+	}
+
+	fetch_row(rs, row);
+
+	OCI_ReleaseResultsets(stmt);
+	finish(stmt);
+	release(conn);
+	return 0;
+}
+
+int DataSourceOracle::execute_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, std::vector<RowError> *errors, i64 *affected)
+{
+	if (rows.empty())
+		return 0;
+
+	//the columns are bound as arrays, so every row has to have the
+	//width of the first one. nothing is sent when one does not
+	size_t row_num = rows.size();
+	size_t col_num = rows[0].size();
+	bool uneven = false;
+
+	for (size_t r=1; r<row_num; r++)
+	{
+		if (rows[r].size() == col_num)
+			continue;
+
+		uneven = true;
+		if (errors)
+		{
+			char text[96];
+			snprintf(text, sizeof(text), "row has %d values, the first row has %d", (int)rows[r].size(), (int)col_num);
+
+			RowError row_error;
+			row_error.row = r;
+			row_error.errnum = 0;
+			row_error.error = text;
+			errors->push_back(std::move(row_error));
+		}
+	}
+
+	if (uneven)
+		return 4;
+
+	OCI_Connection *conn = acquire();
+	if (!conn)
+		return 1;
+
+	OCI_Statement *stmt = OCI_StatementCreate(conn);
+	if (!stmt)
+	{
+		release(conn);
+		return 2;
+	}
+
+	if (!OCI_Prepare(stmt, sql.c_str()))
+	{
+		finish(stmt);
+		release(conn);
+		return 3;
+	}
+
+	std::vector<BindArray> arrays(col_num);
+
+	if (!OCI_BindArraySetSize(stmt, row_num))
+	{
+		finish(stmt);
+		release(conn);
+		return 4;
+	}
+
+	for (size_t i=0; i<col_num; i++)
+	{
+		BindArray &array = arrays[i];
+
+		char pos[16];
+		snprintf(pos, sizeof(pos), ":%d", (int)(i+1));
+
+		boolean ok = FALSE;
+		if (fill_bind_array(rows, i, array))
+		{
+			if (array.kind == BindArray::KIND_INT)
+				ok = OCI_BindArrayOfInts(stmt, pos, &array.ints[0], 0);
+			else if (array.kind == BindArray::KIND_BIGINT)
+				ok = OCI_BindArrayOfBigInts(stmt, pos, &array.bigints[0], 0);
+			else if (array.kind == BindArray::KIND_FLOAT)
+				ok = OCI_BindArrayOfFloats(stmt, pos, &array.floats[0], 0);
+			else if (array.kind == BindArray::KIND_DOUBLE)
+				ok = OCI_BindArrayOfDoubles(stmt, pos, &array.doubles[0], 0);
+			else
+				ok = OCI_BindArrayOfStrings(stmt, pos, &array.strings[0], array.width, 0);
+		}
+
+		if (!ok)
+		{
+			finish(stmt);
+			release(conn);
+			return 4;
+		}
+
+		OCI_Bind *bind = OCI_GetBind2(stmt, pos);
+		for (size_t r=0; r<row_num; r++)
+		{
+			if (rows[r][i].is_null())
+				OCI_BindSetNullAtPos(bind, r+1);
+		}
+	}
+
+	//without batch error mode the execution stops at the first bad
+	//row. with it oracle goes on past bad rows and reports each of them
+	//as a batch error
+	if (!OCI_SetBatchErrorMode(stmt, TRUE))
+	{
+		finish(stmt);
+		release(conn);
+		return 4;
+	}
+
+	boolean ok = OCI_Execute(stmt);
+
+	unsigned error_num = OCI_GetBatchErrorCount(stmt);
+	if (errors)
+	{
+		OCI_Error *err = OCI_GetBatchError(stmt);
+		while (err)
+		{
+			RowError row_error;
+			row_error.row = OCI_ErrorGetRow(err) - 1;
+			row_error.errnum = OCI_ErrorGetOCICode(err);
+			row_error.error = OCI_ErrorGetString(err);
+			errors->push_back(std::move(row_error));
+
+			err = OCI_GetBatchError(stmt);
+		}
+	}
+
+	if (affected)
+		*affected = OCI_GetAffectedRows(stmt);
+
+	finish(stmt);
+	release(conn);
+
+	if (error_num)
+		return 6;
+
+	return ok ? 0 : 5;
+}
+
+//ocilib reads bound strings up to their null, which the bytes of a
+//meta do not have. they are copied with one into a buffer kept per
+//thread, it only allocates when it has to grow
+int DataSourceOracle::bind_params(OCI_Statement *stmt, std::vector<Meta> &in)
+{
+	slow_call.in = &in;
+
+	static thread_local string chars;
+	size_t total = 0;
+
+	for (size_t i=0; i<in.size(); i++)
+	{
+		if (in[i].is_string())
+			total += in[i].string_size() + 1;
+	}
+
+	if (chars.size() < total)
+		chars.resize(total);
+
+	size_t offset = 0;
+
+	for (size_t i=0; i<in.size(); i++)
+	{
+		Meta &meta = in[i];
+
+		char pos[16];
+		snprintf(pos, sizeof(pos), ":%d", (int)(i+1));
+
+		if (meta.is_integer())
+		{
+			i32 &val = meta.integer_ref();
+			OCI_BindInt(stmt, pos, &val);
+		}
+		else if (meta.is_bigint())
+		{
+			i64 &val = meta.bigint_ref();
+			OCI_BindBigInt(stmt, pos, &val);
+		}
+		else if (meta.is_float())
+		{
+			f32 &val = meta.float_ref();
+			OCI_BindFloat(stmt, pos, &val);
+		}
+		else if (meta.is_double())
+		{
+			f64 &val = meta.double_ref();
+			OCI_BindDouble(stmt, pos, &val);
+		}
+		else if (meta.is_string())
+		{
+			size_t len = meta.string_size();
+			char *data = &chars[offset];
+
+			memcpy(data, meta.string_data(), len);
+			data[len] = '\0';
+			offset += len + 1;
+
+			OCI_BindString(stmt, pos, data, len);
+		}
+		else
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//strings that are not null terminated are copied into copies, which
+//has to live until the statement is executed
+int DataSourceOracle::bind_params(OCI_Statement *stmt, const Param *params, size_t param_num, std::vector<string> &copies)
+{
+	slow_call.params = params;
+	slow_call.param_num = param_num;
+
+	for (size_t i=0; i<param_num; i++)
+	{
+		Param &param = const_cast<Param &>(params[i]);
+
+		char pos[16];
+		snprintf(pos, sizeof(pos), ":%d", (int)(i+1));
+
+		if (param.type == Param::TYPE_INT)
+		{
+			OCI_BindInt(stmt, pos, &param.number_i32);
+		}
+		else if (param.type == Param::TYPE_BIGINT)
+		{
+			big_int &val = reinterpret_cast<big_int &>(param.number_i64);
+			OCI_BindBigInt(stmt, pos, &val);
+		}
+		else if (param.type == Param::TYPE_FLOAT)
+		{
+			OCI_BindFloat(stmt, pos, &param.number_f32);
+		}
+		else if (param.type == Param::TYPE_DOUBLE)
+		{
+			OCI_BindDouble(stmt, pos, &param.number_f64);
+		}
+		else if (param.type == Param::TYPE_STRING)
+		{
+			char *data = const_cast<char *>(param.str.data);
+			if (!param.terminated)
+			{
+				if (copies.empty())
+					copies.reserve(param_num);
+
+				copies.push_back(string(param.str.data, param.str.size));
+				data = &copies.back()[0];
+			}
+
+			OCI_BindString(stmt, pos, data, param.str.size);
+		}
+		else
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void DataSourceOracle::fetch_row(OCI_Resultset *rs, std::vector<Meta> &row)
+{
+	u32 field_num = OCI_GetColumnCount(rs);
+	row.resize(field_num);
+
+	for (u32 i=0; i<field_num; i++)
+	{
+		if (OCI_IsNull(rs, i+1))
+		{
+			row[i] = Meta();
+			continue;
+		}
+
+		OCI_Column *col = OCI_GetColumn(rs, i+1);
+		u32 col_type = OCI_ColumnGetType(col);
+
+		if (col_type == OCI_CDT_NUMERIC)
+		{
+			if (OCI_ColumnGetScale(col) <= 0)
+			{
+				if (OCI_ColumnGetPrecision(col) >= 10)
+				{
+					row[i] = (i64)OCI_GetBigInt(rs, i+1);
+				}
+				else
+				{
+					row[i] = (i32)OCI_GetInt(rs, i+1);
+				}
+			}
+			else
+			{
+				if (OCI_ColumnGetPrecision(col) >= 10)
+				{
+					row[i] = (f32)OCI_GetDouble(rs, i+1);
+				}
+				else
+				{
+					row[i] = (f64)OCI_GetFloat(rs, i+1);
+				}
+			}
+		}
+		else if (col_type == OCI_CDT_TEXT)
+		{
+			row[i] = OCI_GetString(rs, i+1);
+		}
+		else
+		{
+			row[i] = Meta();
+		}
+	}
+}
+
+void DataSourceOracle::fetch_columns(OCI_Resultset *rs, ColumnBatch &batch)
+{
+	u32 field_num = batch.column_count();
+
+	for (u32 i=0; i<field_num; i++)
+	{
+		ColumnBatch::Type type = batch.column(i).type;
+
+		if (type == ColumnBatch::TYPE_NULL || OCI_IsNull(rs, i+1))
+		{
+			batch.append_null(i);
+		}
+		else if (type == ColumnBatch::TYPE_INT)
+		{
+			batch.append_int(i, OCI_GetInt(rs, i+1));
+		}
+		else if (type == ColumnBatch::TYPE_BIGINT)
+		{
+			batch.append_bigint(i, OCI_GetBigInt(rs, i+1));
+		}
+		else if (type == ColumnBatch::TYPE_DOUBLE)
+		{
+			batch.append_double(i, OCI_GetDouble(rs, i+1));
+		}
+		else
+		{
+			const otext *val = OCI_GetString(rs, i+1);
+			batch.append_string(i, val, strlen(val));
+		}
+	}
+
+	batch.end_row();
+}
+
+bool DataSourceOracle::fill_bind_array(const std::vector<std::vector<Meta>> &rows, size_t col, BindArray &array)
+{
+	size_t row_num = rows.size();
+
+	//the widest type in the column decides how it is bound, numbers
+	//and strings can not share a column
+	array.kind = BindArray::KIND_NULL;
+	array.width = 1;
+
+	for (size_t r=0; r<row_num; r++)
+	{
+		if (rows[r].size() <= col)
+			return false;
+
+		const Meta &meta = rows[r][col];
+		BindArray::Kind kind;
+
+		if (meta.is_integer())
+			kind = BindArray::KIND_INT;
+		else if (meta.is_bigint())
+			kind = BindArray::KIND_BIGINT;
+		else if (meta.is_float())
+			kind = BindArray::KIND_FLOAT;
+		else if (meta.is_double())
+			kind = BindArray::KIND_DOUBLE;
+		else if (meta.is_string())
+			kind = BindArray::KIND_STRING;
+		else
+			continue;
+
+		if (kind == BindArray::KIND_STRING)
+		{
+			if (array.kind != BindArray::KIND_NULL && array.kind != BindArray::KIND_STRING)
+				return false;
+
+			if (meta.string_size() > array.width)
+				array.width = meta.string_size();
+		}
+		else if (array.kind == BindArray::KIND_STRING)
+		{
+			return false;
+		}
+
+		//floats only stay floats when the whole column is float
+		if ((kind == BindArray::KIND_FLOAT && (array.kind == BindArray::KIND_INT || array.kind == BindArray::KIND_BIGINT))
+			|| (array.kind == BindArray::KIND_FLOAT && (kind == BindArray::KIND_INT || kind == BindArray::KIND_BIGINT)))
+			kind = BindArray::KIND_DOUBLE;
+
+		if (kind > array.kind)
+			array.kind = kind;
+	}
+
+	if (array.kind == BindArray::KIND_NULL)
+		array.kind = BindArray::KIND_STRING;
+
+	if (array.kind == BindArray::KIND_INT)
+		array.ints.assign(row_num, 0);
+	else if (array.kind == BindArray::KIND_BIGINT)
+		array.bigints.assign(row_num, 0);
+	else if (array.kind == BindArray::KIND_FLOAT)
+		array.floats.assign(row_num, 0);
+	else if (array.kind == BindArray::KIND_DOUBLE)
+		array.doubles.assign(row_num, 0);
+
+	if (array.kind != BindArray::KIND_STRING)
+	{
+		for (size_t r=0; r<row_num; r++)
+		{
+			const Meta &meta = rows[r][col];
+			double val;
+
+			if (meta.is_integer())
+				val = meta.get_int();
+			else if (meta.is_bigint())
+				val = (double)meta.get_bigint();
+			else if (meta.is_float())
+				val = meta.get_float();
+			else if (meta.is_double())
+				val = meta.get_double();
+			else
+				continue;
+
+			if (array.kind == BindArray::KIND_INT)
+				array.ints[r] = meta.get_int();
+			else if (array.kind == BindArray::KIND_BIGINT)
+				array.bigints[r] = meta.is_bigint() ? meta.get_bigint() : meta.get_int();
+			else if (array.kind == BindArray::KIND_FLOAT)
+				array.floats[r] = meta.get_float();
+			else
+				array.doubles[r] = val;
+		}
+	}
+	else
+	{
+		//fixed width slots, each one null terminated
+		size_t slot = array.width + 1;
+		array.strings.assign(row_num * slot, 0);
+
+		for (size_t r=0; r<row_num; r++)
+		{
+			const Meta &meta = rows[r][col];
+			if (meta.is_string())
+				memcpy(&array.strings[r * slot], meta.string_data(), meta.string_size());
+		}
+	}
+
+	return true;
+}
+
+//the pool runs in no wait mode, an exhausted pool makes
+//OCI_PoolGetConnection fail at once and we wait here for a release.
+//the pool is only ever called outside _mutex, the mutex just guards
+//_releases so a release between a failed try and the wait is not lost.
+//every checkout is timed, the fast ones too
+OCI_Connection *DataSourceOracle::acquire()
+{
+	if (!pool)
+		return NULL;
+
+	if (_slow_log)
+	{
+		slow_call.begin = SlowQueryLog::now_us();
+		slow_call.in = NULL;
+		slow_call.params = NULL;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	OCI_Connection *conn = OCI_PoolGetConnection(pool, NULL);
+	if (!conn)
+	{
+		//a failure below max_size is a real error, not contention
+		if (_options.wait_timeout_ms == 0 || OCI_PoolGetBusyCount(pool) < _options.max_size)
+		{
+			_failures++;
+			return NULL;
+		}
+
+		_waits++;
+		_waiters++;
+		auto deadline = start + std::chrono::milliseconds(_options.wait_timeout_ms);
+
+		for (;;)
+		{
+			uint64_t seen;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				seen = _releases;
+			}
+
+			conn = OCI_PoolGetConnection(pool, NULL);
+			if (conn || std::chrono::steady_clock::now() >= deadline)
+				break;
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait_until(lock, deadline, [&] { return _releases != seen; });
+		}
+
+		_waiters--;
+	}
+
+	uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	_wait_us_total += us;
+
+	uint64_t max = _wait_us_max;
+	while (us > max && !_wait_us_max.compare_exchange_weak(max, us))
+		;
+
+	if (!conn)
+	{
+		_timeouts++;
+		return NULL;
+	}
+
+	_checkouts++;
+	return conn;
+}
+
+void DataSourceOracle::set_slow_query_log(SlowQueryLog *log)
+{
+	_slow_log = log;
+}
+
+//every call frees its statement through here, which ends the call for
+//the slow query log
+void DataSourceOracle::finish(OCI_Statement *stmt)
+{
+	if (slow_call.begin)
+	{
+		uint64_t duration = SlowQueryLog::now_us() - slow_call.begin;
+		slow_call.begin = 0;
+
+		if (_slow_log && _slow_log->should_log(duration))
+		{
+			OCI_Error *err = OCI_GetLastError();
+			const otext *sql = OCI_GetSql(stmt);
+
+			SlowQueryEntry entry;
+			entry.source = "oracle";
+			entry.code = err ? OCI_ErrorGetOCICode(err) : 0;
+			entry.sql = QueryStatsRegistry::fingerprint(sql ? sql : "");
+			entry.duration_us = duration;
+			entry.rows = OCI_GetAffectedRows(stmt);
+
+			if (slow_call.in)
+				entry.param_types = SlowQueryLog::param_types(*slow_call.in);
+			else if (slow_call.params)
+				entry.param_types = SlowQueryLog::param_types(slow_call.params, slow_call.param_num);
+
+			_slow_log->write(entry);
+		}
+	}
+
+	OCI_StatementFree(stmt);
+}
+
+void DataSourceOracle::release(OCI_Connection *conn)
+{
+	OCI_ConnectionFree(conn);
+
+	if (_waiters)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_releases++;
+		}
+		_cond.notify_one();
+	}
+}
+
+unsigned DataSourceOracle::last_errno() const
+{
+	OCI_Error *err = OCI_GetLastError();
+	return err ? OCI_ErrorGetOCICode(err) : -1;
+}
+
+const char *DataSourceOracle::last_error() const
+{
+	OCI_Error *err = OCI_GetLastError();
+	return err ? OCI_ErrorGetString(err) : "unknown ocilib error";
+}
+
+OraclePoolStats DataSourceOracle::pool_stats() const
+{
+	OraclePoolStats stats;
+	stats.busy = pool ? OCI_PoolGetBusyCount(pool) : 0;
+	stats.opened = pool ? OCI_PoolGetOpenedCount(pool) : 0;
+	stats.checkouts = _checkouts;
+	stats.waits = _waits;
+	stats.timeouts = _timeouts;
+	stats.failures = _failures;
+	stats.wait_us_total = _wait_us_total;
+	stats.wait_us_max = _wait_us_max;
+	return stats;
 }
 
 int DataSourceOracle::get_magic() const
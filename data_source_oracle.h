@@ -2,10 +2,46 @@
 #define STDEX_DATA_SOURCE_ORACLE_H_
 #ifdef STDEX_HAS_ORACLE
 
-#include "data_meta.h"
+#include "data_source.h"
+#include "data_slow_query_log.h"
 #include <ocilib.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 namespace stdex {
 
+struct OraclePoolOptions
+{
+	unsigned min_size;
+	unsigned max_size;
+	unsigned increment;
+
+	//seconds an idle session is kept above min_size
+	unsigned idle_timeout;
+	//how long a caller waits for a session once the pool is exhausted,
+	//0 fails right away
+	unsigned wait_timeout_ms;
+	//statements cached per session, 0 keeps the ocilib default
+	unsigned stmt_cache_size;
+
+	OraclePoolOptions();
+};
+
+struct OraclePoolStats
+{
+	unsigned busy;
+	unsigned opened;
+
+	uint64_t checkouts;
+	//checkouts that found the pool exhausted and waited for a release
+	uint64_t waits;
+	uint64_t timeouts;
+	uint64_t failures;
+	//time spent in every checkout, the ones served at once included
+	uint64_t wait_us_total;
+	uint64_t wait_us_max;
+};
+
 class DataSourceOracle
 {
 public:
@@ -14,25 +50,114 @@ public:
 	bool is_ready() const;
 
 	int open(const string &host, int port, const string &user, const string &passwd, const string &dbase);
+	int open(const string &host, int port, const string &user, const string &passwd, const string &dbase, const OraclePoolOptions &options);
 	void close();
 
 	int query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row);
 	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows);
+	int query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows);
+	int query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback);
+	int query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch);
 	int insert(const string &sql, std::vector<Meta> &in);
 	int execute(const string &sql, std::vector<Meta> &in, i64 *affected);
 	int execute(const string &sql);
 
+	//variadic forms binding their arguments in place, e.g.
+	//execute(sql, 42, name, 3.5). numbers and null terminated strings
+	//are bound without copying
+	template <typename... Ts>
+	int execute(const string &sql, const Ts &... args);
+	template <typename... Ts>
+	int query(const string &sql, std::vector<Meta> &row, const Ts &... args);
+
+	//binds every column of rows as one array and runs the statement for
+	//all of them in a single round trip. rows oracle rejects are listed
+	//in errors while the others are still applied. every row needs the
+	//width of the first, otherwise the rows that differ are listed and
+	//4 is returned without running anything
+	int execute_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, std::vector<RowError> *errors=NULL, i64 *affected=NULL);
+
 	unsigned last_errno() const;
 	const char *last_error() const;
 
+	OraclePoolStats pool_stats() const;
+
 	int get_magic() const;
 	void set_magic(int v);
 
+	//calls over the log's threshold are written to it, NULL turns it off.
+	//set before the source is shared between threads
+	void set_slow_query_log(SlowQueryLog *log);
+
 private:
+	//values of one bind column laid out the way OCI_BindArrayOf* expects
+	struct BindArray
+	{
+		enum Kind
+		{
+			KIND_NULL,
+			KIND_INT,
+			KIND_BIGINT,
+			KIND_FLOAT,
+			KIND_DOUBLE,
+			KIND_STRING,
+		};
+
+		Kind kind;
+		std::vector<int> ints;
+		std::vector<big_int> bigints;
+		std::vector<float> floats;
+		std::vector<double> doubles;
+		std::vector<otext> strings;
+		unsigned width;
+	};
+
+	OCI_Connection *acquire();
+	void release(OCI_Connection *conn);
+	void finish(OCI_Statement *stmt);
+
+	static bool fill_bind_array(const std::vector<std::vector<Meta>> &rows, size_t col, BindArray &array);
+	int bind_params(OCI_Statement *stmt, std::vector<Meta> &in);
+	int bind_params(OCI_Statement *stmt, const Param *params, size_t param_num, std::vector<string> &copies);
+	int execute_params(const string &sql, const Param *params, size_t param_num, i64 *affected);
+	int query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row);
+	void fetch_row(OCI_Resultset *rs, std::vector<Meta> &row);
+	void fetch_columns(OCI_Resultset *rs, ColumnBatch &batch);
+
 	OCI_ConnPool *pool;
 	int _magic;
+	SlowQueryLog *_slow_log;
+
+	OraclePoolOptions _options;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::atomic<unsigned> _waiters;
+	//bumped under _mutex by every release a waiter may be after
+	uint64_t _releases;
+
+	std::atomic<uint64_t> _checkouts;
+	std::atomic<uint64_t> _waits;
+	std::atomic<uint64_t> _timeouts;
+	std::atomic<uint64_t> _failures;
+	std::atomic<uint64_t> _wait_us_total;
+	std::atomic<uint64_t> _wait_us_max;
 };
 
+//the extra trailing slot keeps the array valid for an empty pack
+template <typename... Ts>
+int DataSourceOracle::execute(const string &sql, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return execute_params(sql, params, sizeof...(Ts), NULL);
+}
+
+template <typename... Ts>
+int DataSourceOracle::query(const string &sql, std::vector<Meta> &row, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return query_params(sql, params, sizeof...(Ts), row);
+}
+
 }
 #endif
 #endif //STDEX_DATA_SOURCE_ORACLE_H_
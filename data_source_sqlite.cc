@@ -19,14 +19,28 @@
 
 #ifdef STDEX_HAS_SQLITE
 #include "data_source_sqlite.h"
+#include <algorithm>
+#include <iterator>
 namespace stdex {
 
 DataSourceSqlite::DataSourceSqlite()
 {
-	int ret = sqlite3_config(SQLITE_CONFIG_SERIALIZED);
+	//sqlite3_config fails once the library is initialized, which the
+	//first open does, so it may only run for the first connection
+	static const int ret = sqlite3_config(SQLITE_CONFIG_SERIALIZED);
 	assert(ret == SQLITE_OK);
 
 	db = NULL;
+	_stmt_capacity = 32;
+	_stmt_hits = 0;
+	_stmt_misses = 0;
+	_row_busy = false;
+	_slow_log = NULL;
+	_slow_begin = 0;
+	_slow_rows = 0;
+	_slow_in = NULL;
+	_slow_params = NULL;
+	_slow_param_num = 0;
 }
 
 DataSourceSqlite::~DataSourceSqlite()
@@ -35,11 +49,21 @@ DataSourceSqlite::~DataSourceSqlite()
 }
 
 int DataSourceSqlite::open(const string &filename)
+{
+	return open(filename, SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE);
+}
+
+int DataSourceSqlite::open(const string &filename, int flags)
 {
 	assert(db == NULL);
 
-	if (sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL) != SQLITE_OK)
+	if (sqlite3_open_v2(filename.c_str(), &db, flags, NULL) != SQLITE_OK)
+	{
+		//a handle is returned even when the open fails
+		sqlite3_close_v2(db);
+		db = NULL;
 		return 1;
+	}
 
 	//autocommit mode is on by default
 	return 0;
@@ -47,6 +71,8 @@ int DataSourceSqlite::open(const string &filename)
 
 void DataSourceSqlite::close()
 {
+	clear_stmt_cache();
+
 	if (db)
 	{
 		sqlite3_close_v2(db);
@@ -62,156 +88,147 @@ bool DataSourceSqlite::is_ready() const
 		return false;
 }
 
-int DataSourceSqlite::query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
+void DataSourceSqlite::interrupt()
 {
-	sqlite3_stmt *stmt = NULL;
+	if (db)
+		sqlite3_interrupt(db);
+}
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK)
+int DataSourceSqlite::query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
 		return 1;
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			const Meta &meta = in[i];
+		finish(stmt);
+		return 2;
+	}
 
-			if (meta.is_integer())
-			{
-				i32 val = meta.get_integer();
-				if (sqlite3_bind_int(stmt, i+1, val))
-					return 2;
-			}
-			else if (meta.is_bigint())
-			{
-				i64 val = meta.get_bigint();
-				if (sqlite3_bind_int64(stmt, i+1, val))
-					return 2;
-			}
-			else if (meta.is_float())
-			{
-				f32 val = meta.get_float();
-				if (sqlite3_bind_double(stmt, i+1, val))
-					return 2;
-			}
-			else if (meta.is_double())
-			{
-				f64 val = meta.get_double();
-				if (sqlite3_bind_double(stmt, i+1, val))
-					return 2;
-			}
-			else if (meta.is_string())
-			{
-				string val = meta.get_string();
-				if (sqlite3_bind_text(stmt, i+1, val.c_str(), val.size(), SQLITE_TRANSIENT))
-					return 2;
-			}
-			else
-			{
-				if (sqlite3_bind_null(stmt, i+1))
-					return 2;
-			}
-		}
+	return step_single(sql, stmt, row);
+}
+
+int DataSourceSqlite::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
+{
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(std::move(row));
+		return true;
+	});
+}
+
+int DataSourceSqlite::query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows)
+{
+	return query_each(sql, in, [&rows](std::vector<Meta> &row) {
+		rows.push_back(row);
+		return true;
+	});
+}
+
+int DataSourceSqlite::query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
+		return 1;
+
+	if (bind_params(stmt, in))
+	{
+		finish(stmt);
+		return 2;
 	}
 
-	int ret = sqlite3_step(stmt);
+	//the scratch row is reused unless a callback runs a nested query_each
+	std::vector<Meta> nested;
+	std::vector<Meta> &row = _row_busy ? nested : _row;
+	bool outer = !_row_busy;
+	_row_busy = true;
 
-	if (ret == SQLITE_DONE)
+	while (true)
 	{
-        sqlite3_finalize(stmt);
-        return 0;
+		int ret = sqlite3_step(stmt);
+
+		if (ret == SQLITE_DONE)
+			break;
+
+		if (ret != SQLITE_ROW)
+		{
+			printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
+			finish(stmt);
+			_row_busy = !outer;
+			return 3;
+		}
+
+		fetch_row(stmt, row);
+		_slow_rows++;
+
+		if (!callback(row))
+			break;
 	}
 
-	if (ret != SQLITE_ROW)
+	finish(stmt);
+	_row_busy = !outer;
+	return 0;
+}
+
+int DataSourceSqlite::query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
+		return 1;
+
+	if (bind_params(stmt, in))
 	{
-		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
-        return 3;
+		finish(stmt);
+		return 2;
 	}
 
+	//column types are only known from the values, they are fixed by the
+	//first non null value of each column
 	int col_count = sqlite3_column_count(stmt);
-	row.resize(col_count);
+	batch.reset(col_count);
 
 	for (int i=0; i<col_count; i++)
+		batch.set_column(i, sqlite3_column_name(stmt, i), ColumnBatch::TYPE_NULL);
+
+	while (true)
 	{
-		sqlite3_value *col_value = sqlite3_column_value(stmt, i);
-		const char *col_type = sqlite3_column_decltype(stmt, i);
-		int value_type = sqlite3_value_type(col_value);
-		if (value_type == SQLITE_INTEGER && col_type != "BIGINT")
-		{
-			row[i] = (i32)sqlite3_value_int(col_value);
-		}
-		else if (value_type == SQLITE_INTEGER && col_type == "BIGINT")
-		{
-			row[i] = (i64)sqlite3_value_int64(col_value);
-		}
-		else if (value_type == SQLITE_FLOAT)
-		{
-			row[i] = (f64)sqlite3_value_double(col_value);
-		}
-		else if (value_type == SQLITE3_TEXT)
-		{
-			string tmp((const char *)sqlite3_value_text(col_value), sqlite3_value_bytes(col_value));
-			row[i] = std::move(tmp);
-		}
-		else if (value_type == SQLITE_BLOB)
-		{
-			string tmp((const char *)sqlite3_value_blob(col_value), sqlite3_value_bytes(col_value));
-			row[i] = std::move(tmp);
-		}
-		else if (value_type == SQLITE_NULL)
+		int ret = sqlite3_step(stmt);
+
+		if (ret == SQLITE_DONE)
+			break;
+
+		if (ret != SQLITE_ROW)
 		{
-			row[i] = std::move(string());
+			printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
+			finish(stmt);
+			return 3;
 		}
+
+		fetch_columns(stmt, batch);
+		_slow_rows++;
 	}
 
-    sqlite3_finalize(stmt);
+	finish(stmt);
 	return 0;
 }
 
-int DataSourceSqlite::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows)
+int DataSourceSqlite::query_typed(const string &sql, std::vector<Meta> &in, size_t column_num, const std::function<void(sqlite3_stmt *)> &fetch)
 {
-	sqlite3_stmt *stmt = NULL;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK)
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
 		return 1;
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			const Meta &meta = in[i];
+		finish(stmt);
+		return 2;
+	}
 
-			if (meta.is_integer())
-			{
-				i32 val = meta.get_integer();
-				sqlite3_bind_int(stmt, i+1, val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 val = meta.get_bigint();
-				sqlite3_bind_int64(stmt, i+1, val);
-			}
-			else if (meta.is_float())
-			{
-				f32 val = meta.get_float();
-				sqlite3_bind_double(stmt, i+1, val);
-			}
-			else if (meta.is_double())
-			{
-				f64 val = meta.get_double();
-				sqlite3_bind_double(stmt, i+1, val);
-			}
-			else if (meta.is_string())
-			{
-				string val = meta.get_string();
-				if (sqlite3_bind_text(stmt, i+1, val.c_str(), val.size(), SQLITE_TRANSIENT))
-					return 2;
-			}
-			else
-			{
-				sqlite3_bind_null(stmt, i+1);
-			}
-		}
+	if ((size_t)sqlite3_column_count(stmt) != column_num)
+	{
+		printf("\nsqlite err: %s: %d columns, %d expected\n", sql.c_str(), sqlite3_column_count(stmt), (int)column_num);
+		finish(stmt);
+		return 4;
 	}
 
 	while (true)
@@ -219,107 +236,33 @@ int DataSourceSqlite::query_all(const string &sql, std::vector<Meta> &in, std::v
 		int ret = sqlite3_step(stmt);
 
 		if (ret == SQLITE_DONE)
-		{
-			sqlite3_finalize(stmt);
-			return 0;
-		}
+			break;
 
 		if (ret != SQLITE_ROW)
 		{
 			printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
+			finish(stmt);
 			return 3;
 		}
 
-		int col_count = sqlite3_column_count(stmt);
-		std::vector<Meta> row;
-		row.resize(col_count);
-
-		for (int i=0; i<col_count; i++)
-		{
-			sqlite3_value *col_value = sqlite3_column_value(stmt, i);
-			const char *col_type = sqlite3_column_decltype(stmt, i);
-			int value_type = sqlite3_value_type(col_value);
-			if (value_type == SQLITE_INTEGER && col_type != "BIGINT")
-			{
-				row[i] = (i32)sqlite3_value_int(col_value);
-			}
-			else if (value_type == SQLITE_INTEGER && col_type == "BIGINT")
-			{
-				row[i] = (i64)sqlite3_value_int(col_value);
-			}
-			else if (value_type == SQLITE_FLOAT)
-			{
-				row[i] = (f64)sqlite3_value_double(col_value);
-			}
-			else if (value_type == SQLITE3_TEXT)
-			{
-				string tmp((const char *)sqlite3_value_text(col_value), sqlite3_value_bytes(col_value));
-				row[i] = std::move(tmp);
-			}
-			else if (value_type == SQLITE_BLOB)
-			{
-				string tmp((const char *)sqlite3_value_blob(col_value), sqlite3_value_bytes(col_value));
-				row[i] = std::move(tmp);
-			}
-			else if (value_type == SQLITE_NULL)
-			{
-				row[i] = std::move(string());
-			}
-		}
-
-		rows.push_back(std::move(row));
+		fetch(stmt);
+		_slow_rows++;
 	}
 
-	sqlite3_finalize(stmt);
+	finish(stmt);
 	return 0;
 }
 
-
 int DataSourceSqlite::insert(const string &sql, std::vector<Meta> &in, i64 *insert_id)
 {
-	sqlite3_stmt *stmt = NULL;
-
-	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK)
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
 		return 1;
 
-	if (!in.empty())
+	if (bind_params(stmt, in))
 	{
-		for (size_t i=0; i<in.size(); i++)
-		{
-			const Meta &meta = in[i];
-
-			if (meta.is_integer())
-			{
-				i32 val = meta.get_integer();
-				sqlite3_bind_int(stmt, i+1, val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 val = meta.get_bigint();
-				sqlite3_bind_int64(stmt, i+1, val);
-			}
-			else if (meta.is_float())
-			{
-				f32 val = meta.get_float();
-				sqlite3_bind_double(stmt, i+1, val);
-			}
-			else if (meta.is_double())
-			{
-				f64 val = meta.get_double();
-				sqlite3_bind_double(stmt, i+1, val);
-			}
-			else if (meta.is_string())
-			{
-				string &val = meta.get_string();
-				if (sqlite3_bind_text(stmt, i+1, val.c_str(), val.size(), SQLITE_TRANSIENT))
-					return 2;
-			}
-			else
-			{
-				sqlite3_bind_null(stmt, i+1);
-			}
-		}
+		finish(stmt);
+		return 2;
 	}
 
 	int ret = sqlite3_step(stmt);
@@ -327,89 +270,616 @@ int DataSourceSqlite::insert(const string &sql, std::vector<Meta> &in, i64 *inse
 	if (ret != SQLITE_DONE)
 	{
 		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
-		sqlite3_finalize(stmt);
+		finish(stmt);
 		return 3;
 	}
 
 	if (insert_id)
 		*insert_id = sqlite3_last_insert_rowid(db);
 
-	sqlite3_finalize(stmt);
+	finish(stmt);
 	return 0;
 }
 
-
 int DataSourceSqlite::execute(const string &sql, std::vector<Meta> &in, i64 *affected)
 {
-	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
+		return 1;
+
+	if (bind_params(stmt, in))
+	{
+		finish(stmt);
+		return 2;
+	}
+
+	return step_execute(sql, stmt, affected);
+}
 
-	if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK)
+int DataSourceSqlite::insert_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, size_t batch_size, std::vector<BatchResult> *results)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
 		return 1;
 
-	if (!in.empty())
+	//one transaction around the whole load unless the caller already
+	//opened one, each batch gets a savepoint so a failed batch is
+	//rolled back on its own
+	bool own_txn = sqlite3_get_autocommit(db) != 0;
+	if (own_txn && sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
 	{
-		for (size_t i=0; i<in.size(); i++)
+		finish(stmt);
+		return 4;
+	}
+
+	if (batch_size == 0)
+		batch_size = rows.size();
+
+	//every row has to fill each parameter, a short row would otherwise
+	//step with what the row before it bound
+	int param_num = sqlite3_bind_parameter_count(stmt);
+	int first_error = 0;
+	size_t first_result = results ? results->size() : 0;
+
+	for (size_t next = 0; next < rows.size(); next += batch_size)
+	{
+		BatchResult result;
+		result.first_row = next;
+		result.row_count = std::min(batch_size, rows.size() - next);
+		result.affected = 0;
+		result.code = 0;
+		result.errnum = 0;
+
+		if (sqlite3_exec(db, "SAVEPOINT insert_batch", NULL, NULL, NULL) != SQLITE_OK)
 		{
-			const Meta &meta = in[i];
+			result.code = 4;
+			result.errnum = sqlite3_errcode(db);
+			result.error = sqlite3_errmsg(db);
+			printf("\nsqlite err: SAVEPOINT: %s\n", result.error.c_str());
 
-			if (meta.is_integer())
-			{
-				i32 val = meta.get_integer();
-				sqlite3_bind_int(stmt, i+1, val);
-			}
-			else if (meta.is_bigint())
-			{
-				i64 val = meta.get_bigint();
-				sqlite3_bind_int64(stmt, i+1, val);
-			}
-			else if (meta.is_float())
+			if (!first_error)
+				first_error = result.code;
+
+			if (results)
+				results->push_back(std::move(result));
+			continue;
+		}
+
+		for (size_t i = next; i < next + result.row_count; i++)
+		{
+			if (rows[i].size() != (size_t)param_num)
 			{
-				f32 val = meta.get_float();
-				sqlite3_bind_double(stmt, i+1, val);
+				char error[96];
+				snprintf(error, sizeof(error), "row %zu has %zu values for %d parameters", i, rows[i].size(), param_num);
+
+				result.code = 2;
+				result.errnum = SQLITE_RANGE;
+				result.error = error;
+				break;
 			}
-			else if (meta.is_double())
+
+			if (bind_params(stmt, rows[i]))
 			{
-				f64 val = meta.get_double();
-				sqlite3_bind_double(stmt, i+1, val);
+				result.code = 2;
+				break;
 			}
-			else if (meta.is_string())
+
+			if (sqlite3_step(stmt) != SQLITE_DONE)
 			{
-				string val = meta.get_string();
-				if (sqlite3_bind_text(stmt, i+1, val.c_str(), val.size(), SQLITE_TRANSIENT))
-					return 2;
+				result.code = 3;
+				break;
 			}
-			else
+
+			result.affected += sqlite3_changes(db);
+			sqlite3_reset(stmt);
+		}
+
+		if (result.code)
+		{
+			if (result.error.empty())
 			{
-				sqlite3_bind_null(stmt, i+1);
+				result.errnum = sqlite3_errcode(db);
+				result.error = sqlite3_errmsg(db);
 			}
+
+			result.affected = 0;
+			printf("\nsqlite err: %s: %s\n", sql.c_str(), result.error.c_str());
+
+			sqlite3_reset(stmt);
+			sqlite3_exec(db, "ROLLBACK TO insert_batch", NULL, NULL, NULL);
+		}
+
+		if (sqlite3_exec(db, "RELEASE insert_batch", NULL, NULL, NULL) != SQLITE_OK && !result.code)
+		{
+			result.code = 4;
+			result.errnum = sqlite3_errcode(db);
+			result.error = sqlite3_errmsg(db);
+			result.affected = 0;
+			printf("\nsqlite err: RELEASE: %s\n", result.error.c_str());
+		}
+
+		if (result.code && !first_error)
+			first_error = result.code;
+
+		if (results)
+			results->push_back(std::move(result));
+	}
+
+	finish(stmt);
+
+	if (own_txn && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+	{
+		unsigned errnum = sqlite3_errcode(db);
+		string error = sqlite3_errmsg(db);
+		printf("\nsqlite err: COMMIT: %s\n", error.c_str());
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+		//nothing of the load made it, the batches that went through
+		//are rolled back with the rest
+		for (size_t i = first_result; results && i < results->size(); i++)
+		{
+			BatchResult &result = (*results)[i];
+			if (result.code)
+				continue;
+
+			result.code = 4;
+			result.errnum = errnum;
+			result.error = error;
+			result.affected = 0;
+		}
+
+		return 4;
+	}
+
+	return first_error;
+}
+
+int DataSourceSqlite::execute(const string &sql)
+{
+	if (sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) != SQLITE_OK)
+	{
+		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
+		return 1;
+	}
+
+	return 0;
+}
+
+int DataSourceSqlite::execute_params(const string &sql, const Param *params, size_t param_num, i64 *affected)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
+		return 1;
+
+	if (bind_params(stmt, params, param_num))
+	{
+		finish(stmt);
+		return 2;
+	}
+
+	return step_execute(sql, stmt, affected);
+}
+
+int DataSourceSqlite::query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row)
+{
+	sqlite3_stmt *stmt = prepare(sql);
+	if (!stmt)
+		return 1;
+
+	if (bind_params(stmt, params, param_num))
+	{
+		finish(stmt);
+		return 2;
+	}
+
+	return step_single(sql, stmt, row);
+}
+
+void DataSourceSqlite::set_stmt_cache_capacity(size_t capacity)
+{
+	_stmt_capacity = capacity;
+
+	while (_stmt_list.size() > _stmt_capacity)
+		evict(&_stmt_list.back());
+}
+
+size_t DataSourceSqlite::stmt_cache_capacity() const
+{
+	return _stmt_capacity;
+}
+
+uint64_t DataSourceSqlite::stmt_cache_hits() const
+{
+	return _stmt_hits;
+}
+
+uint64_t DataSourceSqlite::stmt_cache_misses() const
+{
+	return _stmt_misses;
+}
+
+sqlite3_stmt *DataSourceSqlite::prepare(const string &sql)
+{
+	if (_slow_log)
+	{
+		_slow_begin = SlowQueryLog::now_us();
+		_slow_rows = 0;
+	}
+
+	auto it = _stmt_map.find(sql);
+	if (it != _stmt_map.end())
+	{
+		_stmt_list.splice(_stmt_list.begin(), _stmt_list, it->second);
+		_stmt_hits++;
+
+		sqlite3_stmt *stmt = _stmt_list.front().stmt;
+		if (!sqlite3_stmt_busy(stmt))
+			return stmt;
+
+		//a query_each callback runs the same sql again while the cached
+		//statement is still stepping, give it a one off statement
+		stmt = NULL;
+		if (sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL) != SQLITE_OK)
+		{
+			slow_end(sql.c_str(), sqlite3_errcode(db));
+			return NULL;
 		}
+
+		_uncached.push_back(stmt);
+		return stmt;
+	}
+
+	_stmt_misses++;
+
+	//persistent tells sqlite the statement is long lived, so it is
+	//not carved out of the lookaside memory
+	sqlite3_stmt *stmt = NULL;
+	unsigned flags = _stmt_capacity ? SQLITE_PREPARE_PERSISTENT : 0;
+
+	//failed prepares still go to the slow log, with the error code
+	if (sqlite3_prepare_v3(db, sql.c_str(), sql.size(), flags, &stmt, NULL) != SQLITE_OK)
+	{
+		slow_end(sql.c_str(), sqlite3_errcode(db));
+		return NULL;
 	}
 
+	//statements without any sql such as comments come back as NULL
+	if (!stmt)
+	{
+		slow_end(sql.c_str(), SQLITE_MISUSE);
+		return NULL;
+	}
+
+	_stmt_list.push_front(Statement());
+	Statement &st = _stmt_list.front();
+	st.sql = sql;
+	st.stmt = stmt;
+
+	_stmt_map[sql] = _stmt_list.begin();
+	return stmt;
+}
+
+int DataSourceSqlite::bind_params(sqlite3_stmt *stmt, const std::vector<Meta> &in)
+{
+	_slow_in = &in;
+
+	for (size_t i=0; i<in.size(); i++)
+	{
+		const Meta &meta = in[i];
+		int ret;
+
+		if (meta.is_integer())
+		{
+			i32 val = meta.get_integer();
+			ret = sqlite3_bind_int(stmt, i+1, val);
+		}
+		else if (meta.is_bigint())
+		{
+			i64 val = meta.get_bigint();
+			ret = sqlite3_bind_int64(stmt, i+1, val);
+		}
+		else if (meta.is_float())
+		{
+			f32 val = meta.get_float();
+			ret = sqlite3_bind_double(stmt, i+1, val);
+		}
+		else if (meta.is_double())
+		{
+			f64 val = meta.get_double();
+			ret = sqlite3_bind_double(stmt, i+1, val);
+		}
+		else if (meta.is_string())
+		{
+			//the caller keeps in alive for the whole statement and finish()
+			//clears the bindings, so sqlite can point at the meta directly
+			ret = sqlite3_bind_text(stmt, i+1, meta.string_data(), meta.string_size(), SQLITE_STATIC);
+		}
+		else
+		{
+			ret = sqlite3_bind_null(stmt, i+1);
+		}
+
+		if (ret != SQLITE_OK)
+			return 1;
+	}
+
+	return 0;
+}
+
+int DataSourceSqlite::bind_params(sqlite3_stmt *stmt, const Param *params, size_t param_num)
+{
+	_slow_params = params;
+	_slow_param_num = param_num;
+
+	for (size_t i=0; i<param_num; i++)
+	{
+		const Param &param = params[i];
+		int ret;
+
+		if (param.type == Param::TYPE_INT)
+			ret = sqlite3_bind_int(stmt, i+1, param.number_i32);
+		else if (param.type == Param::TYPE_BIGINT)
+			ret = sqlite3_bind_int64(stmt, i+1, param.number_i64);
+		else if (param.type == Param::TYPE_FLOAT)
+			ret = sqlite3_bind_double(stmt, i+1, param.number_f32);
+		else if (param.type == Param::TYPE_DOUBLE)
+			ret = sqlite3_bind_double(stmt, i+1, param.number_f64);
+		else if (param.type == Param::TYPE_STRING)
+			ret = sqlite3_bind_text(stmt, i+1, param.str.data, param.str.size, SQLITE_STATIC);
+		else
+			ret = sqlite3_bind_null(stmt, i+1);
+
+		if (ret != SQLITE_OK)
+			return 1;
+	}
+
+	return 0;
+}
+
+//steps a bound statement once for query() and finishes it
+int DataSourceSqlite::step_single(const string &sql, sqlite3_stmt *stmt, std::vector<Meta> &row)
+{
+	int ret = sqlite3_step(stmt);
+
+	if (ret == SQLITE_DONE)
+	{
+		finish(stmt);
+		return 0;
+	}
+
+	if (ret != SQLITE_ROW)
+	{
+		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
+		finish(stmt);
+		return 3;
+	}
+
+	fetch_row(stmt, row);
+	_slow_rows++;
+
+	finish(stmt);
+	return 0;
+}
+
+int DataSourceSqlite::step_execute(const string &sql, sqlite3_stmt *stmt, i64 *affected)
+{
 	int ret = sqlite3_step(stmt);
 
 	if (ret != SQLITE_DONE)
 	{
 		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
-		sqlite3_finalize(stmt);
+		finish(stmt);
 		return 3;
 	}
 
 	if (affected)
 		*affected = sqlite3_changes(db);
 
-	sqlite3_finalize(stmt);
+	finish(stmt);
 	return 0;
 }
 
-int DataSourceSqlite::execute(const string &sql)
+void DataSourceSqlite::finish(sqlite3_stmt *stmt)
 {
-	if (sqlite3_exec(db, sql.c_str(), NULL, NULL, NULL) != SQLITE_OK)
+	slow_end(sqlite3_sql(stmt), sqlite3_errcode(db));
+
+	if (!_uncached.empty())
 	{
-		printf("\nsqlite err: %s: %s\n", sql.c_str(), sqlite3_errmsg(db));
-		return 1;
+		auto it = std::find(_uncached.begin(), _uncached.end(), stmt);
+		if (it != _uncached.end())
+		{
+			sqlite3_finalize(stmt);
+			_uncached.erase(it);
+			return;
+		}
 	}
 
-	return 0;
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	//statements still stepping in an outer query_each are kept
+	auto it = _stmt_list.end();
+	while (_stmt_list.size() > _stmt_capacity && it != _stmt_list.begin())
+	{
+		auto prev = std::prev(it);
+		if (sqlite3_stmt_busy(prev->stmt))
+			it = prev;
+		else
+			evict(&*prev);
+	}
+}
+
+void DataSourceSqlite::set_slow_query_log(SlowQueryLog *log)
+{
+	_slow_log = log;
+}
+
+void DataSourceSqlite::slow_end(const char *sql, int err)
+{
+	if (!_slow_begin)
+		return;
+
+	uint64_t duration = SlowQueryLog::now_us() - _slow_begin;
+	const std::vector<Meta> *in = _slow_in;
+	const Param *params = _slow_params;
+
+	_slow_begin = 0;
+	_slow_in = NULL;
+	_slow_params = NULL;
+
+	if (!_slow_log || !_slow_log->should_log(duration))
+		return;
+
+	SlowQueryEntry entry;
+	entry.source = "sqlite";
+	entry.sql = QueryStatsRegistry::fingerprint(sql ? sql : "");
+	entry.duration_us = duration;
+	entry.rows = _slow_rows;
+	entry.code = (err == SQLITE_OK || err == SQLITE_ROW || err == SQLITE_DONE) ? 0 : err;
+
+	if (in)
+		entry.param_types = SlowQueryLog::param_types(*in);
+	else if (params)
+		entry.param_types = SlowQueryLog::param_types(params, _slow_param_num);
+
+	if (sql && !entry.code && _slow_log->want_plan(entry.sql))
+		explain(sql, entry.plan);
+
+	_slow_log->write(entry);
+}
+
+//the plan is taken without the parameters, sqlite plans do not depend
+//on the bound values unless built with STAT4
+void DataSourceSqlite::explain(const char *sql, string &plan)
+{
+	string text = "EXPLAIN QUERY PLAN ";
+	text += sql;
+
+	sqlite3_stmt *stmt = NULL;
+	if (sqlite3_prepare_v2(db, text.c_str(), text.size(), &stmt, NULL) != SQLITE_OK || !stmt)
+		return;
+
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+		if (!detail)
+			continue;
+
+		plan += detail;
+		plan += '\n';
+	}
+
+	sqlite3_finalize(stmt);
+}
+
+void DataSourceSqlite::evict(Statement *st)
+{
+	auto it = _stmt_map.find(st->sql);
+
+	sqlite3_finalize(st->stmt);
+
+	_stmt_list.erase(it->second);
+	_stmt_map.erase(it);
+}
+
+void DataSourceSqlite::clear_stmt_cache()
+{
+	while (!_stmt_list.empty())
+		evict(&_stmt_list.back());
+}
+
+void DataSourceSqlite::fetch_row(sqlite3_stmt *stmt, std::vector<Meta> &row)
+{
+	int col_count = sqlite3_column_count(stmt);
+	row.resize(col_count);
+
+	for (int i=0; i<col_count; i++)
+	{
+		sqlite3_value *col_value = sqlite3_column_value(stmt, i);
+		const char *col_type = sqlite3_column_decltype(stmt, i);
+		bool is_bigint = col_type && sqlite3_stricmp(col_type, "BIGINT") == 0;
+		int value_type = sqlite3_value_type(col_value);
+
+		if (value_type == SQLITE_INTEGER && !is_bigint)
+		{
+			row[i] = (i32)sqlite3_value_int(col_value);
+		}
+		else if (value_type == SQLITE_INTEGER && is_bigint)
+		{
+			row[i] = (i64)sqlite3_value_int64(col_value);
+		}
+		else if (value_type == SQLITE_FLOAT)
+		{
+			row[i] = (f64)sqlite3_value_double(col_value);
+		}
+		else if (value_type == SQLITE3_TEXT)
+		{
+			row[i].assign((const char *)sqlite3_value_text(col_value), sqlite3_value_bytes(col_value));
+		}
+		else if (value_type == SQLITE_BLOB)
+		{
+			row[i].assign((const char *)sqlite3_value_blob(col_value), sqlite3_value_bytes(col_value));
+		}
+		else if (value_type == SQLITE_NULL)
+		{
+			row[i].assign("", 0);
+		}
+	}
+}
+
+//unlike fetch_row NULL stays null here, and values that do not match
+//the column type are converted by sqlite
+void DataSourceSqlite::fetch_columns(sqlite3_stmt *stmt, ColumnBatch &batch)
+{
+	int col_count = sqlite3_column_count(stmt);
+
+	for (int i=0; i<col_count; i++)
+	{
+		int value_type = sqlite3_column_type(stmt, i);
+		if (value_type == SQLITE_NULL)
+		{
+			batch.append_null(i);
+			continue;
+		}
+
+		ColumnBatch::Type type = batch.column(i).type;
+		if (type == ColumnBatch::TYPE_NULL)
+		{
+			const char *col_type = sqlite3_column_decltype(stmt, i);
+			bool is_bigint = col_type && sqlite3_stricmp(col_type, "BIGINT") == 0;
+
+			if (value_type == SQLITE_INTEGER)
+				type = is_bigint ? ColumnBatch::TYPE_BIGINT : ColumnBatch::TYPE_INT;
+			else if (value_type == SQLITE_FLOAT)
+				type = ColumnBatch::TYPE_DOUBLE;
+			else
+				type = ColumnBatch::TYPE_STRING;
+
+			batch.set_type(i, type);
+		}
+
+		if (type == ColumnBatch::TYPE_INT)
+		{
+			batch.append_int(i, sqlite3_column_int(stmt, i));
+		}
+		else if (type == ColumnBatch::TYPE_BIGINT)
+		{
+			batch.append_bigint(i, sqlite3_column_int64(stmt, i));
+		}
+		else if (type == ColumnBatch::TYPE_DOUBLE)
+		{
+			batch.append_double(i, sqlite3_column_double(stmt, i));
+		}
+		else
+		{
+			const char *data = value_type == SQLITE_BLOB
+				? (const char *)sqlite3_column_blob(stmt, i)
+				: (const char *)sqlite3_column_text(stmt, i);
+			batch.append_string(i, data, sqlite3_column_bytes(stmt, i));
+		}
+	}
+
+	batch.end_row();
 }
 
 unsigned DataSourceSqlite::last_errno() const
@@ -2,7 +2,8 @@
 #define STDEX_DATA_SOURCE_SQLITE_H_
 #ifdef STDEX_HAS_SQLITE
 
-#include "data_meta.h"
+#include "data_source.h"
+#include "data_slow_query_log.h"
 #include <sqlite3.h>
 namespace stdex {
 
@@ -13,26 +14,182 @@ public:
 	~DataSourceSqlite();
 
 	int open(const string &filename);
+	//flags as sqlite3_open_v2 takes them, e.g. SQLITE_OPEN_READONLY for
+	//connections that only read
+	int open(const string &filename, int flags);
 	void close();
 	bool is_ready() const;
+	//aborts the statement running on another thread, it fails with
+	//SQLITE_INTERRUPT. must not race with close()
+	void interrupt();
 
 	int query(const string &sql, std::vector<Meta> &in, std::vector<Meta> &row);
 	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::vector<Meta>> &rows);
+	int query_all(const string &sql, std::vector<Meta> &in, ArenaRows &rows);
+	int query_each(const string &sql, std::vector<Meta> &in, const RowCallback &callback);
+	int query_columns(const string &sql, std::vector<Meta> &in, ColumnBatch &batch);
+
+	//decodes every row straight into native types, skipping Meta. the
+	//column count has to match the tuple, values of another sqlite type
+	//are converted the way sqlite3_column_* does
+	template <typename... Ts>
+	int query_all(const string &sql, std::vector<Meta> &in, std::vector<std::tuple<Ts...>> &rows);
+	//same for a struct described by RowMapping<T>
+	template <typename T>
+	int query_as(const string &sql, std::vector<Meta> &in, std::vector<T> &rows);
 	int insert(const string &sql, std::vector<Meta> &in, i64 *insert_id=NULL);
 	int execute(const string &sql, std::vector<Meta> &in, i64 *affected=NULL);
 	int execute(const string &sql);
 
+	//variadic forms binding their arguments in place, e.g.
+	//execute(sql, 42, name, 3.5). nothing is copied or allocated for
+	//the parameters
+	template <typename... Ts>
+	int execute(const string &sql, const Ts &... args);
+	template <typename... Ts>
+	int query(const string &sql, std::vector<Meta> &row, const Ts &... args);
+
+	//inserts every row through one prepared statement inside a single
+	//transaction, batch_size rows per savepoint. batch_size 0 makes the
+	//whole load one batch
+	int insert_batch(const string &sql, const std::vector<std::vector<Meta>> &rows, size_t batch_size, std::vector<BatchResult> *results=NULL);
+
 	unsigned last_errno() const;
 	const char *last_error() const;
 
+	//prepared statements are kept per connection, keyed by sql text.
+	//a capacity of 0 finalizes every statement right after use
+	void set_stmt_cache_capacity(size_t capacity);
+	size_t stmt_cache_capacity() const;
+	uint64_t stmt_cache_hits() const;
+	uint64_t stmt_cache_misses() const;
+
 	int get_magic() const;
 	void set_magic(int v);
 
+	//calls over the log's threshold are written to it, NULL turns it off
+	void set_slow_query_log(SlowQueryLog *log);
+
 private:
+	struct Statement
+	{
+		string sql;
+		sqlite3_stmt *stmt;
+	};
+
+	typedef std::list<Statement> StatementList;
+
+	sqlite3_stmt *prepare(const string &sql);
+	int bind_params(sqlite3_stmt *stmt, const std::vector<Meta> &in);
+	int bind_params(sqlite3_stmt *stmt, const Param *params, size_t param_num);
+	int step_single(const string &sql, sqlite3_stmt *stmt, std::vector<Meta> &row);
+	int step_execute(const string &sql, sqlite3_stmt *stmt, i64 *affected);
+	int execute_params(const string &sql, const Param *params, size_t param_num, i64 *affected);
+	int query_params(const string &sql, const Param *params, size_t param_num, std::vector<Meta> &row);
+	void finish(sqlite3_stmt *stmt);
+	void slow_end(const char *sql, int err);
+	void explain(const char *sql, string &plan);
+	void evict(Statement *st);
+	void clear_stmt_cache();
+	void fetch_row(sqlite3_stmt *stmt, std::vector<Meta> &row);
+	void fetch_columns(sqlite3_stmt *stmt, ColumnBatch &batch);
+
+	int query_typed(const string &sql, std::vector<Meta> &in, size_t column_num, const std::function<void(sqlite3_stmt *)> &fetch);
+
+	template <typename Tuple, size_t... I>
+	static void fetch_tuple(sqlite3_stmt *stmt, Tuple &fields, IndexSequence<I...>)
+	{
+		int expand[] = {0, (get_column(stmt, I, std::get<I>(fields)), 0)...};
+		(void)expand;
+	}
+
+	static void get_column(sqlite3_stmt *stmt, int col, int32_t &val)
+	{
+		val = sqlite3_column_int(stmt, col);
+	}
+
+	static void get_column(sqlite3_stmt *stmt, int col, int64_t &val)
+	{
+		val = sqlite3_column_int64(stmt, col);
+	}
+
+	static void get_column(sqlite3_stmt *stmt, int col, float &val)
+	{
+		val = (float)sqlite3_column_double(stmt, col);
+	}
+
+	static void get_column(sqlite3_stmt *stmt, int col, double &val)
+	{
+		val = sqlite3_column_double(stmt, col);
+	}
+
+	static void get_column(sqlite3_stmt *stmt, int col, string &val)
+	{
+		const char *data = (const char *)sqlite3_column_text(stmt, col);
+		val.assign(data ? data : "", sqlite3_column_bytes(stmt, col));
+	}
+
 	sqlite3 *db;
 	int _magic;
+
+	//most recently used statement first
+	StatementList _stmt_list;
+	std::unordered_map<string, StatementList::iterator> _stmt_map;
+	size_t _stmt_capacity;
+	uint64_t _stmt_hits;
+	uint64_t _stmt_misses;
+	//one off statements prepared while the cached one was in use
+	std::vector<sqlite3_stmt *> _uncached;
+
+	//scratch row of query_each, reused so a warm statement allocates nothing
+	std::vector<Meta> _row;
+	bool _row_busy;
+
+	//the call in progress, a nested call takes it over
+	SlowQueryLog *_slow_log;
+	uint64_t _slow_begin;
+	uint64_t _slow_rows;
+	const std::vector<Meta> *_slow_in;
+	const Param *_slow_params;
+	size_t _slow_param_num;
 };
 
+//the extra trailing slot keeps the array valid for an empty pack
+template <typename... Ts>
+int DataSourceSqlite::execute(const string &sql, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return execute_params(sql, params, sizeof...(Ts), NULL);
+}
+
+template <typename... Ts>
+int DataSourceSqlite::query(const string &sql, std::vector<Meta> &row, const Ts &... args)
+{
+	const Param params[sizeof...(Ts) + 1] = {Param(args)...};
+	return query_params(sql, params, sizeof...(Ts), row);
+}
+
+template <typename... Ts>
+int DataSourceSqlite::query_all(const string &sql, std::vector<Meta> &in, std::vector<std::tuple<Ts...>> &rows)
+{
+	return query_typed(sql, in, sizeof...(Ts), [&rows](sqlite3_stmt *stmt) {
+		rows.emplace_back();
+		fetch_tuple(stmt, rows.back(), typename MakeIndexSequence<sizeof...(Ts)>::type());
+	});
+}
+
+template <typename T>
+int DataSourceSqlite::query_as(const string &sql, std::vector<Meta> &in, std::vector<T> &rows)
+{
+	typedef decltype(RowMapping<T>::fields(std::declval<T &>())) Fields;
+
+	return query_typed(sql, in, std::tuple_size<Fields>::value, [&rows](sqlite3_stmt *stmt) {
+		rows.emplace_back();
+		Fields fields = RowMapping<T>::fields(rows.back());
+		fetch_tuple(stmt, fields, typename MakeIndexSequence<std::tuple_size<Fields>::value>::type());
+	});
+}
+
 }
 #endif
 #endif //STDEX_DATA_SOURCE_SQLITE_H_
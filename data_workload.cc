@@ -0,0 +1,530 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "data_workload.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>
+namespace stdex {
+
+WorkloadParam::WorkloadParam()
+{
+	kind = PARAM_UNIFORM;
+	min = 0;
+	max = 0;
+	skew = 0;
+}
+
+WorkloadOptions::WorkloadOptions()
+{
+	threads = 1;
+	duration_ms = 10000;
+	max_calls = 0;
+	rate = 0;
+	seed = 1;
+}
+
+double WorkloadReport::throughput() const
+{
+	if (!elapsed_us)
+		return 0;
+
+	return calls * 1000000.0 / elapsed_us;
+}
+
+static bool parse_int(const string &token, int64_t &val)
+{
+	char *end = NULL;
+	val = strtoll(token.c_str(), &end, 10);
+	return !token.empty() && *end == '\0';
+}
+
+static bool parse_double(const string &token, double &val)
+{
+	char *end = NULL;
+	val = strtod(token.c_str(), &end);
+	return !token.empty() && *end == '\0';
+}
+
+static int parse_param(std::istringstream &words, WorkloadParam &param, string &error)
+{
+	string kind;
+	words >> kind;
+
+	std::vector<string> args;
+	string word;
+	while (words >> word)
+		args.push_back(word);
+
+	if (kind == "uniform" || kind == "skewed" || kind == "string")
+	{
+		size_t arg_num = kind == "skewed" ? 3 : 2;
+		if (args.size() != arg_num || !parse_int(args[0], param.min) || !parse_int(args[1], param.max) || param.min > param.max)
+		{
+			error = kind + " takes " + (kind == "skewed" ? "min max skew" : "min max");
+			return 1;
+		}
+
+		if (kind == "uniform")
+		{
+			param.kind = WorkloadParam::PARAM_UNIFORM;
+		}
+		else if (kind == "string")
+		{
+			param.kind = WorkloadParam::PARAM_STRING;
+			if (param.min < 0)
+			{
+				error = "string length below 0";
+				return 1;
+			}
+		}
+		else
+		{
+			param.kind = WorkloadParam::PARAM_SKEWED;
+			if (!parse_double(args[2], param.skew) || param.skew < 0 || param.skew >= 1)
+			{
+				error = "skew has to be in [0, 1)";
+				return 1;
+			}
+		}
+	}
+	else if (kind == "sequence")
+	{
+		param.kind = WorkloadParam::PARAM_SEQUENCE;
+		if (args.size() != 1 || !parse_int(args[0], param.min))
+		{
+			error = "sequence takes start";
+			return 1;
+		}
+	}
+	else if (kind == "choice")
+	{
+		param.kind = WorkloadParam::PARAM_CHOICE;
+		param.choices.swap(args);
+		if (param.choices.empty())
+		{
+			error = "choice without values";
+			return 1;
+		}
+	}
+	else
+	{
+		error = "unknown param kind " + kind;
+		return 1;
+	}
+
+	return 0;
+}
+
+int Workload::parse(const string &text, string &error)
+{
+	statements.clear();
+
+	std::istringstream lines(text);
+	string line;
+	int line_num = 0;
+
+	while (std::getline(lines, line))
+	{
+		line_num++;
+
+		std::istringstream words(line);
+		string keyword;
+		if (!(words >> keyword) || keyword[0] == '#')
+			continue;
+
+		if (keyword == "query" || keyword == "execute")
+		{
+			WorkloadStatement statement;
+			statement.query = keyword == "query";
+
+			string weight;
+			words >> weight;
+			if (!parse_double(weight, statement.weight) || statement.weight < 0)
+			{
+				error = "bad weight " + weight;
+				return line_num;
+			}
+
+			std::getline(words >> std::ws, statement.sql);
+			if (statement.sql.empty())
+			{
+				error = keyword + " without sql";
+				return line_num;
+			}
+
+			statements.push_back(statement);
+		}
+		else if (keyword == "param")
+		{
+			if (statements.empty())
+			{
+				error = "param before any statement";
+				return line_num;
+			}
+
+			WorkloadParam param;
+			if (parse_param(words, param, error))
+				return line_num;
+
+			statements.back().params.push_back(param);
+		}
+		else
+		{
+			error = "unknown directive " + keyword;
+			return line_num;
+		}
+	}
+
+	return 0;
+}
+
+int Workload::load(const string &filename, string &error)
+{
+	std::ifstream file(filename.c_str());
+	if (!file)
+	{
+		error = "can not open " + filename;
+		return -1;
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return parse(text.str(), error);
+}
+
+namespace {
+
+struct WorkloadState
+{
+	const Workload *workload;
+	const WorkloadOptions *options;
+	//running sum of the weights, picked from by binary search
+	std::vector<double> cumulative;
+
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point deadline;
+	std::atomic<uint64_t> issued;
+
+	std::unique_ptr<LatencyHistogram[]> latency;
+	LatencyHistogram total;
+	std::unique_ptr<std::atomic<uint64_t>[]> calls;
+	std::unique_ptr<std::atomic<uint64_t>[]> errors;
+	std::unique_ptr<std::atomic<uint64_t>[]> rows;
+	std::atomic<size_t> failed_threads;
+};
+
+//xorshift, seeded through splitmix so neighbouring seeds diverge
+struct WorkloadRandom
+{
+	uint64_t state;
+
+	explicit WorkloadRandom(uint64_t seed)
+	{
+		seed += 0x9e3779b97f4a7c15ULL;
+		seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+		state = (seed ^ (seed >> 31)) | 1;
+	}
+
+	uint64_t next()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+
+	//[0, 1)
+	double unit()
+	{
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	//[min, max]
+	int64_t range(int64_t min, int64_t max)
+	{
+		uint64_t span = (uint64_t)max - (uint64_t)min + 1;
+		if (!span)
+			return (int64_t)next();
+
+		return (int64_t)((uint64_t)min + next() % span);
+	}
+};
+
+}
+
+static const char string_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+static Meta make_value(const WorkloadParam &param, WorkloadRandom &random, int64_t sequence)
+{
+	switch (param.kind)
+	{
+	case WorkloadParam::PARAM_UNIFORM:
+		return Meta(random.range(param.min, param.max));
+	case WorkloadParam::PARAM_SKEWED:
+	{
+		double span = (double)param.max - (double)param.min + 1;
+		int64_t offset = (int64_t)(span * pow(random.unit(), 1 / (1 - param.skew)));
+		return Meta(param.min + std::min<int64_t>(offset, param.max - param.min));
+	}
+	case WorkloadParam::PARAM_SEQUENCE:
+		return Meta(sequence);
+	case WorkloadParam::PARAM_STRING:
+	{
+		string val((size_t)random.range(param.min, param.max), ' ');
+		for (size_t i=0; i<val.size(); i++)
+			val[i] = string_chars[random.next() % (sizeof(string_chars) - 1)];
+		return Meta(std::move(val));
+	}
+	case WorkloadParam::PARAM_CHOICE:
+		return Meta(param.choices[random.next() % param.choices.size()]);
+	}
+
+	return Meta();
+}
+
+static size_t pick_statement(const WorkloadState &state, WorkloadRandom &random)
+{
+	const std::vector<double> &cumulative = state.cumulative;
+	double at = random.unit() * cumulative.back();
+
+	size_t index = std::upper_bound(cumulative.begin(), cumulative.end(), at) - cumulative.begin();
+	return std::min(index, cumulative.size() - 1);
+}
+
+static void workload_thread(const WorkloadConnect &connect, WorkloadState &state, size_t index)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const Workload &workload = *state.workload;
+	const WorkloadOptions &options = *state.options;
+
+	WorkloadRunner runner = connect();
+	if (!runner)
+	{
+		state.failed_threads++;
+		return;
+	}
+
+	WorkloadRandom random(options.seed * 1000003 + index);
+
+	//sequences interleave across threads, thread i takes start+i,
+	//start+i+threads and so on
+	std::vector<std::vector<int64_t>> sequences(workload.statements.size());
+	for (size_t i=0; i<workload.statements.size(); i++)
+	{
+		const std::vector<WorkloadParam> &params = workload.statements[i].params;
+		for (size_t j=0; j<params.size(); j++)
+			sequences[i].push_back(params[j].min + (int64_t)index);
+	}
+
+	//with a rate every thread keeps its own schedule, staggered so the
+	//threads do not fire together
+	Clock::duration interval(0);
+	Clock::time_point due = state.start;
+	if (options.rate > 0)
+	{
+		interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.threads / options.rate));
+		due += interval * index / options.threads;
+	}
+
+	std::vector<Meta> in;
+
+	while (true)
+	{
+		if (options.max_calls && state.issued.fetch_add(1, std::memory_order_relaxed) >= options.max_calls)
+			break;
+
+		if (options.rate > 0)
+		{
+			if (options.duration_ms && due >= state.deadline)
+				break;
+
+			std::this_thread::sleep_until(due);
+		}
+		else if (options.duration_ms && Clock::now() >= state.deadline)
+		{
+			break;
+		}
+
+		size_t pick = pick_statement(state, random);
+		const WorkloadStatement &statement = workload.statements[pick];
+
+		in.clear();
+		for (size_t i=0; i<statement.params.size(); i++)
+		{
+			in.push_back(make_value(statement.params[i], random, sequences[pick][i]));
+			if (statement.params[i].kind == WorkloadParam::PARAM_SEQUENCE)
+				sequences[pick][i] += (int64_t)options.threads;
+		}
+
+		Clock::time_point begin = options.rate > 0 ? due : Clock::now();
+		uint64_t rows = 0;
+		int ret = runner(statement.sql, in, statement.query, rows);
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+
+		state.latency[pick].record(ns);
+		state.total.record(ns);
+		state.calls[pick].fetch_add(1, std::memory_order_relaxed);
+		state.rows[pick].fetch_add(rows, std::memory_order_relaxed);
+		if (ret)
+			state.errors[pick].fetch_add(1, std::memory_order_relaxed);
+
+		due += interval;
+	}
+}
+
+int run_workload(const WorkloadConnect &connect, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report)
+{
+	const std::vector<WorkloadStatement> &statements = workload.statements;
+	size_t statement_num = statements.size();
+
+	WorkloadOptions run_options = options;
+	run_options.threads = std::max<size_t>(options.threads, 1);
+
+	WorkloadState state;
+	state.workload = &workload;
+	state.options = &run_options;
+
+	double sum = 0;
+	for (size_t i=0; i<statement_num; i++)
+	{
+		sum += statements[i].weight;
+		state.cumulative.push_back(sum);
+	}
+
+	if (!statement_num || sum <= 0)
+		return 1;
+
+	state.latency.reset(new LatencyHistogram[statement_num]);
+	state.calls.reset(new std::atomic<uint64_t>[statement_num]);
+	state.errors.reset(new std::atomic<uint64_t>[statement_num]);
+	state.rows.reset(new std::atomic<uint64_t>[statement_num]);
+	for (size_t i=0; i<statement_num; i++)
+	{
+		state.calls[i] = 0;
+		state.errors[i] = 0;
+		state.rows[i] = 0;
+	}
+
+	state.issued = 0;
+	state.failed_threads = 0;
+	state.start = std::chrono::steady_clock::now();
+	state.deadline = state.start + std::chrono::milliseconds(options.duration_ms);
+
+	std::vector<std::thread> threads;
+	for (size_t i=0; i<run_options.threads; i++)
+		threads.push_back(std::thread(workload_thread, std::cref(connect), std::ref(state), i));
+
+	for (size_t i=0; i<threads.size(); i++)
+		threads[i].join();
+
+	report.elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - state.start).count();
+	report.calls = 0;
+	report.errors = 0;
+	report.failed_threads = state.failed_threads;
+	report.statements.resize(statement_num);
+	state.total.snapshot(report.latency);
+
+	for (size_t i=0; i<statement_num; i++)
+	{
+		WorkloadStatementReport &out = report.statements[i];
+		out.calls = state.calls[i];
+		out.errors = state.errors[i];
+		out.rows = state.rows[i];
+		state.latency[i].snapshot(out.latency);
+
+		report.calls += out.calls;
+		report.errors += out.errors;
+	}
+
+	if (report.failed_threads == run_options.threads)
+		return 2;
+
+	return 0;
+}
+
+#ifdef STDEX_HAS_MYSQL
+int run_workload(MysqlPool &pool, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report)
+{
+	WorkloadConnect connect = [&pool]() -> WorkloadRunner {
+		return [&pool](const string &sql, std::vector<Meta> &in, bool query, uint64_t &rows) {
+			MysqlPool::Lease conn = pool.acquire();
+			if (!conn)
+				return 1;
+
+			if (query)
+			{
+				return conn->query_each(sql, in, [&rows](std::vector<Meta> &) {
+					rows++;
+					return true;
+				});
+			}
+
+			int64_t affected = 0;
+			int ret = conn->execute(sql, in, &affected);
+			rows = affected > 0 ? affected : 0;
+			return ret;
+		};
+	};
+
+	return run_workload(connect, workload, options, report);
+}
+#endif
+
+#ifdef STDEX_HAS_SQLITE
+int run_workload(const string &filename, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report)
+{
+	WorkloadConnect connect = [&filename]() -> WorkloadRunner {
+		std::shared_ptr<DataSourceSqlite> conn(new DataSourceSqlite);
+		if (conn->open(filename, SQLITE_OPEN_READWRITE|SQLITE_OPEN_NOMUTEX))
+			return WorkloadRunner();
+
+		//writers queue on the file lock the way they would on a server
+		//instead of failing with SQLITE_BUSY
+		conn->execute("PRAGMA busy_timeout = 5000");
+
+		return [conn](const string &sql, std::vector<Meta> &in, bool query, uint64_t &rows) {
+			if (query)
+			{
+				return conn->query_each(sql, in, [&rows](std::vector<Meta> &) {
+					rows++;
+					return true;
+				});
+			}
+
+			i64 affected = 0;
+			int ret = conn->execute(sql, in, &affected);
+			rows = affected > 0 ? affected : 0;
+			return ret;
+		};
+	};
+
+	return run_workload(connect, workload, options, report);
+}
+#endif
+
+}
@@ -0,0 +1,155 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef STDEX_DATA_WORKLOAD_H_
+#define STDEX_DATA_WORKLOAD_H_
+
+#include "data_source.h"
+#include "data_query_stats.h"
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql_pool.h"
+#endif
+#ifdef STDEX_HAS_SQLITE
+#include "data_source_sqlite.h"
+#endif
+namespace stdex {
+
+//how the value of one ? is made up for each call
+struct WorkloadParam
+{
+	enum Kind
+	{
+		//an integer drawn from [min, max]
+		PARAM_UNIFORM,
+		//an integer from [min, max] leaning towards min, skew 0 is
+		//uniform and the closer to 1 the hotter the first values
+		PARAM_SKEWED,
+		//min, min+1, ... per thread, interleaved so threads never repeat
+		PARAM_SEQUENCE,
+		//random letters and digits, between min and max of them
+		PARAM_STRING,
+		//one of choices
+		PARAM_CHOICE,
+	};
+
+	Kind kind;
+	int64_t min;
+	int64_t max;
+	double skew;
+	std::vector<string> choices;
+
+	WorkloadParam();
+};
+
+struct WorkloadStatement
+{
+	string sql;
+	//rows are read back when true, otherwise the affected count is taken
+	bool query;
+	//relative share of the calls
+	double weight;
+	std::vector<WorkloadParam> params;
+};
+
+//the statements of a workload file, one directive per line:
+//
+//  # comment
+//  query <weight> <sql>
+//  execute <weight> <sql>
+//  param uniform <min> <max>
+//  param skewed <min> <max> <skew>
+//  param sequence <start>
+//  param string <min_len> <max_len>
+//  param choice <value> [<value> ...]
+//
+//param lines give the ? of the statement above them, in order
+struct Workload
+{
+	std::vector<WorkloadStatement> statements;
+
+	//returns the 1 based line of the first error, 0 when it parsed
+	int parse(const string &text, string &error);
+	//-1 when the file can not be read
+	int load(const string &filename, string &error);
+};
+
+struct WorkloadOptions
+{
+	//threads driving calls, each over its own connection
+	size_t threads;
+	//run length, 0 runs until max_calls
+	uint64_t duration_ms;
+	//total calls, 0 for no limit
+	uint64_t max_calls;
+	//calls per second over all threads, 0 sends them back to back.
+	//with a rate, latency counts from when a call was due, so a
+	//stalled server shows up as queueing instead of fewer samples
+	double rate;
+	uint64_t seed;
+
+	WorkloadOptions();
+};
+
+struct WorkloadStatementReport
+{
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t rows;
+	HistogramSnapshot latency;
+};
+
+struct WorkloadReport
+{
+	uint64_t elapsed_us;
+	uint64_t calls;
+	uint64_t errors;
+	HistogramSnapshot latency;
+	//same order as the workload's statements
+	std::vector<WorkloadStatementReport> statements;
+	//threads that could not connect and sent nothing
+	size_t failed_threads;
+
+	double throughput() const;
+};
+
+//runs one statement, rows is set to the rows read or affected
+typedef std::function<int(const string &sql, std::vector<Meta> &in, bool query, uint64_t &rows)> WorkloadRunner;
+//called once per thread, an empty runner means the connect failed
+typedef std::function<WorkloadRunner()> WorkloadConnect;
+
+//returns 1 when the workload has no statements and 2 when no thread
+//could connect
+int run_workload(const WorkloadConnect &connect, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report);
+
+#ifdef STDEX_HAS_MYSQL
+//every call checks a connection out of the pool, size the pool to the
+//thread count to measure the server rather than the pool
+int run_workload(MysqlPool &pool, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report);
+#endif
+
+#ifdef STDEX_HAS_SQLITE
+//every thread opens the file read write
+int run_workload(const string &filename, const Workload &workload,
+	const WorkloadOptions &options, WorkloadReport &report);
+#endif
+
+}
+#endif //STDEX_DATA_WORKLOAD_H_
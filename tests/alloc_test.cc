@@ -0,0 +1,174 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//checks that execute and query on sql a connection has already run make
+//no heap allocation, counted by a replaced operator new. sqlite runs on
+//:memory:, mysql when built with it and given a server, e.g.
+//
+//  g++ -std=c++11 -DSTDEX_HAS_SQLITE -DSTDEX_HAS_MYSQL -I. tests/alloc_test.cc
+//    data_source_sqlite.cc data_source_mysql.cc data_slow_query_log.cc
+//    data_query_stats.cc -lsqlite3 -lmysqlclient -lpthread
+//  alloc_test 127.0.0.1 app secret app
+//
+//allocations inside the client libraries do not go through operator new
+//and are not counted. exits with the number of failed checks
+
+#include "data_source.h"
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql.h"
+#endif
+#ifdef STDEX_HAS_SQLITE
+#include "data_source_sqlite.h"
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+using namespace stdex;
+
+static int failed = 0;
+static size_t alloc_count = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed++; \
+		} \
+	} while (0)
+
+//gcc takes the free in the replaced delete for one that frees memory
+//from new, which is what replacing both of them is for
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size)
+{
+	alloc_count++;
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+#endif
+
+//the sql is held in strings made once, a literal would be copied into
+//a new string on every call. names are longer than the small string
+//buffer so a row that copied them would show up
+template <typename Source>
+static void check_warm(Source &source, const char *name)
+{
+	const size_t round_num = 100;
+	const string update = "update alloc_test set score = ? where id = ?";
+	const string select = "select id, name, score from alloc_test where id = ?";
+	const string select_all = "select id, name, score from alloc_test";
+	const string value = "a name long enough for the heap";
+
+	CHECK(source.execute("create temporary table alloc_test (id int primary key, name varchar(64), score double)") == 0);
+	for (int i=0; i<10; i++)
+		CHECK(source.execute("insert into alloc_test (id, name, score) values (?, ?, ?)", i, value, 0.5) == 0);
+
+	std::vector<Meta> update_in, select_in, none, row;
+	update_in.push_back(Meta(1.5));
+	update_in.push_back(Meta((int32_t)3));
+	select_in.push_back(Meta((int32_t)3));
+
+	size_t row_num = 0;
+	RowCallback count_rows = [&row_num](std::vector<Meta> &) { row_num++; return true; };
+
+	//the first round prepares, caches and sizes the buffers
+	for (int warm=0; warm<2; warm++)
+	{
+		size_t before = alloc_count;
+
+		for (size_t i=0; i<round_num; i++)
+		{
+			CHECK(source.execute(update, update_in) == 0);
+			CHECK(source.execute(update, 2.5, 3) == 0);
+			CHECK(source.query(select, select_in, row) == 0);
+			CHECK(source.query(select, row, 3) == 0);
+			CHECK(source.query_each(select_all, none, count_rows) == 0);
+		}
+
+		size_t allocs = alloc_count - before;
+		if (warm)
+		{
+			printf("%s: %zu allocations in %zu warm rounds\n", name, allocs, round_num);
+			CHECK(allocs == 0);
+		}
+	}
+
+	CHECK(row.size() == 3 && row[1].string_size() == value.size());
+	CHECK(row_num == 2 * round_num * 10);
+
+	source.execute("drop table alloc_test");
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef STDEX_HAS_SQLITE
+	DataSourceSqlite sqlite;
+	int ret = sqlite.open(":memory:");
+	CHECK(ret == 0);
+	if (ret == 0)
+		check_warm(sqlite, "sqlite");
+	sqlite.close();
+#endif
+
+#ifdef STDEX_HAS_MYSQL
+	if (argc < 5)
+	{
+		printf("mysql: skipped, usage: alloc_test host user password database [port]\n");
+	}
+	else
+	{
+		DataSourceMysql mysql;
+		int ret = mysql.open(argv[1], argc > 5 ? atoi(argv[5]) : 3306, argv[2], argv[3], argv[4]);
+		if (ret)
+			printf("mysql: %s\n", mysql.last_error());
+		CHECK(ret == 0);
+		if (ret == 0)
+			check_warm(mysql, "mysql");
+		mysql.close();
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	if (failed)
+		printf("%d checks failed\n", failed);
+	else
+		printf("all checks passed\n");
+
+	return failed;
+}
@@ -0,0 +1,127 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//the part of the ocilib api the oracle source uses, declared the way
+//ocilib declares it, so data_source_oracle.cc builds and links against
+//ocilib_mock.cc instead of the real library
+
+#ifndef OCILIB_MOCK_OCILIB_H_
+#define OCILIB_MOCK_OCILIB_H_
+
+#include <stdint.h>
+
+typedef int boolean;
+typedef char otext;
+//ocilib's own 64 bit integer, the width the tree binds its i64 with
+typedef int64_t big_int;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define OCI_ENV_DEFAULT 0
+#define OCI_ENV_THREADED 1
+#define OCI_ENV_CONTEXT 2
+
+#define OCI_POOL_CONNECTION 1
+#define OCI_POOL_SESSION 2
+#define OCI_SESSION_DEFAULT 0
+
+#define OCI_CDT_NUMERIC 1
+#define OCI_CDT_TEXT 4
+
+typedef struct OCI_Pool OCI_Pool;
+typedef struct OCI_Pool OCI_ConnPool;
+typedef struct OCI_Connection OCI_Connection;
+typedef struct OCI_Statement OCI_Statement;
+typedef struct OCI_Resultset OCI_Resultset;
+typedef struct OCI_Column OCI_Column;
+typedef struct OCI_Bind OCI_Bind;
+typedef struct OCI_Error OCI_Error;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+boolean OCI_Initialize(void *err_handler, const otext *lib_path, unsigned int mode);
+boolean OCI_Cleanup(void);
+
+OCI_Pool *OCI_PoolCreate(const otext *db, const otext *user, const otext *pwd, unsigned int type,
+	unsigned int mode, unsigned int min_con, unsigned int max_con, unsigned int incr_con);
+boolean OCI_PoolFree(OCI_Pool *pool);
+boolean OCI_PoolSetTimeout(OCI_Pool *pool, unsigned int value);
+boolean OCI_PoolSetNoWait(OCI_Pool *pool, boolean value);
+boolean OCI_PoolSetStatementCacheSize(OCI_Pool *pool, unsigned int value);
+unsigned int OCI_PoolGetBusyCount(OCI_Pool *pool);
+unsigned int OCI_PoolGetOpenedCount(OCI_Pool *pool);
+OCI_Connection *OCI_PoolGetConnection(OCI_Pool *pool, const otext *tag);
+boolean OCI_ConnectionFree(OCI_Connection *con);
+
+OCI_Statement *OCI_StatementCreate(OCI_Connection *con);
+boolean OCI_StatementFree(OCI_Statement *stmt);
+boolean OCI_Prepare(OCI_Statement *stmt, const otext *sql);
+boolean OCI_Execute(OCI_Statement *stmt);
+boolean OCI_ExecuteStmt(OCI_Statement *stmt, const otext *sql);
+const otext *OCI_GetSql(OCI_Statement *stmt);
+unsigned int OCI_GetAffectedRows(OCI_Statement *stmt);
+boolean OCI_SetBatchErrorMode(OCI_Statement *stmt, boolean value);
+unsigned int OCI_GetBatchErrorCount(OCI_Statement *stmt);
+OCI_Error *OCI_GetBatchError(OCI_Statement *stmt);
+
+boolean OCI_BindInt(OCI_Statement *stmt, const otext *name, int *data);
+boolean OCI_BindBigInt(OCI_Statement *stmt, const otext *name, big_int *data);
+boolean OCI_BindFloat(OCI_Statement *stmt, const otext *name, float *data);
+boolean OCI_BindDouble(OCI_Statement *stmt, const otext *name, double *data);
+boolean OCI_BindString(OCI_Statement *stmt, const otext *name, otext *data, unsigned int len);
+boolean OCI_BindArraySetSize(OCI_Statement *stmt, unsigned int size);
+boolean OCI_BindArrayOfInts(OCI_Statement *stmt, const otext *name, int *data, unsigned int nbelem);
+boolean OCI_BindArrayOfBigInts(OCI_Statement *stmt, const otext *name, big_int *data, unsigned int nbelem);
+boolean OCI_BindArrayOfFloats(OCI_Statement *stmt, const otext *name, float *data, unsigned int nbelem);
+boolean OCI_BindArrayOfDoubles(OCI_Statement *stmt, const otext *name, double *data, unsigned int nbelem);
+boolean OCI_BindArrayOfStrings(OCI_Statement *stmt, const otext *name, otext *data, unsigned int len, unsigned int nbelem);
+OCI_Bind *OCI_GetBind2(OCI_Statement *stmt, const otext *name);
+boolean OCI_BindSetNullAtPos(OCI_Bind *bnd, unsigned int position);
+
+OCI_Resultset *OCI_GetResultset(OCI_Statement *stmt);
+boolean OCI_ReleaseResultsets(OCI_Statement *stmt);
+boolean OCI_FetchNext(OCI_Resultset *rs);
+unsigned int OCI_GetColumnCount(OCI_Resultset *rs);
+OCI_Column *OCI_GetColumn(OCI_Resultset *rs, unsigned int index);
+unsigned int OCI_ColumnGetType(OCI_Column *col);
+const otext *OCI_ColumnGetName(OCI_Column *col);
+int OCI_ColumnGetScale(OCI_Column *col);
+int OCI_ColumnGetPrecision(OCI_Column *col);
+boolean OCI_IsNull(OCI_Resultset *rs, unsigned int index);
+int OCI_GetInt(OCI_Resultset *rs, unsigned int index);
+big_int OCI_GetBigInt(OCI_Resultset *rs, unsigned int index);
+float OCI_GetFloat(OCI_Resultset *rs, unsigned int index);
+double OCI_GetDouble(OCI_Resultset *rs, unsigned int index);
+const otext *OCI_GetString(OCI_Resultset *rs, unsigned int index);
+
+OCI_Error *OCI_GetLastError(void);
+int OCI_ErrorGetOCICode(OCI_Error *err);
+const otext *OCI_ErrorGetString(OCI_Error *err);
+unsigned int OCI_ErrorGetRow(OCI_Error *err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //OCILIB_MOCK_OCILIB_H_
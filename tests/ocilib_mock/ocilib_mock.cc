@@ -0,0 +1,661 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "ocilib.h"
+#include "ocilib_mock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <strings.h>
+
+struct OCI_Error
+{
+	int code;
+	std::string text;
+	unsigned int row;
+};
+
+struct OCI_Pool
+{
+	unsigned int max;
+	unsigned int busy;
+	unsigned int opened;
+};
+
+struct OCI_Connection
+{
+	OCI_Pool *pool;
+};
+
+struct OCI_Bind
+{
+	enum Kind {INT, BIGINT, FLOAT, DOUBLE, STRING};
+
+	std::string name;
+	Kind kind;
+	void *data;
+	//string slot length without the null
+	unsigned int width;
+	bool array;
+	std::set<unsigned int> nulls;
+};
+
+struct OCI_Column
+{
+	std::string name;
+};
+
+struct OCI_Resultset
+{
+	std::vector<OCI_Column> columns;
+	std::vector<std::vector<std::string>> rows;
+	size_t next;
+};
+
+struct OCI_Statement
+{
+	OCI_Connection *con;
+	std::string sql;
+	unsigned int array_size;
+	bool batch_mode;
+	std::vector<OCI_Bind> binds;
+	std::vector<OCI_Error> errors;
+	size_t error_pos;
+	unsigned int affected;
+	OCI_Resultset *rs;
+};
+
+namespace {
+
+struct MockState
+{
+	std::mutex mutex;
+	std::vector<std::string> calls;
+	std::map<unsigned, int> fail_rows;
+	std::vector<std::string> executed;
+	std::vector<std::string> columns;
+	std::vector<std::vector<std::string>> rows;
+};
+
+MockState &state()
+{
+	static MockState mock;
+	return mock;
+}
+
+thread_local OCI_Error last_error;
+thread_local bool has_error = false;
+
+void record(const char *name, const std::string &args=std::string())
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	mock.calls.push_back(args.empty() ? std::string(name) : std::string(name) + " " + args);
+}
+
+boolean succeed()
+{
+	has_error = false;
+	return TRUE;
+}
+
+boolean fail(int code, const std::string &text, unsigned int row=0)
+{
+	last_error.code = code;
+	last_error.text = text;
+	last_error.row = row;
+	has_error = true;
+	return FALSE;
+}
+
+std::string number(double val)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%g", val);
+	return buf;
+}
+
+boolean bind(OCI_Statement *stmt, const otext *name, OCI_Bind::Kind kind, void *data, unsigned int width, bool array, const char *call)
+{
+	OCI_Bind bnd;
+	bnd.name = name;
+	bnd.kind = kind;
+	bnd.data = data;
+	bnd.width = width;
+	bnd.array = array;
+	stmt->binds.push_back(bnd);
+
+	record(call, std::string(name) + (array ? " " + std::to_string(stmt->array_size) : std::string()));
+	return succeed();
+}
+
+std::string bound_value(const OCI_Bind &bnd, unsigned int row)
+{
+	if (bnd.nulls.count(row + 1))
+		return "NULL";
+
+	size_t at = bnd.array ? row : 0;
+
+	switch (bnd.kind)
+	{
+	case OCI_Bind::INT:
+		return std::to_string(((int *)bnd.data)[at]);
+	case OCI_Bind::BIGINT:
+		return std::to_string(((big_int *)bnd.data)[at]);
+	case OCI_Bind::FLOAT:
+		return number(((float *)bnd.data)[at]);
+	case OCI_Bind::DOUBLE:
+		return number(((double *)bnd.data)[at]);
+	case OCI_Bind::STRING:
+		if (bnd.array)
+			return std::string((const char *)bnd.data + at * (bnd.width + 1));
+		return std::string((const char *)bnd.data);
+	}
+
+	return std::string();
+}
+
+bool is_select(const std::string &sql)
+{
+	size_t i = sql.find_first_not_of(" \t\r\n(");
+	return i != std::string::npos && strncasecmp(sql.c_str() + i, "select", 6) == 0;
+}
+
+}
+
+namespace ocilib_mock {
+
+std::vector<std::string> calls()
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	return mock.calls;
+}
+
+size_t count(const std::string &prefix)
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+
+	size_t num = 0;
+	for (size_t i=0; i<mock.calls.size(); i++)
+	{
+		if (mock.calls[i].compare(0, prefix.size(), prefix) == 0)
+			num++;
+	}
+
+	return num;
+}
+
+void reset()
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	mock.calls.clear();
+	mock.fail_rows.clear();
+	mock.executed.clear();
+	mock.columns.clear();
+	mock.rows.clear();
+}
+
+void fail_row(unsigned row, int code)
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	mock.fail_rows[row] = code;
+}
+
+std::vector<std::string> executed_rows()
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	return mock.executed;
+}
+
+void set_result(const std::vector<std::string> &columns, const std::vector<std::vector<std::string>> &rows)
+{
+	MockState &mock = state();
+	std::lock_guard<std::mutex> lock(mock.mutex);
+	mock.columns = columns;
+	mock.rows = rows;
+}
+
+}
+
+extern "C" {
+
+boolean OCI_Initialize(void *, const otext *, unsigned int mode)
+{
+	record("OCI_Initialize", std::to_string(mode));
+	return succeed();
+}
+
+boolean OCI_Cleanup(void)
+{
+	record("OCI_Cleanup");
+	return succeed();
+}
+
+OCI_Pool *OCI_PoolCreate(const otext *db, const otext *, const otext *, unsigned int, unsigned int,
+	unsigned int min_con, unsigned int max_con, unsigned int incr_con)
+{
+	record("OCI_PoolCreate", std::string(db) + " " + std::to_string(min_con) + " " + std::to_string(max_con) + " " + std::to_string(incr_con));
+
+	OCI_Pool *pool = new OCI_Pool;
+	pool->max = max_con;
+	pool->busy = 0;
+	pool->opened = min_con;
+	succeed();
+	return pool;
+}
+
+boolean OCI_PoolFree(OCI_Pool *pool)
+{
+	record("OCI_PoolFree");
+	delete pool;
+	return succeed();
+}
+
+boolean OCI_PoolSetTimeout(OCI_Pool *, unsigned int value)
+{
+	record("OCI_PoolSetTimeout", std::to_string(value));
+	return succeed();
+}
+
+boolean OCI_PoolSetNoWait(OCI_Pool *, boolean value)
+{
+	record("OCI_PoolSetNoWait", std::to_string(value));
+	return succeed();
+}
+
+boolean OCI_PoolSetStatementCacheSize(OCI_Pool *, unsigned int value)
+{
+	record("OCI_PoolSetStatementCacheSize", std::to_string(value));
+	return succeed();
+}
+
+unsigned int OCI_PoolGetBusyCount(OCI_Pool *pool)
+{
+	std::lock_guard<std::mutex> lock(state().mutex);
+	return pool->busy;
+}
+
+unsigned int OCI_PoolGetOpenedCount(OCI_Pool *pool)
+{
+	std::lock_guard<std::mutex> lock(state().mutex);
+	return pool->opened;
+}
+
+//no wait mode only, an exhausted pool fails at once
+OCI_Connection *OCI_PoolGetConnection(OCI_Pool *pool, const otext *)
+{
+	record("OCI_PoolGetConnection");
+
+	{
+		std::lock_guard<std::mutex> lock(state().mutex);
+		if (pool->busy >= pool->max)
+		{
+			fail(24496, "ORA-24496: OCISessionGet() timed out waiting for a free connection");
+			return NULL;
+		}
+
+		pool->busy++;
+		if (pool->opened < pool->busy)
+			pool->opened = pool->busy;
+	}
+
+	OCI_Connection *con = new OCI_Connection;
+	con->pool = pool;
+	succeed();
+	return con;
+}
+
+boolean OCI_ConnectionFree(OCI_Connection *con)
+{
+	record("OCI_ConnectionFree");
+
+	{
+		std::lock_guard<std::mutex> lock(state().mutex);
+		con->pool->busy--;
+	}
+
+	delete con;
+	return succeed();
+}
+
+OCI_Statement *OCI_StatementCreate(OCI_Connection *con)
+{
+	record("OCI_StatementCreate");
+
+	OCI_Statement *stmt = new OCI_Statement;
+	stmt->con = con;
+	stmt->array_size = 1;
+	stmt->batch_mode = false;
+	stmt->error_pos = 0;
+	stmt->affected = 0;
+	stmt->rs = NULL;
+	succeed();
+	return stmt;
+}
+
+boolean OCI_StatementFree(OCI_Statement *stmt)
+{
+	record("OCI_StatementFree");
+	delete stmt->rs;
+	delete stmt;
+	return succeed();
+}
+
+boolean OCI_Prepare(OCI_Statement *stmt, const otext *sql)
+{
+	record("OCI_Prepare", sql);
+	stmt->sql = sql;
+	return succeed();
+}
+
+boolean OCI_Execute(OCI_Statement *stmt)
+{
+	record("OCI_Execute", std::to_string(stmt->array_size));
+
+	MockState &mock = state();
+	std::vector<std::string> executed;
+	std::map<unsigned, int> fail_rows;
+	{
+		std::lock_guard<std::mutex> lock(mock.mutex);
+		fail_rows.swap(mock.fail_rows);
+	}
+
+	stmt->errors.clear();
+	stmt->error_pos = 0;
+	stmt->affected = 0;
+
+	for (unsigned int r=0; r<stmt->array_size; r++)
+	{
+		std::string values;
+		for (size_t i=0; i<stmt->binds.size(); i++)
+		{
+			if (i)
+				values += '|';
+			values += bound_value(stmt->binds[i], r);
+		}
+
+		auto it = fail_rows.find(r);
+		if (it != fail_rows.end())
+		{
+			OCI_Error err;
+			err.code = it->second;
+			err.text = "ORA-" + std::to_string(it->second) + ": rejected by the mock";
+			err.row = r + 1;
+
+			if (!stmt->batch_mode)
+			{
+				std::lock_guard<std::mutex> lock(mock.mutex);
+				mock.executed.swap(executed);
+				return fail(err.code, err.text, err.row);
+			}
+
+			stmt->errors.push_back(err);
+			continue;
+		}
+
+		executed.push_back(values);
+		stmt->affected++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mock.mutex);
+		mock.executed.swap(executed);
+
+		if (is_select(stmt->sql))
+		{
+			delete stmt->rs;
+			stmt->rs = new OCI_Resultset;
+			stmt->rs->next = 0;
+			stmt->rs->rows = mock.rows;
+
+			for (size_t i=0; i<mock.columns.size(); i++)
+			{
+				OCI_Column col;
+				col.name = mock.columns[i];
+				stmt->rs->columns.push_back(col);
+			}
+		}
+	}
+
+	return succeed();
+}
+
+boolean OCI_ExecuteStmt(OCI_Statement *stmt, const otext *sql)
+{
+	return OCI_Prepare(stmt, sql) && OCI_Execute(stmt);
+}
+
+const otext *OCI_GetSql(OCI_Statement *stmt)
+{
+	return stmt->sql.c_str();
+}
+
+unsigned int OCI_GetAffectedRows(OCI_Statement *stmt)
+{
+	return stmt->affected;
+}
+
+boolean OCI_SetBatchErrorMode(OCI_Statement *stmt, boolean value)
+{
+	record("OCI_SetBatchErrorMode", std::to_string(value));
+	stmt->batch_mode = value != FALSE;
+	return succeed();
+}
+
+unsigned int OCI_GetBatchErrorCount(OCI_Statement *stmt)
+{
+	return (unsigned int)stmt->errors.size();
+}
+
+OCI_Error *OCI_GetBatchError(OCI_Statement *stmt)
+{
+	if (stmt->error_pos >= stmt->errors.size())
+		return NULL;
+
+	return &stmt->errors[stmt->error_pos++];
+}
+
+boolean OCI_BindInt(OCI_Statement *stmt, const otext *name, int *data)
+{
+	return bind(stmt, name, OCI_Bind::INT, data, 0, false, "OCI_BindInt");
+}
+
+boolean OCI_BindBigInt(OCI_Statement *stmt, const otext *name, big_int *data)
+{
+	return bind(stmt, name, OCI_Bind::BIGINT, data, 0, false, "OCI_BindBigInt");
+}
+
+boolean OCI_BindFloat(OCI_Statement *stmt, const otext *name, float *data)
+{
+	return bind(stmt, name, OCI_Bind::FLOAT, data, 0, false, "OCI_BindFloat");
+}
+
+boolean OCI_BindDouble(OCI_Statement *stmt, const otext *name, double *data)
+{
+	return bind(stmt, name, OCI_Bind::DOUBLE, data, 0, false, "OCI_BindDouble");
+}
+
+boolean OCI_BindString(OCI_Statement *stmt, const otext *name, otext *data, unsigned int len)
+{
+	return bind(stmt, name, OCI_Bind::STRING, data, len, false, "OCI_BindString");
+}
+
+boolean OCI_BindArraySetSize(OCI_Statement *stmt, unsigned int size)
+{
+	record("OCI_BindArraySetSize", std::to_string(size));
+	if (size == 0)
+		return fail(1, "array size 0");
+
+	stmt->array_size = size;
+	return succeed();
+}
+
+boolean OCI_BindArrayOfInts(OCI_Statement *stmt, const otext *name, int *data, unsigned int)
+{
+	return bind(stmt, name, OCI_Bind::INT, data, 0, true, "OCI_BindArrayOfInts");
+}
+
+boolean OCI_BindArrayOfBigInts(OCI_Statement *stmt, const otext *name, big_int *data, unsigned int)
+{
+	return bind(stmt, name, OCI_Bind::BIGINT, data, 0, true, "OCI_BindArrayOfBigInts");
+}
+
+boolean OCI_BindArrayOfFloats(OCI_Statement *stmt, const otext *name, float *data, unsigned int)
+{
+	return bind(stmt, name, OCI_Bind::FLOAT, data, 0, true, "OCI_BindArrayOfFloats");
+}
+
+boolean OCI_BindArrayOfDoubles(OCI_Statement *stmt, const otext *name, double *data, unsigned int)
+{
+	return bind(stmt, name, OCI_Bind::DOUBLE, data, 0, true, "OCI_BindArrayOfDoubles");
+}
+
+boolean OCI_BindArrayOfStrings(OCI_Statement *stmt, const otext *name, otext *data, unsigned int len, unsigned int)
+{
+	return bind(stmt, name, OCI_Bind::STRING, data, len, true, "OCI_BindArrayOfStrings");
+}
+
+OCI_Bind *OCI_GetBind2(OCI_Statement *stmt, const otext *name)
+{
+	for (size_t i=0; i<stmt->binds.size(); i++)
+	{
+		if (stmt->binds[i].name == name)
+			return &stmt->binds[i];
+	}
+
+	return NULL;
+}
+
+boolean OCI_BindSetNullAtPos(OCI_Bind *bnd, unsigned int position)
+{
+	record("OCI_BindSetNullAtPos", bnd->name + " " + std::to_string(position));
+	bnd->nulls.insert(position);
+	return succeed();
+}
+
+OCI_Resultset *OCI_GetResultset(OCI_Statement *stmt)
+{
+	return stmt->rs;
+}
+
+boolean OCI_ReleaseResultsets(OCI_Statement *stmt)
+{
+	delete stmt->rs;
+	stmt->rs = NULL;
+	return succeed();
+}
+
+boolean OCI_FetchNext(OCI_Resultset *rs)
+{
+	if (rs->next >= rs->rows.size())
+		return FALSE;
+
+	rs->next++;
+	return TRUE;
+}
+
+unsigned int OCI_GetColumnCount(OCI_Resultset *rs)
+{
+	return (unsigned int)rs->columns.size();
+}
+
+OCI_Column *OCI_GetColumn(OCI_Resultset *rs, unsigned int index)
+{
+	return &rs->columns[index - 1];
+}
+
+unsigned int OCI_ColumnGetType(OCI_Column *)
+{
+	return OCI_CDT_TEXT;
+}
+
+const otext *OCI_ColumnGetName(OCI_Column *col)
+{
+	return col->name.c_str();
+}
+
+int OCI_ColumnGetScale(OCI_Column *)
+{
+	return 0;
+}
+
+int OCI_ColumnGetPrecision(OCI_Column *)
+{
+	return 0;
+}
+
+boolean OCI_IsNull(OCI_Resultset *, unsigned int)
+{
+	return FALSE;
+}
+
+int OCI_GetInt(OCI_Resultset *rs, unsigned int index)
+{
+	return atoi(OCI_GetString(rs, index));
+}
+
+big_int OCI_GetBigInt(OCI_Resultset *rs, unsigned int index)
+{
+	return atoll(OCI_GetString(rs, index));
+}
+
+float OCI_GetFloat(OCI_Resultset *rs, unsigned int index)
+{
+	return (float)atof(OCI_GetString(rs, index));
+}
+
+double OCI_GetDouble(OCI_Resultset *rs, unsigned int index)
+{
+	return atof(OCI_GetString(rs, index));
+}
+
+const otext *OCI_GetString(OCI_Resultset *rs, unsigned int index)
+{
+	return rs->rows[rs->next - 1][index - 1].c_str();
+}
+
+OCI_Error *OCI_GetLastError(void)
+{
+	return has_error ? &last_error : NULL;
+}
+
+int OCI_ErrorGetOCICode(OCI_Error *err)
+{
+	return err->code;
+}
+
+const otext *OCI_ErrorGetString(OCI_Error *err)
+{
+	return err->text.c_str();
+}
+
+unsigned int OCI_ErrorGetRow(OCI_Error *err)
+{
+	return err->row;
+}
+
+}
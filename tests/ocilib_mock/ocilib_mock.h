@@ -0,0 +1,51 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef OCILIB_MOCK_H_
+#define OCILIB_MOCK_H_
+
+#include <string>
+#include <vector>
+
+//drives and inspects the mock ocilib. it keeps no server state: every
+//execution succeeds unless a row was set to fail, and a select returns
+//the rows set with set_result
+namespace ocilib_mock {
+
+//every ocilib call since the last reset with its main arguments, e.g.
+//"OCI_BindArrayOfInts :1 3"
+std::vector<std::string> calls();
+//calls whose text starts with prefix
+size_t count(const std::string &prefix);
+void reset();
+
+//the 0 based row of the next execution that oracle rejects with code.
+//without batch error mode the execution stops there, with it the
+//row is reported and the others go through
+void fail_row(unsigned row, int code);
+
+//the values each row of the last execution carried, "1|abc|NULL"
+std::vector<std::string> executed_rows();
+
+//what a select returns, every column as text
+void set_result(const std::vector<std::string> &columns, const std::vector<std::vector<std::string>> &rows);
+
+}
+
+#endif //OCILIB_MOCK_H_
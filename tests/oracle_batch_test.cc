@@ -0,0 +1,186 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//runs DataSourceOracle::execute_batch against the ocilib mock and checks
+//the calls it makes, no oracle server needed, e.g.
+//
+//  g++ -std=c++11 -DSTDEX_HAS_ORACLE -Itests/ocilib_mock -I. tests/oracle_batch_test.cc
+//    tests/ocilib_mock/ocilib_mock.cc data_source_oracle.cc data_slow_query_log.cc
+//    data_query_stats.cc -lpthread
+//
+//exits with the number of failed checks
+
+#include "data_source_oracle.h"
+#include "ocilib_mock.h"
+#include <cstdio>
+using namespace stdex;
+
+static int failed = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			failed++; \
+		} \
+	} while (0)
+
+static std::vector<std::vector<Meta>> make_rows(size_t num)
+{
+	std::vector<std::vector<Meta>> rows(num);
+	for (size_t r=0; r<num; r++)
+	{
+		rows[r].push_back(Meta((i32)(r+1)));
+		rows[r].push_back(Meta("name" + std::to_string(r+1)));
+	}
+
+	return rows;
+}
+
+static void test_binds_arrays(DataSourceOracle &source)
+{
+	ocilib_mock::reset();
+
+	std::vector<std::vector<Meta>> rows = make_rows(3);
+	rows[1][1] = Meta();
+
+	std::vector<RowError> errors;
+	i64 affected = 0;
+	int ret = source.execute_batch("insert into t values (:1, :2)", rows, &errors, &affected);
+
+	CHECK(ret == 0);
+	CHECK(errors.empty());
+	CHECK(affected == 3);
+
+	CHECK(ocilib_mock::count("OCI_BindArraySetSize 3") == 1);
+	CHECK(ocilib_mock::count("OCI_BindArrayOfInts :1 3") == 1);
+	CHECK(ocilib_mock::count("OCI_BindArrayOfStrings :2 3") == 1);
+	CHECK(ocilib_mock::count("OCI_BindSetNullAtPos :2 2") == 1);
+	CHECK(ocilib_mock::count("OCI_Execute") == 1);
+
+	std::vector<string> executed = ocilib_mock::executed_rows();
+	CHECK(executed.size() == 3);
+	CHECK(executed.size() == 3 && executed[0] == "1|name1");
+	CHECK(executed.size() == 3 && executed[1] == "2|NULL");
+	CHECK(executed.size() == 3 && executed[2] == "3|name3");
+
+	//the session goes back to the pool
+	CHECK(ocilib_mock::count("OCI_PoolGetConnection") == ocilib_mock::count("OCI_ConnectionFree"));
+}
+
+static void test_batch_error_mode(DataSourceOracle &source)
+{
+	ocilib_mock::reset();
+
+	//batch error mode has to be on before the execution, or oracle
+	//stops at the first bad row
+	std::vector<std::vector<Meta>> rows = make_rows(4);
+	source.execute_batch("insert into t values (:1, :2)", rows);
+
+	std::vector<string> calls = ocilib_mock::calls();
+	size_t mode_at = calls.size();
+	size_t execute_at = calls.size();
+	for (size_t i=0; i<calls.size(); i++)
+	{
+		if (calls[i] == "OCI_SetBatchErrorMode 1" && mode_at == calls.size())
+			mode_at = i;
+		if (calls[i].compare(0, 11, "OCI_Execute") == 0 && execute_at == calls.size())
+			execute_at = i;
+	}
+
+	CHECK(mode_at < calls.size());
+	CHECK(mode_at < execute_at);
+}
+
+static void test_row_errors(DataSourceOracle &source)
+{
+	ocilib_mock::reset();
+	ocilib_mock::fail_row(1, 1);
+	ocilib_mock::fail_row(3, 12899);
+
+	std::vector<std::vector<Meta>> rows = make_rows(5);
+	std::vector<RowError> errors;
+	i64 affected = 0;
+	int ret = source.execute_batch("insert into t values (:1, :2)", rows, &errors, &affected);
+
+	CHECK(ret == 6);
+	CHECK(affected == 3);
+	CHECK(errors.size() == 2);
+	if (errors.size() == 2)
+	{
+		CHECK(errors[0].row == 1);
+		CHECK(errors[0].errnum == 1);
+		CHECK(errors[1].row == 3);
+		CHECK(errors[1].errnum == 12899);
+		CHECK(!errors[1].error.empty());
+	}
+
+	//the rows around the bad ones still went through
+	std::vector<string> executed = ocilib_mock::executed_rows();
+	CHECK(executed.size() == 3);
+	CHECK(executed.size() == 3 && executed[0] == "1|name1");
+	CHECK(executed.size() == 3 && executed[1] == "3|name3");
+	CHECK(executed.size() == 3 && executed[2] == "5|name5");
+}
+
+static void test_uneven_rows(DataSourceOracle &source)
+{
+	ocilib_mock::reset();
+
+	std::vector<std::vector<Meta>> rows = make_rows(4);
+	rows[2].pop_back();
+	rows[3].push_back(Meta(1.5));
+
+	std::vector<RowError> errors;
+	int ret = source.execute_batch("insert into t values (:1, :2)", rows, &errors);
+
+	CHECK(ret == 4);
+	CHECK(errors.size() == 2);
+	CHECK(errors.size() == 2 && errors[0].row == 2);
+	CHECK(errors.size() == 2 && errors[1].row == 3);
+
+	//rejected before a session is taken
+	CHECK(ocilib_mock::calls().empty());
+}
+
+int main()
+{
+	DataSourceOracle source;
+
+	OraclePoolOptions options;
+	options.max_size = 2;
+
+	int ret = source.open("127.0.0.1", 1521, "app", "secret", "orcl", options);
+	CHECK(ret == 0);
+	if (ret)
+		return failed;
+
+	test_binds_arrays(source);
+	test_batch_error_mode(source);
+	test_row_errors(source);
+	test_uneven_rows(source);
+
+	if (failed)
+		printf("%d checks failed\n", failed);
+	else
+		printf("all checks passed\n");
+
+	return failed;
+}
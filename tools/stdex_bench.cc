@@ -0,0 +1,1196 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//micro benchmarks for Meta and the data sources, printed as one json
+//object so two runs can be compared, e.g.
+//
+//  stdex_bench > before.json
+//  stdex_bench --sqlite-file /tmp/bench.db --filter sqlite/
+//  stdex_bench --host 127.0.0.1 --user app --database app
+//
+//every case is repeated until it ran for --min-ms and reports the time
+//per operation, the memory cases run once and report bytes per cell.
+//the sqlite cases run on :memory: and on a file, the mysql ones when
+//built with mysql and given --host. the tables they use are created
+//and dropped by the benchmark. the coroutine case needs a C++20 build
+
+#include "data_query_stats.h"
+#include "data_source.h"
+#ifdef STDEX_HAS_MYSQL
+#include "data_source_mysql.h"
+#endif
+#ifdef STDEX_HAS_SQLITE
+#include "data_source_sqlite.h"
+#endif
+#if defined(STDEX_HAS_SQLITE) && defined(__cpp_impl_coroutine)
+#include "data_source_coro.h"
+#include <condition_variable>
+#include <mutex>
+#endif
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <new>
+#include <utility>
+using namespace stdex;
+
+//results are added into it so the compiler cannot drop the work
+static volatile uint64_t sink;
+
+//every allocation of the process goes through here, the cases that
+//report memory take the difference around their work. bytes are the
+//requested sizes, without what malloc adds
+static std::atomic<uint64_t> alloc_count(0);
+static std::atomic<uint64_t> alloc_bytes(0);
+
+//gcc takes the free in the replaced delete for one that frees memory
+//from new, which is what replacing both of them is for
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size)
+{
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+#endif
+
+struct BenchResult
+{
+	string name;
+	uint64_t ops;
+	double ns_per_op;
+	//case specific numbers, rows per query and the like
+	std::vector<std::pair<string, double>> extra;
+};
+
+class Bench
+{
+public:
+	Bench(uint64_t min_ms, const string &filter) : _min_ns(min_ms * 1000000), _filter(filter) {}
+
+	bool wanted(const string &name) const
+	{
+		return _filter.empty() || name.find(_filter) != string::npos;
+	}
+
+	//op(n) runs the operation n times. the count doubles until a round
+	//takes min_ms, the last round is the one reported
+	BenchResult *run(const string &name, const std::function<void(uint64_t)> &op)
+	{
+		if (!wanted(name))
+			return NULL;
+
+		op(1);
+
+		uint64_t n = 1;
+		uint64_t ns = 0;
+
+		for (;;)
+		{
+			uint64_t begin = now_ns();
+			op(n);
+			ns = now_ns() - begin;
+
+			if (ns >= _min_ns || n >= (1ull << 32))
+				break;
+
+			//aim a little past min_ms, but never grow more than 100 times
+			uint64_t next = ns ? (uint64_t)(n * 1.2 * _min_ns / ns) : n * 100;
+			n = std::max(n * 2, std::min(next, n * 100));
+		}
+
+		BenchResult result;
+		result.name = name;
+		result.ops = n;
+		result.ns_per_op = (double)ns / n;
+		_results.push_back(std::move(result));
+		return &_results.back();
+	}
+
+	//for cases that time themselves, a single long run or a setup that
+	//cannot be repeated
+	BenchResult *add(const string &name, uint64_t ops, uint64_t ns)
+	{
+		BenchResult result;
+		result.name = name;
+		result.ops = ops;
+		result.ns_per_op = ops ? (double)ns / ops : 0;
+		_results.push_back(std::move(result));
+		return &_results.back();
+	}
+
+	void print() const
+	{
+		printf("{\"min_ms\":%llu,\"cases\":[", (unsigned long long)(_min_ns / 1000000));
+
+		for (size_t i=0; i<_results.size(); i++)
+		{
+			const BenchResult &result = _results[i];
+
+			printf("%s\n{\"name\":", i ? "," : "");
+			print_json_string(result.name);
+			printf(",\"ops\":%llu,\"ns_per_op\":%.1f", (unsigned long long)result.ops, result.ns_per_op);
+
+			for (size_t j=0; j<result.extra.size(); j++)
+			{
+				double val = result.extra[j].second;
+
+				//counts come out whole, not as 2.0003e+06
+				putchar(',');
+				print_json_string(result.extra[j].first);
+				if (val == (double)(int64_t)val)
+					printf(":%lld", (long long)val);
+				else
+					printf(":%.6g", val);
+			}
+
+			putchar('}');
+		}
+
+		printf("\n]}\n");
+	}
+
+	static uint64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+private:
+	static void print_json_string(const string &val)
+	{
+		putchar('"');
+
+		for (size_t i=0; i<val.size(); i++)
+		{
+			unsigned char c = val[i];
+
+			if (c == '"' || c == '\\')
+				printf("\\%c", c);
+			else if (c < 0x20)
+				printf("\\u%04x", c);
+			else
+				putchar(c);
+		}
+
+		putchar('"');
+	}
+
+	uint64_t _min_ns;
+	string _filter;
+	//a deque keeps the results run() and add() handed out in place
+	std::deque<BenchResult> _results;
+};
+
+//one value of every kind a Meta stores differently: the numbers, a
+//string that fits inline and one that goes to the heap
+static std::vector<std::pair<string, Meta>> meta_samples()
+{
+	std::vector<std::pair<string, Meta>> samples;
+	samples.push_back(std::make_pair(string("null"), Meta()));
+	samples.push_back(std::make_pair(string("int"), Meta((int32_t)123456)));
+	samples.push_back(std::make_pair(string("bigint"), Meta((int64_t)1234567890123ll)));
+	samples.push_back(std::make_pair(string("float"), Meta(1.5f)));
+	samples.push_back(std::make_pair(string("double"), Meta(3.14159)));
+	samples.push_back(std::make_pair(string("short_string"), Meta("stdex")));
+	samples.push_back(std::make_pair(string("long_string"), Meta(string(64, 'x'))));
+	return samples;
+}
+
+static void bench_meta(Bench &bench)
+{
+	std::vector<std::pair<string, Meta>> samples = meta_samples();
+
+	for (size_t i=0; i<samples.size(); i++)
+	{
+		const string &type = samples[i].first;
+		const Meta &sample = samples[i].second;
+
+		//strings are built from a std::string the way a caller has them
+		string text = sample.is_string() ? string(sample.string_data(), sample.string_size()) : string();
+
+		bench.run("meta/construct/" + type, [&](uint64_t n) {
+			for (uint64_t k=0; k<n; k++)
+			{
+				if (sample.is_null())
+				{
+					Meta meta;
+					sink = sink + meta.is_null();
+				}
+				else if (sample.is_integer())
+				{
+					Meta meta((int32_t)k);
+					sink = sink + meta.is_integer();
+				}
+				else if (sample.is_bigint())
+				{
+					Meta meta((int64_t)k);
+					sink = sink + meta.is_bigint();
+				}
+				else if (sample.is_float())
+				{
+					Meta meta((float)k);
+					sink = sink + meta.is_float();
+				}
+				else if (sample.is_double())
+				{
+					Meta meta((double)k);
+					sink = sink + meta.is_double();
+				}
+				else
+				{
+					Meta meta(text);
+					sink = sink + meta.string_size();
+				}
+			}
+		});
+
+		bench.run("meta/copy/" + type, [&](uint64_t n) {
+			for (uint64_t k=0; k<n; k++)
+			{
+				Meta meta(sample);
+				sink = sink + meta.is_null();
+			}
+		});
+
+		//two moves per round, the value goes back where it came from
+		BenchResult *result = bench.run("meta/move/" + type, [&](uint64_t n) {
+			Meta from(sample);
+			for (uint64_t k=0; k<n; k++)
+			{
+				Meta to(std::move(from));
+				from = std::move(to);
+			}
+			sink = sink + from.is_null();
+		});
+
+		if (result)
+			result->ns_per_op /= 2;
+
+		bench.run("meta/to_string/" + type, [&](uint64_t n) {
+			for (uint64_t k=0; k<n; k++)
+				sink = sink + sample.to_string().size();
+		});
+	}
+}
+
+//a case whose calls failed timed the error path, it says so. each round
+//starts errors over, so it counts the failures of the reported round
+static void add_errors(BenchResult *result, uint64_t &errors)
+{
+	if (result && errors)
+		result->extra.push_back(std::make_pair(string("errors"), (double)errors));
+	errors = 0;
+}
+
+//the layout Meta had before it became a 16 byte tagged union: the type,
+//the number and a std::string side by side
+struct LegacyMeta
+{
+	int type;
+	union
+	{
+		int32_t number_i32;
+		int64_t number_i64;
+		float number_f32;
+		double number_f64;
+	} number;
+	string text;
+};
+
+//memory a result column of cell_num copies of each sample takes, next
+//to what the old layout took for the same values
+static void bench_meta_memory(Bench &bench)
+{
+	const size_t cell_num = 100000;
+	std::vector<std::pair<string, Meta>> samples = meta_samples();
+
+	for (size_t i=0; i<samples.size(); i++)
+	{
+		string name = "meta/bytes_per_cell/" + samples[i].first;
+		if (!bench.wanted(name))
+			continue;
+
+		const Meta &sample = samples[i].second;
+
+		uint64_t count = alloc_count;
+		uint64_t bytes = alloc_bytes;
+		uint64_t begin = Bench::now_ns();
+
+		std::vector<Meta> cells;
+		cells.reserve(cell_num);
+		for (size_t k=0; k<cell_num; k++)
+			cells.push_back(sample);
+
+		uint64_t ns = Bench::now_ns() - begin;
+		double meta_bytes = (double)(alloc_bytes - bytes) / cell_num;
+		double meta_allocs = (double)(alloc_count - count) / cell_num;
+
+		bytes = alloc_bytes;
+
+		std::vector<LegacyMeta> legacy;
+		legacy.reserve(cell_num);
+		for (size_t k=0; k<cell_num; k++)
+		{
+			LegacyMeta cell;
+			cell.type = 0;
+			cell.number.number_i64 = 0;
+			if (sample.is_string())
+				cell.text.assign(sample.string_data(), sample.string_size());
+			legacy.push_back(std::move(cell));
+		}
+
+		double legacy_bytes = (double)(alloc_bytes - bytes) / cell_num;
+		sink = sink + cells.size() + legacy.size();
+
+		BenchResult *result = bench.add(name, cell_num, ns);
+		result->extra.push_back(std::make_pair(string("bytes_per_cell"), meta_bytes));
+		result->extra.push_back(std::make_pair(string("allocs_per_cell"), meta_allocs));
+		result->extra.push_back(std::make_pair(string("legacy_bytes_per_cell"), legacy_bytes));
+	}
+}
+
+//what the stats hooks of one query cost without a server: the timing
+//a mysql call takes, three laps and the record into its entry
+static void bench_stats_record(Bench &bench)
+{
+	QueryStatsRegistry registry;
+	QueryStats *stats = registry.find("select id, name, score from bench_stdex where id = ?");
+	QueryTiming timing;
+	timing.stats = NULL;
+
+	bench.run("stats/record/query", [&](uint64_t n) {
+		for (uint64_t k=0; k<n; k++)
+		{
+			timing.start();
+			timing.stats = stats;
+			timing.lap(PHASE_PREPARE);
+			timing.lap(PHASE_BIND);
+			timing.lap(PHASE_EXECUTE);
+			timing.rows = 1;
+			timing.bytes = 24;
+			timing.end(0);
+		}
+	});
+}
+
+//the same cases for every source, they only differ in their sql
+struct BenchSchema
+{
+	const char *create;
+	const char *create_insert;
+};
+
+//a row of bench_stdex for query_as
+struct BenchRow
+{
+	int32_t id;
+	string name;
+	double score;
+};
+
+namespace stdex {
+
+template <>
+struct RowMapping<BenchRow>
+{
+	static std::tuple<int32_t &, string &, double &> fields(BenchRow &row)
+	{
+		return std::tie(row.id, row.name, row.score);
+	}
+};
+
+}
+
+//bench_stdex holds row_num rows with ids 0 to row_num-1,
+//bench_stdex_insert starts empty
+template <typename Source>
+static int create_tables(Source &source, const string &prefix, const BenchSchema &schema, size_t row_num)
+{
+	source.execute("drop table if exists bench_stdex");
+	source.execute("drop table if exists bench_stdex_insert");
+
+	if (source.execute(schema.create) || source.execute(schema.create_insert))
+	{
+		fprintf(stderr, "%s: %s\n", prefix.c_str(), source.last_error());
+		return 1;
+	}
+
+	std::vector<std::vector<Meta>> rows(row_num);
+	for (size_t i=0; i<row_num; i++)
+	{
+		rows[i].push_back(Meta((int32_t)i));
+		rows[i].push_back(Meta("name " + std::to_string(i)));
+		rows[i].push_back(Meta(i * 0.5));
+	}
+
+	if (source.insert_batch("insert into bench_stdex (id, name, score) values (?, ?, ?)", rows, 0))
+	{
+		fprintf(stderr, "%s: %s\n", prefix.c_str(), source.last_error());
+		return 1;
+	}
+
+	return 0;
+}
+
+template <typename Source>
+static void drop_tables(Source &source)
+{
+	source.execute("drop table if exists bench_stdex");
+	source.execute("drop table if exists bench_stdex_insert");
+}
+
+template <typename Source>
+static int bench_source(Bench &bench, Source &source, const string &prefix, const BenchSchema &schema, size_t row_num)
+{
+	const char *cases[] = {"query", "query_all", "insert", "decode/meta", "decode/tuple", "decode/struct"};
+	bool wanted = false;
+	for (size_t i=0; i<sizeof(cases) / sizeof(cases[0]); i++)
+		wanted = wanted || bench.wanted(prefix + cases[i]);
+
+	if (!wanted)
+		return 0;
+
+	if (create_tables(source, prefix, schema, row_num))
+		return 1;
+
+	std::vector<Meta> in(1), row;
+	uint64_t seed = 1;
+	uint64_t errors = 0;
+
+	BenchResult *one = bench.run(prefix + "query", [&](uint64_t n) {
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			in[0] = (int32_t)((seed >> 33) % row_num);
+			errors += source.query("select id, name, score from bench_stdex where id = ?", in, row) != 0;
+			sink = sink + row.size();
+		}
+	});
+
+	add_errors(one, errors);
+
+	const size_t range = 100;
+	std::vector<std::vector<Meta>> result;
+
+	BenchResult *all = bench.run(prefix + "query_all", [&](uint64_t n) {
+		std::vector<Meta> bounds(2);
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			int32_t first = (int32_t)((seed >> 33) % (row_num - range));
+			bounds[0] = first;
+			bounds[1] = first + (int32_t)range - 1;
+
+			result.clear();
+			errors += source.query_all("select id, name, score from bench_stdex where id between ? and ?", bounds, result) != 0;
+			sink = sink + result.size();
+		}
+	});
+
+	if (all)
+		all->extra.push_back(std::make_pair(string("rows"), (double)range));
+	add_errors(all, errors);
+
+	BenchResult *insert = bench.run(prefix + "insert", [&](uint64_t n) {
+		std::vector<Meta> values(2);
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			int64_t id = 0;
+			values[0] = "inserted";
+			values[1] = (double)k;
+			errors += source.insert("insert into bench_stdex_insert (name, score) values (?, ?)", values, &id) != 0;
+			sink = sink + id;
+		}
+	});
+
+	add_errors(insert, errors);
+
+	//the same 1000 rows decoded into Meta cells, into tuples of native
+	//types and into a mapped struct, reported per row
+	const size_t decode_rows = 1000;
+	const char *decode_sql = "select id, name, score from bench_stdex where id < 1000";
+	std::vector<Meta> none;
+
+	std::vector<std::vector<Meta>> meta_rows;
+	BenchResult *meta = bench.run(prefix + "decode/meta", [&](uint64_t n) {
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			meta_rows.clear();
+			errors += source.query_all(decode_sql, none, meta_rows) != 0;
+			for (size_t r=0; r<meta_rows.size(); r++)
+				sink = sink + meta_rows[r][0].get_int() + meta_rows[r][1].string_size() + (uint64_t)meta_rows[r][2].get_double();
+		}
+	});
+
+	add_errors(meta, errors);
+
+	std::vector<std::tuple<int32_t, string, double>> tuple_rows;
+	BenchResult *tuple = bench.run(prefix + "decode/tuple", [&](uint64_t n) {
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			tuple_rows.clear();
+			errors += source.query_all(decode_sql, none, tuple_rows) != 0;
+			for (size_t r=0; r<tuple_rows.size(); r++)
+				sink = sink + std::get<0>(tuple_rows[r]) + std::get<1>(tuple_rows[r]).size() + (uint64_t)std::get<2>(tuple_rows[r]);
+		}
+	});
+
+	add_errors(tuple, errors);
+
+	std::vector<BenchRow> struct_rows;
+	BenchResult *mapped = bench.run(prefix + "decode/struct", [&](uint64_t n) {
+		errors = 0;
+		for (uint64_t k=0; k<n; k++)
+		{
+			struct_rows.clear();
+			errors += source.query_as(decode_sql, none, struct_rows) != 0;
+			for (size_t r=0; r<struct_rows.size(); r++)
+				sink = sink + struct_rows[r].id + struct_rows[r].name.size() + (uint64_t)struct_rows[r].score;
+		}
+	});
+
+	add_errors(mapped, errors);
+
+	BenchResult *decoded[] = {meta, tuple, mapped};
+	for (int i=0; i<3; i++)
+	{
+		if (!decoded[i])
+			continue;
+
+		decoded[i]->ops *= decode_rows;
+		decoded[i]->ns_per_op /= decode_rows;
+		if (meta && i)
+			decoded[i]->extra.push_back(std::make_pair(string("speedup"), meta->ns_per_op / decoded[i]->ns_per_op));
+	}
+
+	drop_tables(source);
+	return 0;
+}
+
+#ifdef STDEX_HAS_SQLITE
+static const BenchSchema sqlite_schema = {
+	"create table bench_stdex (id integer primary key, name text, score real)",
+	"create table bench_stdex_insert (id integer primary key, name text, score real)",
+};
+
+static void bench_sqlite(Bench &bench, const string &path, size_t row_num)
+{
+	const char *names[] = {"memory", "file"};
+	string files[] = {":memory:", path};
+
+	for (int i=0; i<2; i++)
+	{
+		if (i == 1)
+			remove(path.c_str());
+
+		DataSourceSqlite source;
+		if (source.open(files[i]))
+		{
+			fprintf(stderr, "sqlite: cannot open %s\n", files[i].c_str());
+			continue;
+		}
+
+		bench_source(bench, source, string("sqlite/") + names[i] + "/", sqlite_schema, row_num);
+		source.close();
+
+		if (i == 1)
+			remove(path.c_str());
+	}
+}
+
+//point selects on a file database through the statement cache and with
+//the cache turned off, which prepares and finalizes on every call
+static void bench_sqlite_cache(Bench &bench, const string &path, size_t row_num)
+{
+	const char *names[] = {"sqlite/file/point_select/cached", "sqlite/file/point_select/uncached"};
+	if (!bench.wanted(names[0]) && !bench.wanted(names[1]))
+		return;
+
+	remove(path.c_str());
+
+	DataSourceSqlite source;
+	if (source.open(path))
+	{
+		fprintf(stderr, "sqlite: cannot open %s\n", path.c_str());
+		return;
+	}
+
+	if (create_tables(source, "sqlite/file/point_select/", sqlite_schema, row_num) == 0)
+	{
+		size_t capacities[] = {source.stmt_cache_capacity(), 0};
+		std::vector<Meta> in(1), row;
+		uint64_t seed = 1;
+		uint64_t errors = 0;
+
+		for (int i=0; i<2; i++)
+		{
+			source.set_stmt_cache_capacity(capacities[i]);
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+
+			BenchResult *result = bench.run(names[i], [&](uint64_t n) {
+				errors = 0;
+				hits = source.stmt_cache_hits();
+				misses = source.stmt_cache_misses();
+
+				for (uint64_t k=0; k<n; k++)
+				{
+					seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+					in[0] = (int32_t)((seed >> 33) % row_num);
+					errors += source.query("select id, name, score from bench_stdex where id = ?", in, row) != 0;
+					sink = sink + row.size();
+				}
+
+				hits = source.stmt_cache_hits() - hits;
+				misses = source.stmt_cache_misses() - misses;
+			});
+
+			if (result)
+			{
+				result->extra.push_back(std::make_pair(string("cache_hits"), (double)hits));
+				result->extra.push_back(std::make_pair(string("cache_misses"), (double)misses));
+				add_errors(result, errors);
+			}
+		}
+
+		drop_tables(source);
+	}
+
+	source.close();
+	remove(path.c_str());
+}
+
+//one large query_all read into the usual vector of rows and into an
+//ArenaRows, run once each. ns_per_op is the time per row to fill the
+//result, free_ns the time to destroy it
+static void bench_sqlite_arena(Bench &bench, size_t big_rows)
+{
+	const char *names[] = {"sqlite/big_result/vector", "sqlite/big_result/arena"};
+	if (!bench.wanted(names[0]) && !bench.wanted(names[1]))
+		return;
+
+	DataSourceSqlite source;
+	if (source.open(":memory:"))
+		return;
+
+	char sql[512];
+	snprintf(sql, sizeof(sql),
+		"insert into bench_stdex_big with recursive n(i) as (select 0 union all select i+1 from n where i < %llu) "
+		"select i, printf('a name long enough for the heap %%d', i), i * 0.5 from n",
+		(unsigned long long)big_rows - 1);
+
+	if (source.execute("create table bench_stdex_big (id integer primary key, name text, score real)") || source.execute(sql))
+	{
+		fprintf(stderr, "sqlite: %s\n", source.last_error());
+		return;
+	}
+
+	std::vector<Meta> in;
+
+	for (int i=0; i<2; i++)
+	{
+		if (!bench.wanted(names[i]))
+			continue;
+
+		uint64_t count = alloc_count;
+		uint64_t bytes = alloc_bytes;
+		uint64_t begin = Bench::now_ns();
+		uint64_t fill_ns, free_ns;
+		size_t fetched;
+		int ret;
+
+		if (i == 0)
+		{
+			std::vector<std::vector<Meta>> *rows = new std::vector<std::vector<Meta>>();
+			ret = source.query_all("select id, name, score from bench_stdex_big", in, *rows);
+			fetched = rows->size();
+			fill_ns = Bench::now_ns() - begin;
+			count = alloc_count - count;
+			bytes = alloc_bytes - bytes;
+
+			begin = Bench::now_ns();
+			delete rows;
+			free_ns = Bench::now_ns() - begin;
+		}
+		else
+		{
+			ArenaRows *rows = new ArenaRows();
+			ret = source.query_all("select id, name, score from bench_stdex_big", in, *rows);
+			fetched = rows->size();
+			fill_ns = Bench::now_ns() - begin;
+			count = alloc_count - count;
+			bytes = alloc_bytes - bytes;
+
+			begin = Bench::now_ns();
+			delete rows;
+			free_ns = Bench::now_ns() - begin;
+		}
+
+		BenchResult *result = bench.add(names[i], fetched, fill_ns);
+		result->extra.push_back(std::make_pair(string("free_ns"), (double)free_ns));
+		result->extra.push_back(std::make_pair(string("allocs"), (double)count));
+		result->extra.push_back(std::make_pair(string("alloc_bytes"), (double)bytes));
+		if (ret)
+			result->extra.push_back(std::make_pair(string("errors"), 1.0));
+	}
+
+	source.close();
+}
+#endif
+
+#if defined(STDEX_HAS_SQLITE) && defined(__cpp_impl_coroutine)
+//a coroutine nobody awaits, it runs until its first co_await on the
+//caller and frees itself when it returns
+struct BenchTask
+{
+	struct promise_type
+	{
+		BenchTask get_return_object() { return BenchTask(); }
+		std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+		std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+//the lookups in flight, the last one to finish wakes the caller
+struct CoroBatch
+{
+	IoPool *pool;
+	std::vector<DataSourceSqlite *> sources;
+	size_t left;
+	uint64_t errors;
+	uint64_t rows;
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	void done(int ret, size_t row_size)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		errors += ret != 0;
+		rows += row_size;
+		if (--left == 0)
+			cond.notify_one();
+	}
+};
+
+//each pool thread owns one connection, so the lookup runs on the
+//connection of the worker that picked it up
+static BenchTask coro_lookup(CoroBatch &batch, int32_t id)
+{
+	std::vector<Meta> in(1), row;
+	in[0] = id;
+
+	int ret = co_await co_run(*batch.pool, [&batch, &in, &row]() {
+		DataSourceSqlite *source = batch.sources[IoPool::current_worker()];
+		return source->query("select id, name, score from bench_stdex where id = ?", in, row);
+	});
+
+	batch.done(ret, row.size());
+}
+
+//coro_num point selects started at once as coroutines and run on an
+//IoPool with one file connection per thread. ns_per_op is the wall time
+//of the whole batch per lookup
+static void bench_sqlite_coro(Bench &bench, const string &path, size_t row_num, size_t coro_num, size_t thread_num)
+{
+	const char *name = "sqlite/file/coro/lookups";
+	if (!bench.wanted(name))
+		return;
+
+	remove(path.c_str());
+
+	std::vector<DataSourceSqlite> sources(thread_num);
+	for (size_t i=0; i<thread_num; i++)
+	{
+		if (sources[i].open(path))
+		{
+			fprintf(stderr, "sqlite: cannot open %s\n", path.c_str());
+			remove(path.c_str());
+			return;
+		}
+	}
+
+	if (create_tables(sources[0], "sqlite/file/coro/", sqlite_schema, row_num) == 0)
+	{
+		CoroBatch batch;
+		batch.left = coro_num;
+		batch.errors = 0;
+		batch.rows = 0;
+		for (size_t i=0; i<thread_num; i++)
+			batch.sources.push_back(&sources[i]);
+
+		uint64_t begin, elapsed;
+		size_t queued;
+		{
+			IoPool pool(thread_num);
+			batch.pool = &pool;
+			uint64_t seed = 1;
+
+			begin = Bench::now_ns();
+			for (size_t i=0; i<coro_num; i++)
+			{
+				seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+				coro_lookup(batch, (int32_t)((seed >> 33) % row_num));
+			}
+			queued = pool.pending();
+
+			std::unique_lock<std::mutex> lock(batch.mutex);
+			batch.cond.wait(lock, [&batch]() { return batch.left == 0; });
+			elapsed = Bench::now_ns() - begin;
+		}
+
+		BenchResult *result = bench.add(name, coro_num, elapsed);
+		result->extra.push_back(std::make_pair(string("threads"), (double)thread_num));
+		result->extra.push_back(std::make_pair(string("queued"), (double)queued));
+		result->extra.push_back(std::make_pair(string("lookups_per_s"), elapsed ? coro_num * 1e9 / elapsed : 0.0));
+		result->extra.push_back(std::make_pair(string("rows"), (double)batch.rows));
+		add_errors(result, batch.errors);
+
+		drop_tables(sources[0]);
+	}
+
+	for (size_t i=0; i<thread_num; i++)
+		sources[i].close();
+	remove(path.c_str());
+}
+#endif
+
+#ifdef STDEX_HAS_MYSQL
+struct MysqlTarget
+{
+	string host, user, password, database;
+	int port;
+};
+
+static const BenchSchema mysql_schema = {
+	"create table bench_stdex (id int primary key, name varchar(64), score double)",
+	"create table bench_stdex_insert (id int auto_increment primary key, name varchar(64), score double)",
+};
+
+//rows of four VARCHAR(4096) columns read with query_all, once holding
+//a few bytes per value and once 1000. the allocations and bytes per
+//row should follow the values, not the declared width
+static void bench_mysql_wide(Bench &bench, DataSourceMysql &source)
+{
+	const char *names[] = {"mysql/wide_varchar/short", "mysql/wide_varchar/long"};
+	const size_t lengths[] = {3, 1000};
+	const size_t row_num = 1000;
+
+	for (int i=0; i<2; i++)
+	{
+		if (!bench.wanted(names[i]))
+			continue;
+
+		source.execute("drop table if exists bench_stdex_wide");
+		if (source.execute("create table bench_stdex_wide (id int primary key, a varchar(4096), b varchar(4096), c varchar(4096), d varchar(4096))"))
+		{
+			fprintf(stderr, "mysql: %s\n", source.last_error());
+			return;
+		}
+
+		string value(lengths[i], 'w');
+		std::vector<std::vector<Meta>> rows(row_num);
+		for (size_t r=0; r<row_num; r++)
+		{
+			rows[r].push_back(Meta((int32_t)r));
+			for (int c=0; c<4; c++)
+				rows[r].push_back(Meta(value));
+		}
+
+		source.insert_batch("insert into bench_stdex_wide (id, a, b, c, d) values (?, ?, ?, ?, ?)", rows, 0);
+
+		std::vector<Meta> in;
+		std::vector<std::vector<Meta>> result;
+		uint64_t errors = 0;
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+		uint64_t fetched = 0;
+
+		BenchResult *res = bench.run(names[i], [&](uint64_t n) {
+			errors = 0;
+			fetched = 0;
+			count = alloc_count;
+			bytes = alloc_bytes;
+
+			for (uint64_t k=0; k<n; k++)
+			{
+				result.clear();
+				errors += source.query_all("select id, a, b, c, d from bench_stdex_wide", in, result) != 0;
+				fetched += result.size();
+			}
+
+			count = alloc_count - count;
+			bytes = alloc_bytes - bytes;
+		});
+
+		//reported per row
+		if (res)
+		{
+			res->ops *= row_num;
+			res->ns_per_op /= row_num;
+			res->extra.push_back(std::make_pair(string("value_bytes"), (double)lengths[i]));
+			res->extra.push_back(std::make_pair(string("allocs_per_row"), fetched ? (double)count / fetched : 0));
+			res->extra.push_back(std::make_pair(string("bytes_per_row"), fetched ? (double)bytes / fetched : 0));
+			add_errors(res, errors);
+		}
+
+		source.execute("drop table if exists bench_stdex_wide");
+	}
+}
+
+#ifdef STDEX_QUERY_STATS
+//the point select and the 100 row range read with no registry set and
+//recording into one. overhead_pct is how much slower recording is, a
+//build without STDEX_QUERY_STATS leaves no hooks to compare against
+static void bench_mysql_stats(Bench &bench, DataSourceMysql &source, size_t row_num)
+{
+	const char *names[] = {"mysql/stats/off/query", "mysql/stats/on/query", "mysql/stats/off/query_all", "mysql/stats/on/query_all"};
+	bool wanted = false;
+	for (int i=0; i<4; i++)
+		wanted = wanted || bench.wanted(names[i]);
+
+	if (!wanted || create_tables(source, "mysql/stats/", mysql_schema, row_num))
+		return;
+
+	QueryStatsRegistry registry;
+	const size_t range = 100;
+	std::vector<Meta> in(1), bounds(2), row;
+	std::vector<std::vector<Meta>> range_rows;
+	uint64_t seed = 1;
+	uint64_t errors = 0;
+	double off_ns = 0;
+
+	for (int i=0; i<4; i++)
+	{
+		bool all = i >= 2;
+		source.set_query_stats(i % 2 ? &registry : NULL);
+
+		BenchResult *result = bench.run(names[i], [&](uint64_t n) {
+			errors = 0;
+			for (uint64_t k=0; k<n; k++)
+			{
+				seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+				int32_t first = (int32_t)((seed >> 33) % (row_num - range));
+
+				if (all)
+				{
+					bounds[0] = first;
+					bounds[1] = first + (int32_t)range - 1;
+					range_rows.clear();
+					errors += source.query_all("select id, name, score from bench_stdex where id between ? and ?", bounds, range_rows) != 0;
+					sink = sink + range_rows.size();
+				}
+				else
+				{
+					in[0] = first;
+					errors += source.query("select id, name, score from bench_stdex where id = ?", in, row) != 0;
+					sink = sink + row.size();
+				}
+			}
+		});
+
+		if (!result)
+			continue;
+
+		if (i % 2 == 0)
+			off_ns = result->ns_per_op;
+		else if (off_ns > 0)
+			result->extra.push_back(std::make_pair(string("overhead_pct"), (result->ns_per_op - off_ns) * 100 / off_ns));
+		add_errors(result, errors);
+	}
+
+	source.set_query_stats(NULL);
+	drop_tables(source);
+}
+#endif
+
+static void bench_mysql(Bench &bench, const MysqlTarget &target, size_t row_num)
+{
+	if (target.host.empty())
+		return;
+
+	DataSourceMysql source;
+	if (source.open(target.host, target.port, target.user, target.password, target.database))
+	{
+		fprintf(stderr, "mysql: %s\n", source.last_error());
+		return;
+	}
+
+	bench_source(bench, source, "mysql/", mysql_schema, row_num);
+	bench_mysql_wide(bench, source);
+#ifdef STDEX_QUERY_STATS
+	bench_mysql_stats(bench, source, row_num);
+#else
+	if (bench.wanted("mysql/stats/on/query") || bench.wanted("mysql/stats/on/query_all"))
+		fprintf(stderr, "built without STDEX_QUERY_STATS, the mysql/stats cases are skipped\n");
+#endif
+	source.close();
+}
+#endif
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: stdex_bench [options]\n"
+		"  --min-ms ms          time each case runs at least, 200 by default\n"
+		"  --filter text        only the cases whose name contains text\n"
+		"  --rows num           rows in the table the queries read, 10000 by default\n"
+		"  --big-rows num       rows of the big result cases, 1000000 by default\n"
+		"  --sqlite-file file   file for the sqlite file cases, stdex_bench.db by default\n"
+		"  --coros num          concurrent lookups of the coroutine case, 10000 by default\n"
+		"  --io-threads num     threads and connections it runs on, 4 by default\n"
+		"  --host host          run the mysql cases against host, with\n"
+		"  --port port            3306 by default\n"
+		"  --user user\n"
+		"  --password password\n"
+		"  --database database\n");
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t min_ms = 200;
+	size_t row_num = 10000;
+	size_t big_rows = 1000000;
+	size_t coro_num = 10000;
+	size_t io_threads = 4;
+	string filter;
+	string sqlite_file = "stdex_bench.db";
+	string host, user, password, database;
+	int port = 3306;
+
+	for (int i=1; i<argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!val)
+		{
+			usage();
+			return 2;
+		}
+
+		i++;
+
+		if (!strcmp(arg, "--min-ms"))
+			min_ms = strtoull(val, NULL, 10);
+		else if (!strcmp(arg, "--filter"))
+			filter = val;
+		else if (!strcmp(arg, "--rows"))
+			row_num = strtoul(val, NULL, 10);
+		else if (!strcmp(arg, "--big-rows"))
+			big_rows = strtoul(val, NULL, 10);
+		else if (!strcmp(arg, "--sqlite-file"))
+			sqlite_file = val;
+		else if (!strcmp(arg, "--coros"))
+			coro_num = strtoul(val, NULL, 10);
+		else if (!strcmp(arg, "--io-threads"))
+			io_threads = strtoul(val, NULL, 10);
+		else if (!strcmp(arg, "--host"))
+			host = val;
+		else if (!strcmp(arg, "--port"))
+			port = atoi(val);
+		else if (!strcmp(arg, "--user"))
+			user = val;
+		else if (!strcmp(arg, "--password"))
+			password = val;
+		else if (!strcmp(arg, "--database"))
+			database = val;
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	if (row_num < 1000)
+		row_num = 1000;
+	if (big_rows < 1)
+		big_rows = 1;
+	if (coro_num < 1)
+		coro_num = 1;
+	if (io_threads < 1)
+		io_threads = 1;
+
+	Bench bench(min_ms, filter);
+
+	bench_meta(bench);
+	bench_meta_memory(bench);
+	bench_stats_record(bench);
+
+#ifdef STDEX_HAS_SQLITE
+	bench_sqlite(bench, sqlite_file, row_num);
+	bench_sqlite_cache(bench, sqlite_file, row_num);
+	bench_sqlite_arena(bench, big_rows);
+#else
+	(void)sqlite_file;
+	(void)big_rows;
+#endif
+
+#if defined(STDEX_HAS_SQLITE) && defined(__cpp_impl_coroutine)
+	bench_sqlite_coro(bench, sqlite_file, row_num, coro_num, io_threads);
+#else
+	(void)coro_num;
+	(void)io_threads;
+#endif
+
+#ifdef STDEX_HAS_MYSQL
+	MysqlTarget target;
+	target.host = host;
+	target.port = port;
+	target.user = user;
+	target.password = password;
+	target.database = database;
+	bench_mysql(bench, target, row_num);
+#else
+	(void)port;
+	if (!host.empty())
+		fprintf(stderr, "built without mysql, the mysql cases are skipped\n");
+#endif
+
+	bench.print();
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//drives a workload file against sqlite or mysql and prints throughput
+//and latency percentiles, e.g.
+//
+//  stdex_replay --sqlite app.db --threads 8 --duration 30 --rate 2000 app.workload
+//  stdex_replay --host 127.0.0.1 --user app --database app --json app.workload
+//
+//see data_workload.h for the workload file format
+
+#include "data_workload.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+using namespace stdex;
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: stdex_replay [options] workload\n"
+		"  --sqlite file        run against a sqlite database\n"
+		"  --host host          run against mysql, with\n"
+		"  --port port            3306 by default\n"
+		"  --user user\n"
+		"  --password password\n"
+		"  --database name\n"
+		"  --threads n          connections driving calls, 4 by default\n"
+		"  --duration seconds   10 by default, 0 runs until --calls\n"
+		"  --calls n            stop after n calls\n"
+		"  --rate n             calls per second over all threads\n"
+		"  --seed n\n"
+		"  --json               print the report as json\n");
+}
+
+static void print_text(const Workload &workload, const WorkloadReport &report)
+{
+	printf("%llu calls, %llu errors in %.3f s, %.1f calls/s\n",
+		(unsigned long long)report.calls, (unsigned long long)report.errors,
+		report.elapsed_us / 1e6, report.throughput());
+
+	if (report.failed_threads)
+		printf("%zu threads could not connect\n", report.failed_threads);
+
+	printf("%10s %8s %10s %10s %10s %10s  %s\n", "calls", "errors", "rows", "p50 us", "p99 us", "p999 us", "sql");
+
+	for (size_t i=0; i<=report.statements.size(); i++)
+	{
+		bool total = i == report.statements.size();
+		const HistogramSnapshot &latency = total ? report.latency : report.statements[i].latency;
+		uint64_t rows = 0;
+
+		if (!total)
+			rows = report.statements[i].rows;
+		else
+		{
+			for (size_t j=0; j<report.statements.size(); j++)
+				rows += report.statements[j].rows;
+		}
+
+		printf("%10llu %8llu %10llu %10.1f %10.1f %10.1f  %s\n",
+			(unsigned long long)(total ? report.calls : report.statements[i].calls),
+			(unsigned long long)(total ? report.errors : report.statements[i].errors),
+			(unsigned long long)rows,
+			latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3,
+			total ? "(all)" : workload.statements[i].sql.c_str());
+	}
+}
+
+static void print_json_string(const string &val)
+{
+	putchar('"');
+
+	for (size_t i=0; i<val.size(); i++)
+	{
+		unsigned char c = val[i];
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+
+	putchar('"');
+}
+
+static void print_json_latency(const HistogramSnapshot &latency)
+{
+	printf("\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"mean_us\":%.1f",
+		latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3,
+		latency.count ? latency.sum_ns / 1e3 / latency.count : 0.0);
+}
+
+static void print_json(const Workload &workload, const WorkloadReport &report)
+{
+	printf("{\"elapsed_us\":%llu,\"calls\":%llu,\"errors\":%llu,\"throughput\":%.1f,\"failed_threads\":%zu,",
+		(unsigned long long)report.elapsed_us, (unsigned long long)report.calls,
+		(unsigned long long)report.errors, report.throughput(), report.failed_threads);
+	print_json_latency(report.latency);
+	printf(",\"statements\":[");
+
+	for (size_t i=0; i<report.statements.size(); i++)
+	{
+		const WorkloadStatementReport &statement = report.statements[i];
+
+		printf("%s{\"sql\":", i ? "," : "");
+		print_json_string(workload.statements[i].sql);
+		printf(",\"calls\":%llu,\"errors\":%llu,\"rows\":%llu,",
+			(unsigned long long)statement.calls, (unsigned long long)statement.errors,
+			(unsigned long long)statement.rows);
+		print_json_latency(statement.latency);
+		putchar('}');
+	}
+
+	printf("]}\n");
+}
+
+int main(int argc, char *argv[])
+{
+	WorkloadOptions options;
+	options.threads = 4;
+
+	string sqlite;
+	string host, user, password, database;
+	int port = 3306;
+	bool json = false;
+	const char *path = NULL;
+
+	for (int i=1; i<argc; i++)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(arg, "--json"))
+		{
+			json = true;
+			continue;
+		}
+
+		if (arg[0] != '-')
+		{
+			path = arg;
+			continue;
+		}
+
+		if (!val)
+		{
+			usage();
+			return 2;
+		}
+
+		i++;
+
+		if (!strcmp(arg, "--sqlite"))
+			sqlite = val;
+		else if (!strcmp(arg, "--host"))
+			host = val;
+		else if (!strcmp(arg, "--port"))
+			port = atoi(val);
+		else if (!strcmp(arg, "--user"))
+			user = val;
+		else if (!strcmp(arg, "--password"))
+			password = val;
+		else if (!strcmp(arg, "--database"))
+			database = val;
+		else if (!strcmp(arg, "--threads"))
+			options.threads = strtoul(val, NULL, 10);
+		else if (!strcmp(arg, "--duration"))
+			options.duration_ms = (uint64_t)(strtod(val, NULL) * 1000);
+		else if (!strcmp(arg, "--calls"))
+			options.max_calls = strtoull(val, NULL, 10);
+		else if (!strcmp(arg, "--rate"))
+			options.rate = strtod(val, NULL);
+		else if (!strcmp(arg, "--seed"))
+			options.seed = strtoull(val, NULL, 10);
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+
+	if (!path || sqlite.empty() == host.empty() || (!options.duration_ms && !options.max_calls))
+	{
+		usage();
+		return 2;
+	}
+
+	Workload workload;
+	string error;
+	int line = workload.load(path, error);
+	if (line)
+	{
+		if (line < 0)
+			fprintf(stderr, "%s\n", error.c_str());
+		else
+			fprintf(stderr, "%s:%d: %s\n", path, line, error.c_str());
+		return 2;
+	}
+
+	WorkloadReport report;
+	int ret = 1;
+
+	if (!sqlite.empty())
+	{
+#ifdef STDEX_HAS_SQLITE
+		ret = run_workload(sqlite, workload, options, report);
+#else
+		fprintf(stderr, "built without sqlite\n");
+		return 2;
+#endif
+	}
+	else
+	{
+#ifdef STDEX_HAS_MYSQL
+		MysqlPoolOptions pool_options;
+		pool_options.host = host;
+		pool_options.port = port;
+		pool_options.user = user;
+		pool_options.passwd = password;
+		pool_options.dbase = database;
+		pool_options.min_size = options.threads;
+		pool_options.max_size = options.threads;
+
+		MysqlPool pool;
+		if (pool.open(pool_options))
+		{
+			fprintf(stderr, "mysql: %s\n", pool.last_error().c_str());
+			return 1;
+		}
+
+		ret = run_workload(pool, workload, options, report);
+		pool.close();
+#else
+		(void)port;
+		fprintf(stderr, "built without mysql\n");
+		return 2;
+#endif
+	}
+
+	if (ret == 1)
+	{
+		fprintf(stderr, "%s: no statements to run\n", path);
+		return 2;
+	}
+
+	if (ret == 2)
+	{
+		fprintf(stderr, "no thread could connect\n");
+		return 1;
+	}
+
+	if (json)
+		print_json(workload, report);
+	else
+		print_text(workload, report);
+
+	return report.errors ? 1 : 0;
+}